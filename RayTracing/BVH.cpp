@@ -0,0 +1,677 @@
+#include "BVH.h"
+#include "CpuTracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+using namespace std;
+using namespace glm;
+
+const int binCount = 12;      //centroid bins evaluated per axis
+const int maxLeafSize = packetWidth; //larger leaves are split even when the SAH prefers not to
+const float traversalCost = 1.0f; //cost of visiting a node, relative to one intersection test
+const float boundsPad = 1e-4f; //keeps flat boxes from losing hits to rounding
+const int stackSize = maxBVHDepth;
+//below this depth nodes are split at the median, so even 2^32 primitives end
+//in leaves by maxBVHDepth
+const int medianDepth = maxBVHDepth - 32;
+
+//for the steps every traversal repeats, which must not become calls however
+//many traversal functions use them
+#ifdef _MSC_VER
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+// --------------------------------------------------------------------------
+// Construction
+
+struct Bounds {
+	vec3 lo = vec3(numeric_limits<float>::max());
+	vec3 hi = vec3(-numeric_limits<float>::max());
+
+	void Grow(vec3 p) { lo = min(lo, p); hi = max(hi, p); }
+	void Grow(const Bounds &b) { lo = min(lo, b.lo); hi = max(hi, b.hi); }
+	float Area() const
+	{
+		vec3 e = hi - lo;
+		return (e.x < 0) ? 0 : e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+struct Bin {
+	Bounds bounds;
+	int count = 0;
+};
+
+static void MakeLeaf(BVHNode &node, uint32_t first, uint32_t count)
+{
+	node.leftFirst = first;
+	node.count = count;
+}
+
+//which of the scene's arrays a primitive id refers to: ids below numTriangles
+//are triangles, then come the spheres and last the instances
+enum PrimitiveKind { TriangleKind, SphereKind, InstanceKind };
+
+struct PrimitiveIds {
+	uint32_t numTriangles;
+	uint32_t numSpheres;
+
+	PrimitiveKind Kind(uint32_t prim) const
+	{
+		return (prim < numTriangles) ? TriangleKind : (prim < numTriangles + numSpheres) ? SphereKind : InstanceKind;
+	}
+};
+
+//copy the triangles, spheres and instances of a scene into the order given
+static void ReorderScene(Scene &scene, const vector<uint32_t> &order, PrimitiveIds ids)
+{
+	TriangleLanes triangles;
+	SphereLanes spheres;
+	vector<uint32_t> triangleMaterials, sphereMaterials;
+	vector<Instance> instances;
+	triangles.Resize(ids.numTriangles);
+	spheres.Resize(ids.numSpheres);
+	triangleMaterials.reserve(ids.numTriangles);
+	sphereMaterials.reserve(ids.numSpheres);
+	instances.reserve(scene.InstanceCount());
+	for (uint32_t prim : order)
+	{
+		switch (ids.Kind(prim))
+		{
+		case TriangleKind:
+			triangles.Set(triangleMaterials.size(), scene.triangles.A(prim), scene.triangles.B(prim),
+				scene.triangles.C(prim));
+			triangleMaterials.push_back(scene.triangleMaterials[prim]);
+			break;
+		case SphereKind:
+		{
+			uint32_t sphere = prim - ids.numTriangles;
+			spheres.Set(sphereMaterials.size(), scene.spheres.Center(sphere), scene.spheres.r[sphere]);
+			sphereMaterials.push_back(scene.sphereMaterials[sphere]);
+			break;
+		}
+		case InstanceKind:
+			instances.push_back(scene.instances[prim - ids.numTriangles - ids.numSpheres]);
+			break;
+		}
+	}
+	scene.triangles = move(triangles);
+	scene.spheres = move(spheres);
+	scene.triangleMaterials = move(triangleMaterials);
+	scene.sphereMaterials = move(sphereMaterials);
+	scene.instances = move(instances);
+}
+
+//build each mesh's hierarchy on its own, in mesh space, as a scene of nothing
+//but its triangles, and put the triangles back in leaf order
+static void BuildMeshes(Scene &scene, vector<BVH> &meshBVHs)
+{
+	meshBVHs.assign(scene.meshes.size(), BVH());
+	for (size_t m = 0; m < scene.meshes.size(); m++)
+	{
+		const Mesh &mesh = scene.meshes[m];
+		TriangleLanes &lanes = scene.meshTriangles;
+		Scene part;
+		part.triangles.Resize(mesh.count);
+		part.triangleMaterials.assign(mesh.count, 0);
+		for (uint32_t i = 0; i < mesh.count; i++)
+			part.triangles.Set(i, lanes.A(mesh.first + i), lanes.B(mesh.first + i), lanes.C(mesh.first + i));
+		BuildBVH(meshBVHs[m], part);
+		for (uint32_t i = 0; i < mesh.count; i++)
+			lanes.Set(mesh.first + i, part.triangles.A(i), part.triangles.B(i), part.triangles.C(i));
+	}
+}
+
+//world bounds of an instance: the corners of its mesh's box, placed
+static Bounds InstanceBounds(const Instance &instance, const BVHNode &meshRoot)
+{
+	mat4 placement = inverse(mat4(instance.toMesh));
+	Bounds bounds;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		vec3 p((corner & 1) ? meshRoot.boundsMax.x : meshRoot.boundsMin.x,
+			(corner & 2) ? meshRoot.boundsMax.y : meshRoot.boundsMin.y,
+			(corner & 4) ? meshRoot.boundsMax.z : meshRoot.boundsMin.z);
+		bounds.Grow(vec3(placement * vec4(p, 1)));
+	}
+	return bounds;
+}
+
+double BuildBVH(BVH &bvh, Scene &scene)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	PrimitiveIds ids = { (uint32_t)scene.TriangleCount(), (uint32_t)scene.SphereCount() };
+	uint32_t count = ids.numTriangles + ids.numSpheres + (uint32_t)scene.InstanceCount();
+	bvh.nodes.clear();
+	bvh.meshRoots.clear();
+	BuildLightTree(bvh.lightNodes, scene.lights);
+	if (count == 0)
+		return 0;
+	vector<BVH> meshBVHs;
+	BuildMeshes(scene, meshBVHs);
+
+	//bounds and centroids of every primitive
+	vector<uint32_t> primitives(count);
+	vector<Bounds> primBounds(count);
+	vector<vec3> centroids(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		Bounds &b = primBounds[i];
+		switch (ids.Kind(i))
+		{
+		case TriangleKind:
+			b.Grow(scene.triangles.A(i));
+			b.Grow(scene.triangles.B(i));
+			b.Grow(scene.triangles.C(i));
+			break;
+		case SphereKind:
+		{
+			uint32_t sphere = i - ids.numTriangles;
+			b.Grow(scene.spheres.Center(sphere) - scene.spheres.r[sphere]);
+			b.Grow(scene.spheres.Center(sphere) + scene.spheres.r[sphere]);
+			break;
+		}
+		case InstanceKind:
+		{
+			const Instance &instance = scene.instances[i - ids.numTriangles - ids.numSpheres];
+			b = InstanceBounds(instance, meshBVHs[instance.mesh].nodes[0]);
+			break;
+		}
+		}
+		b.lo -= boundsPad;
+		b.hi += boundsPad;
+		centroids[i] = (b.lo + b.hi) * 0.5f;
+		primitives[i] = i;
+	}
+
+	//children are allocated in pairs, so a tree of n leaves has 2n - 1 nodes
+	bvh.nodes.reserve(2 * count);
+	bvh.nodes.push_back(BVHNode());
+	MakeLeaf(bvh.nodes[0], 0, count);
+
+	vector<pair<uint32_t, int>> pending = { { 0, 1 } }; //node and its depth
+	while (!pending.empty())
+	{
+		uint32_t nodeIndex = pending.back().first;
+		int depth = pending.back().second;
+		pending.pop_back();
+
+		uint32_t first = bvh.nodes[nodeIndex].leftFirst;
+		uint32_t n = bvh.nodes[nodeIndex].count;
+
+		Bounds bounds, centroidBounds;
+		PrimitiveKind firstKind = ids.Kind(primitives[first]);
+		bool mixed = false;
+		for (uint32_t i = first; i < first + n; i++)
+		{
+			bounds.Grow(primBounds[primitives[i]]);
+			centroidBounds.Grow(centroids[primitives[i]]);
+			mixed |= ids.Kind(primitives[i]) != firstKind;
+		}
+		bvh.nodes[nodeIndex].boundsMin = bounds.lo;
+		bvh.nodes[nodeIndex].boundsMax = bounds.hi;
+		if (n <= 1)
+			continue;
+		bool deep = depth >= medianDepth;
+
+		//evaluate the SAH at the bin boundaries along each axis
+		float bestCost = numeric_limits<float>::max();
+		int bestAxis = -1, bestSplit = 0;
+		vec3 extent = centroidBounds.hi - centroidBounds.lo;
+		for (int axis = 0; axis < 3 && !deep; axis++)
+		{
+			if (extent[axis] <= 0)
+				continue;
+			Bin bins[binCount];
+			float scale = binCount / extent[axis];
+			for (uint32_t i = first; i < first + n; i++)
+			{
+				uint32_t prim = primitives[i];
+				int b = std::min(binCount - 1, (int)((centroids[prim][axis] - centroidBounds.lo[axis]) * scale));
+				bins[b].count++;
+				bins[b].bounds.Grow(primBounds[prim]);
+			}
+
+			float leftArea[binCount - 1];
+			int leftCount[binCount - 1];
+			Bounds sweep;
+			int sum = 0;
+			for (int b = 0; b < binCount - 1; b++)
+			{
+				sweep.Grow(bins[b].bounds);
+				sum += bins[b].count;
+				leftArea[b] = sweep.Area();
+				leftCount[b] = sum;
+			}
+			sweep = Bounds();
+			sum = 0;
+			for (int b = binCount - 1; b > 0; b--)
+			{
+				sweep.Grow(bins[b].bounds);
+				sum += bins[b].count;
+				float cost = leftArea[b - 1] * leftCount[b - 1] + sweep.Area() * sum;
+				if (leftCount[b - 1] > 0 && sum > 0 && cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		//compare against intersecting everything here, in the same units; with
+		//coincident centroids no SAH split exists and big ranges are just halved.
+		//Leaves must hold a single kind of primitive, so mixed ones split by kind
+		float leafCost = bounds.Area() * n;
+		float splitCost = bestCost + traversalCost * bounds.Area();
+		bool split = (bestAxis >= 0 && splitCost < leafCost) || n > (uint32_t)maxLeafSize;
+		if (!split && !mixed)
+			continue;
+
+		uint32_t *begin = &primitives[first];
+		uint32_t *middle;
+		if (deep)
+		{
+			//halved with the kinds in runs, so that a leaf ends up with one kind
+			sort(begin, begin + n, [&](uint32_t a, uint32_t b) { return ids.Kind(a) < ids.Kind(b); });
+			middle = begin + n / 2;
+		}
+		else if (!split)
+			middle = partition(begin, begin + n, [&](uint32_t prim) { return ids.Kind(prim) == firstKind; });
+		else if (bestAxis >= 0)
+		{
+			float scale = binCount / extent[bestAxis];
+			float lo = centroidBounds.lo[bestAxis];
+			middle = partition(begin, begin + n, [&](uint32_t prim) {
+				return std::min(binCount - 1, (int)((centroids[prim][bestAxis] - lo) * scale)) < bestSplit;
+			});
+		}
+		else
+			middle = begin + n / 2;
+
+		uint32_t leftCountFinal = (uint32_t)(middle - begin);
+		uint32_t left = (uint32_t)bvh.nodes.size();
+		bvh.nodes.push_back(BVHNode());
+		bvh.nodes.push_back(BVHNode());
+		MakeLeaf(bvh.nodes[left], first, leftCountFinal);
+		MakeLeaf(bvh.nodes[left + 1], first + leftCountFinal, n - leftCountFinal);
+
+		bvh.nodes[nodeIndex].leftFirst = left;
+		bvh.nodes[nodeIndex].count = 0;
+		pending.push_back({ left + 1, depth + 1 });
+		pending.push_back({ left, depth + 1 });
+	}
+
+	//point each leaf at its primitives once the scene is in leaf order: leaves
+	//tile the primitive list, and a leaf's first index counts only its own kind
+	vector<uint32_t> leafAt(count, 0);
+	for (uint32_t i = 0; i < (uint32_t)bvh.nodes.size(); i++)
+		if (bvh.nodes[i].IsLeaf())
+			leafAt[bvh.nodes[i].leftFirst] = i;
+	uint32_t before[3] = {}; //primitives of each kind in earlier leaves
+	for (uint32_t i = 0; i < count; )
+	{
+		BVHNode &leaf = bvh.nodes[leafAt[i]];
+		uint32_t n = leaf.count;
+		PrimitiveKind kind = ids.Kind(primitives[i]);
+		leaf.leftFirst = before[kind];
+		if (kind == SphereKind)
+			leaf.count |= sphereLeafBit;
+		else if (kind == InstanceKind)
+			leaf.count |= instanceLeafBit;
+		before[kind] += n;
+		i += n;
+	}
+	ReorderScene(scene, primitives, ids);
+
+	//the meshes' hierarchies go after the scene's, their leaves pointing into
+	//the shared mesh triangle array
+	for (size_t m = 0; m < meshBVHs.size(); m++)
+	{
+		uint32_t offset = (uint32_t)bvh.nodes.size();
+		bvh.meshRoots.push_back(offset);
+		for (BVHNode node : meshBVHs[m].nodes)
+		{
+			node.leftFirst += node.IsLeaf() ? scene.meshes[m].first : offset;
+			bvh.nodes.push_back(node);
+		}
+	}
+
+	return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+int BVHDepth(const BVH &bvh, uint32_t root)
+{
+	int deepest = 0;
+	vector<pair<uint32_t, int>> pending = { { root, 1 } };
+	while (!bvh.nodes.empty() && !pending.empty())
+	{
+		pair<uint32_t, int> top = pending.back();
+		pending.pop_back();
+		const BVHNode &node = bvh.nodes[top.first];
+		deepest = std::max(deepest, top.second);
+		if (!node.IsLeaf())
+		{
+			pending.push_back({ node.leftFirst, top.second + 1 });
+			pending.push_back({ node.leftFirst + 1, top.second + 1 });
+		}
+	}
+	return deepest;
+}
+
+vector<int32_t> BVHSkipLinks(const BVH &bvh)
+{
+	//children are always stored after their parent, so each node's link is
+	//known by the time its children are reached
+	vector<int32_t> skip(bvh.nodes.size(), -1);
+	for (size_t i = 0; i < bvh.nodes.size(); i++)
+	{
+		const BVHNode &node = bvh.nodes[i];
+		if (!node.IsLeaf())
+		{
+			skip[node.leftFirst] = node.leftFirst + 1;
+			skip[node.leftFirst + 1] = skip[i];
+		}
+	}
+	return skip;
+}
+
+// --------------------------------------------------------------------------
+// Traversal
+
+//entry distance of the ray into the box within [0, tMax], or infinity on a miss
+static ALWAYS_INLINE float IntersectBounds(const BVHNode &node, vec3 origin, vec3 invRay, float tMax)
+{
+	vec3 t0 = (node.boundsMin - origin) * invRay;
+	vec3 t1 = (node.boundsMax - origin) * invRay;
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return (enter <= exit) ? enter : numeric_limits<float>::infinity();
+}
+
+//reciprocal direction with zero components nudged away from 0 to avoid NaNs
+static inline vec3 InverseRay(vec3 ray)
+{
+	vec3 inv;
+	for (int i = 0; i < 3; i++)
+		inv[i] = 1 / ((std::abs(ray[i]) > 1e-20f) ? ray[i] : copysign(1e-20f, ray[i]));
+	return inv;
+}
+
+void IntersectCounts::Add(const IntersectCounts &other)
+{
+	nodes += other.nodes;
+	spheres += other.spheres;
+	triangles += other.triangles;
+	planes += other.planes;
+}
+
+//a triangle or sphere leaf's primitives are tested by one kernel call; the
+//tests of an instance leaf are counted as its meshes are traversed
+static inline void CountLeaf(IntersectCounts *counts, const BVHNode &node)
+{
+	if (counts && !node.IsInstanceLeaf())
+		(node.IsSphereLeaf() ? counts->spheres : counts->triangles) += node.Count();
+}
+
+//move a ray into an instance's mesh space; the direction is not normalized
+//again, so distances along the ray are the same in both spaces
+static inline void ToMesh(const Instance &instance, vec3 &origin, vec3 &ray)
+{
+	origin = instance.toMesh * vec4(origin, 1);
+	ray = mat3(instance.toMesh) * ray;
+}
+
+template <bool inMesh>
+static void ClosestInTree(const Scene &scene, const BVH &bvh, uint32_t root, vec3 origin, vec3 ray, float &closest,
+	Hit &hit, int instance, IntersectCounts *counts);
+
+//closest hit in the meshes of an instance leaf's instances
+static void ClosestInInstances(const Scene &scene, const BVH &bvh, const BVHNode &node, vec3 origin, vec3 ray,
+	float &minT, Hit &hit, IntersectCounts *counts)
+{
+	for (uint32_t i = node.leftFirst; i < node.leftFirst + node.Count(); i++)
+	{
+		const Instance &placed = scene.instances[i];
+		vec3 meshOrigin = origin, meshRay = ray;
+		ToMesh(placed, meshOrigin, meshRay);
+		ClosestInTree<true>(scene, bvh, bvh.meshRoots[placed.mesh], meshOrigin, meshRay, minT, hit, (int)i, counts);
+	}
+}
+
+//closest hit below root, improving on minT: the scene's hierarchy, or inMesh
+//the hierarchy of the mesh placed by instance, with the ray in its space
+template <bool inMesh>
+static void ClosestInTree(const Scene &scene, const BVH &bvh, uint32_t root, vec3 origin, vec3 ray, float &closest,
+	Hit &hit, int instance, IntersectCounts *counts)
+{
+	//kept in a local, which the compiler need not assume hit aliases
+	float minT = closest;
+	const float infinity = numeric_limits<float>::infinity();
+	const IntersectKernels &kernels = Kernels();
+	const TriangleLanes &triangles = inMesh ? scene.meshTriangles : scene.triangles;
+	vec3 invRay = InverseRay(ray);
+	uint32_t stack[stackSize];
+	float stackT[stackSize]; //entry distance of each pending node
+	int top = 0;
+	uint32_t nodeIndex = root;
+	if (counts)
+		counts->nodes++;
+	if (IntersectBounds(bvh.nodes[root], origin, invRay, minT) == infinity)
+		return;
+
+	for (;;)
+	{
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		if (!inMesh && node.IsInstanceLeaf())
+			ClosestInInstances(scene, bvh, node, origin, ray, minT, hit, counts);
+		else if (node.IsLeaf())
+		{
+			//a leaf is at most packetWidth primitives of one kind: one kernel call
+			CountLeaf(counts, node);
+			uint32_t lanes = (1u << node.Count()) - 1;
+			bool spheres = !inMesh && node.IsSphereLeaf();
+			float t[packetWidth];
+			uint32_t mask = (spheres
+				? kernels.spheres(scene.spheres, node.leftFirst, origin, ray, 0, minT, t)
+				: kernels.triangles(triangles, node.leftFirst, origin, ray, 0, minT, t)) & lanes;
+			for (int i = 0; mask; i++, mask >>= 1)
+			{
+				if ((mask & 1) && t[i] < minT)
+				{
+					minT = t[i];
+					hit.objectType = spheres ? 0 : (inMesh ? 3 : 2);
+					hit.index = node.leftFirst + i;
+					hit.instance = instance;
+				}
+			}
+		}
+		else
+		{
+			//visit the nearer child first, and skip children beyond the closest hit
+			uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+			float tNear = IntersectBounds(bvh.nodes[near], origin, invRay, minT);
+			float tFar = IntersectBounds(bvh.nodes[far], origin, invRay, minT);
+			if (counts)
+				counts->nodes += 2;
+			if (tFar < tNear)
+			{
+				swap(near, far);
+				swap(tNear, tFar);
+			}
+			if (tNear != infinity)
+			{
+				if (tFar != infinity)
+				{
+					stackT[top] = tFar;
+					stack[top++] = far;
+				}
+				nodeIndex = near;
+				continue;
+			}
+		}
+		//resume with the next pending node still in front of the closest hit
+		while (top > 0 && stackT[top - 1] > minT)
+			top--;
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top];
+	}
+	closest = minT;
+}
+
+bool IntersectClosest(const Scene &scene, const BVH &bvh, vec3 origin, vec3 ray, Hit &hit, IntersectCounts *counts)
+{
+	float minT = numeric_limits<float>::infinity();
+	hit = Hit();
+
+	for (int i = 0; i < (int)scene.PlaneCount(); i++)
+	{
+		float test = IntersectPlane(scene.planeNormals[i], scene.planePoints[i], origin, ray);
+		if (test > 0 && test < minT)
+		{
+			minT = test;
+			hit.objectType = 1;
+			hit.index = i;
+		}
+	}
+
+	if (counts)
+		counts->planes += scene.PlaneCount();
+
+	if (!bvh.nodes.empty())
+		ClosestInTree<false>(scene, bvh, 0, origin, ray, minT, hit, -1, counts);
+
+	if (hit.objectType < 0)
+		return false;
+	hit.t = minT;
+	return true;
+}
+
+template <bool inMesh>
+static bool AnyInTree(const Scene &scene, const BVH &bvh, const IntersectKernels &kernels, uint32_t root,
+	vec3 origin, vec3 ray, float dist, int *leaf, IntersectCounts *counts);
+
+//true if anything in the mesh of one of an instance leaf's instances is hit
+//with 0 <= t <= dist
+static bool InstancesOcclude(const Scene &scene, const BVH &bvh, const IntersectKernels &kernels,
+	const BVHNode &node, vec3 origin, vec3 ray, float dist, IntersectCounts *counts)
+{
+	for (uint32_t i = node.leftFirst; i < node.leftFirst + node.Count(); i++)
+	{
+		const Instance &placed = scene.instances[i];
+		vec3 meshOrigin = origin, meshRay = ray;
+		ToMesh(placed, meshOrigin, meshRay);
+		if (AnyInTree<true>(scene, bvh, kernels, bvh.meshRoots[placed.mesh], meshOrigin, meshRay, dist, nullptr,
+			counts))
+			return true;
+	}
+	return false;
+}
+
+//true if any primitive of a leaf is hit with 0 <= t <= dist
+template <bool inMesh>
+static inline bool LeafOccludes(const Scene &scene, const BVH &bvh, const BVHNode &node,
+	const IntersectKernels &kernels, vec3 origin, vec3 ray, float dist, IntersectCounts *counts)
+{
+	if (!inMesh && node.IsInstanceLeaf())
+		return InstancesOcclude(scene, bvh, kernels, node, origin, ray, dist, counts);
+
+	CountLeaf(counts, node);
+	uint32_t lanes = (1u << node.Count()) - 1;
+	float t[packetWidth];
+	uint32_t mask = (!inMesh && node.IsSphereLeaf())
+		? kernels.spheres(scene.spheres, node.leftFirst, origin, ray, 0, dist, t)
+		: kernels.triangles(inMesh ? scene.meshTriangles : scene.triangles, node.leftFirst, origin, ray, 0, dist, t);
+	return (mask & lanes) != 0;
+}
+
+//any hit below root, as ClosestInTree; leaf receives the occluding leaf
+template <bool inMesh>
+static bool AnyInTree(const Scene &scene, const BVH &bvh, const IntersectKernels &kernels, uint32_t root,
+	vec3 origin, vec3 ray, float dist, int *leaf, IntersectCounts *counts)
+{
+	const float infinity = numeric_limits<float>::infinity();
+	vec3 invRay = InverseRay(ray);
+	uint32_t stack[stackSize];
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0)
+	{
+		uint32_t nodeIndex = stack[--top];
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		if (counts)
+			counts->nodes++;
+		if (IntersectBounds(node, origin, invRay, dist) == infinity)
+			continue;
+		if (node.IsLeaf())
+		{
+			if (LeafOccludes<inMesh>(scene, bvh, node, kernels, origin, ray, dist, counts))
+			{
+				if (leaf)
+					*leaf = (int)nodeIndex;
+				return true;
+			}
+		}
+		else
+		{
+			stack[top++] = node.leftFirst + 1;
+			stack[top++] = node.leftFirst;
+		}
+	}
+	return false;
+}
+
+bool IntersectAny(const Scene &scene, const BVH &bvh, vec3 origin, vec3 ray, float dist, Occluder *last,
+	IntersectCounts *counts)
+{
+	const IntersectKernels &kernels = Kernels();
+
+	//neighbouring rays are usually blocked by the same object, so one test
+	//often settles the query without any traversal
+	if (last)
+	{
+		if (last->plane >= 0 && (size_t)last->plane < scene.PlaneCount())
+		{
+			if (counts)
+				counts->planes++;
+			float test = IntersectPlane(scene.planeNormals[last->plane], scene.planePoints[last->plane], origin, ray);
+			if (test >= 0 && test <= dist)
+				return true;
+		}
+		else if (last->leaf >= 0 && (size_t)last->leaf < bvh.nodes.size()
+			&& LeafOccludes<false>(scene, bvh, bvh.nodes[last->leaf], kernels, origin, ray, dist, counts))
+			return true;
+	}
+
+	for (size_t i = 0; i < scene.PlaneCount(); i++)
+	{
+		float test = IntersectPlane(scene.planeNormals[i], scene.planePoints[i], origin, ray);
+		if (test >= 0 && test <= dist)
+		{
+			if (counts)
+				counts->planes += i + 1;
+			if (last)
+				*last = Occluder{ -1, (int)i };
+			return true;
+		}
+	}
+	if (counts)
+		counts->planes += scene.PlaneCount();
+	if (bvh.nodes.empty())
+		return false;
+
+	int leaf;
+	if (!AnyInTree<false>(scene, bvh, kernels, 0, origin, ray, dist, &leaf, counts))
+		return false;
+	if (last)
+		*last = Occluder{ leaf, -1 };
+	return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+#include "PacketKernels.h"
+#include "LightTree.h"
+
+using namespace glm;
+using namespace std;
+
+//set in BVHNode::count for leaves over spheres or instances rather than triangles
+const uint32_t sphereLeafBit = 0x80000000u;
+const uint32_t instanceLeafBit = 0x40000000u;
+
+//one node of the hierarchy; 32 bytes so two share a cache line
+struct BVHNode {
+	vec3 boundsMin;
+	uint32_t leftFirst; //interior: index of the left child (right is +1); leaf: first primitive
+	vec3 boundsMax;
+	uint32_t count;     //number of primitives in a leaf, 0 for interior nodes; may carry a leaf bit
+
+	bool IsLeaf() const { return count != 0; }
+	bool IsSphereLeaf() const { return (count & sphereLeafBit) != 0; }
+	bool IsInstanceLeaf() const { return (count & instanceLeafBit) != 0; }
+	uint32_t Count() const { return count & ~(sphereLeafBit | instanceLeafBit); }
+};
+
+//bounding volume hierarchy over the triangles, spheres and instances of a
+//scene; planes are unbounded and are tested separately by the traversal
+//functions. Every leaf holds one kind of primitive, stored contiguously in the
+//scene's arrays, so a triangle or sphere leaf is a single call to the packet
+//kernels. Each mesh has a hierarchy of its own over its triangles in mesh
+//space, stored after the scene's, which instance leaves descend into. The
+//lights have a hierarchy of their own too, for drawing a few of many
+struct BVH {
+	vector<BVHNode> nodes;        //nodes[0] is the root
+	vector<uint32_t> meshRoots;   //root node of each mesh's hierarchy
+	vector<LightNode> lightNodes; //see BuildLightTree
+};
+
+//closest intersection along a ray
+struct Hit {
+	float t = -1;
+	int objectType = -1; //0 = sphere; 1 = plane; 2 = triangle; 3 = triangle of an instance's mesh
+	int index = -1;      //for type 3, into Scene::meshTriangles
+	int instance = -1;   //for type 3
+};
+
+//levels a hierarchy may have, root and leaves included: the CPU traversals
+//keep their pending nodes in fixed stacks this deep
+const int maxBVHDepth = 64;
+
+//build the hierarchy with a binned surface area heuristic, reordering the
+//scene's triangles, spheres, instances and each mesh's triangles into leaf
+//order, and the light hierarchy; returns seconds taken. Ranges still
+//unsplit deep in the tree are halved instead, keeping within maxBVHDepth
+double BuildBVH(BVH &bvh, Scene &scene);
+
+//depth of the deepest leaf below root, for reporting and checking
+int BVHDepth(const BVH &bvh, uint32_t root = 0);
+
+//for every node, the node a depth-first walk visits once that node's subtree
+//is done or skipped (-1 after the last), so that ray.frag can traverse
+//without a stack
+vector<int32_t> BVHSkipLinks(const BVH &bvh);
+
+//intersection tests performed by the traversal functions, by what was tested
+struct IntersectCounts {
+	uint64_t nodes = 0; //bounding box tests
+	uint64_t spheres = 0;
+	uint64_t triangles = 0;
+	uint64_t planes = 0;
+
+	void Add(const IntersectCounts &other);
+};
+
+//closest hit with t > 0, as the primary loops in trace(); false if nothing is
+//hit. The tests made are added to counts when given, those in meshes included
+bool IntersectClosest(const Scene &scene, const BVH &bvh, vec3 origin, vec3 ray, Hit &hit,
+	IntersectCounts *counts = nullptr);
+
+//what last blocked a shadow ray, so the next ray toward the same light can
+//try it before anything else: a leaf of the hierarchy or a plane
+struct Occluder {
+	int leaf = -1;  //node index of the leaf holding the occluding triangle, sphere or instance
+	int plane = -1;
+};
+
+//any-hit query: true as soon as any object is hit with 0 <= t <= dist, as the
+//shadow loops in trace(). When last is given its occluder is tested first and
+//replaced by whatever blocks this ray
+bool IntersectAny(const Scene &scene, const BVH &bvh, vec3 origin, vec3 ray, float dist,
+	Occluder *last = nullptr, IntersectCounts *counts = nullptr);
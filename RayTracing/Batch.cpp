@@ -0,0 +1,136 @@
+#include "Batch.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Saving
+
+FrameWriter::FrameWriter(int capacity)
+	: m_capacity(std::max(capacity, 1)), m_thread(&FrameWriter::Run, this)
+{
+}
+
+void FrameWriter::Add(unique_ptr<ImageBuffer> image, const string &path)
+{
+	auto start = chrono::high_resolution_clock::now();
+	unique_lock<mutex> guard(m_lock);
+	m_changed.wait(guard, [&] { return m_queue.size() < m_capacity; });
+	m_blockedSeconds += chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	m_queue.emplace_back(move(image), path);
+	m_changed.notify_all();
+}
+
+bool FrameWriter::Finish()
+{
+	if (m_thread.joinable())
+	{
+		{
+			lock_guard<mutex> guard(m_lock);
+			m_finishing = true;
+		}
+		m_changed.notify_all();
+		m_thread.join();
+	}
+	return !m_failed;
+}
+
+void FrameWriter::Run()
+{
+	unique_lock<mutex> guard(m_lock);
+	for (;;)
+	{
+		m_changed.wait(guard, [&] { return !m_queue.empty() || m_finishing; });
+		if (m_queue.empty())
+			return;
+		//the image stays queued, counting against the capacity, until written
+		ImageBuffer &image = *m_queue.front().first;
+		string path = m_queue.front().second;
+		guard.unlock();
+		auto start = chrono::high_resolution_clock::now();
+		bool saved = image.SaveToFile(path);
+		double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+		guard.lock();
+		m_encodeSeconds += seconds;
+		m_failed = m_failed || !saved;
+		m_queue.pop_front();
+		m_changed.notify_all();
+	}
+}
+
+// --------------------------------------------------------------------------
+// Camera paths
+
+string FramePath(const string &pattern, int frame)
+{
+	string number = to_string(frame);
+	size_t last = pattern.find_last_of('#');
+	if (last == string::npos)
+	{
+		size_t dot = pattern.find_last_of('.');
+		size_t slash = pattern.find_last_of("/\\");
+		if (dot == string::npos || (slash != string::npos && dot < slash))
+			dot = pattern.size();
+		return pattern.substr(0, dot) + number + pattern.substr(dot);
+	}
+	size_t first = pattern.find_last_not_of('#', last);
+	first = first == string::npos ? 0 : first + 1;
+	size_t digits = last + 1 - first;
+	if (number.size() < digits)
+		number.insert(0, digits - number.size(), '0');
+	return pattern.substr(0, first) + number + pattern.substr(last + 1);
+}
+
+int RenderPath(const Scene &scene, const BVH &bvh, const vector<CameraKey> &keys, const BatchSettings &settings)
+{
+	auto start = chrono::high_resolution_clock::now();
+	float first = keys.front().time;
+	int frames = (int)((keys.back().time - first) * settings.fps + 1e-3f) + 1;
+
+	//each frame in flight gets its share of the threads
+	int jobs = std::max(1, std::min(settings.jobs, frames));
+	int threads = settings.threads > 0 ? settings.threads : (int)std::max(1u, thread::hardware_concurrency());
+	int frameThreads = std::max(1, threads / jobs);
+
+	FrameWriter writer(jobs + 1);
+	atomic<int> next(0);
+	mutex printLock;
+	double traceSeconds = 0;
+	auto job = [&] {
+		for (int frame = next++; frame < frames; frame = next++)
+		{
+			float time = first + frame / settings.fps;
+			unique_ptr<ImageBuffer> image(new ImageBuffer);
+			image->Allocate(settings.width, settings.height);
+			double seconds = RenderCpu(scene, bvh, CameraAt(keys, time), image.get(), frameThreads, nullptr,
+				settings.tileEdge, nullptr, settings.trace);
+			{
+				lock_guard<mutex> guard(printLock);
+				traceSeconds += seconds;
+				cout << "Frame " << frame << " at " << time << " s traced in " << seconds * 1000 << " ms" << endl;
+			}
+			writer.Add(move(image), FramePath(settings.outPattern, frame));
+		}
+	};
+	vector<thread> pool;
+	for (int i = 1; i < jobs; i++)
+		pool.emplace_back(job);
+	job();
+	for (thread &t : pool)
+		t.join();
+	bool ok = writer.Finish();
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	cout << frames << " frames of " << settings.width << "x" << settings.height << " at " << settings.trace.samples
+		<< " samples per pixel, " << jobs << " at a time on " << frameThreads << " threads each: " << seconds
+		<< " s (" << frames / seconds << " frames/s), " << traceSeconds * 1000 / frames << " ms tracing per frame"
+		<< endl;
+	cout << "Encoding took " << writer.EncodeSeconds() * 1000 << " ms on its own thread; tracing waited "
+		<< writer.BlockedSeconds() * 1000 << " ms for it" << endl;
+	if (!ok)
+		cout << "ERROR: some frames could not be saved" << endl;
+	return ok ? 0 : -1;
+}
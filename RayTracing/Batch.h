@@ -0,0 +1,68 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "CameraPath.h"
+#include "imagebuffer.h"
+
+using namespace std;
+
+//saves images on a thread of its own, in the order they are added, so that
+//tracing the next frame need not wait for the last one to be encoded. At
+//most capacity images wait at once; Add blocks while that many do
+class FrameWriter
+{
+public:
+	explicit FrameWriter(int capacity = 2);
+	~FrameWriter() { Finish(); }
+
+	//queue image to be saved to path, taking it over
+	void Add(unique_ptr<ImageBuffer> image, const string &path);
+	//wait until every image added is written; false if any could not be
+	bool Finish();
+
+	//seconds the thread spent saving, and that Add spent waiting for room
+	double EncodeSeconds() const { return m_encodeSeconds; }
+	double BlockedSeconds() const { return m_blockedSeconds; }
+
+private:
+	void Run();
+
+	size_t m_capacity;
+	mutex m_lock;
+	condition_variable m_changed;
+	deque<pair<unique_ptr<ImageBuffer>, string>> m_queue;
+	bool m_finishing = false;
+	bool m_failed = false;
+	double m_encodeSeconds = 0, m_blockedSeconds = 0;
+	thread m_thread;
+};
+
+//how the frames of a camera path are rendered
+struct BatchSettings {
+	int width = 1024, height = 1024;
+	float fps = 24;
+	int jobs = 1;            //frames traced at once, sharing out the threads
+	int threads = 0;         //0 = one per core
+	int tileEdge = tileSize;
+	string outPattern = "frame####.png";
+	TraceSettings trace;     //samples per pixel among them
+};
+
+//file name of a frame: the last run of #s in pattern replaced by the frame
+//number padded with zeros to its length, or without one the number added
+//before the extension
+string FramePath(const string &pattern, int frame);
+
+//trace the camera path at settings.fps from its first key to its last,
+//jobs frames at a time, each saved by a FrameWriter to the file FramePath
+//names; returns the process exit code
+int RenderPath(const Scene &scene, const BVH &bvh, const vector<CameraKey> &keys, const BatchSettings &settings);
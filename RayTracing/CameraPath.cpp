@@ -0,0 +1,119 @@
+#include "CameraPath.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+using namespace glm;
+
+Camera MakeCamera(vec3 position, float yaw, float pitch, float fov)
+{
+	Camera camera;
+	camera.origin = vec3(0, 0, 0);
+	camera.fov = fov;
+	camera.transform = glm::rotate(camera.transform, yaw, vec3(0, 1, 0));
+	camera.transform = glm::rotate(camera.transform, pitch, vec3(1, 0, 0));
+	camera.oTransform = glm::translate(camera.oTransform, position);
+	return camera;
+}
+
+// --------------------------------------------------------------------------
+// Reading
+
+static bool Fail(const string &path, int line, const string &message)
+{
+	cout << "ERROR: " << path << ":" << line << ": " << message << endl;
+	return false;
+}
+
+bool LoadCameraPath(const string &path, vector<CameraKey> &keys)
+{
+	ifstream in(path);
+	if (!in)
+	{
+		cout << "ERROR: Could not open camera path " << path << endl;
+		return false;
+	}
+
+	vector<CameraKey> loaded;
+	string text;
+	for (int line = 1; getline(in, text); line++)
+	{
+		//braces need not be spaced from what they enclose
+		text = text.substr(0, text.find('#'));
+		size_t open = text.find('{'), close = text.find('}');
+		istringstream words(text.substr(0, std::min(open, text.size())));
+		string word;
+		if (!(words >> word))
+		{
+			if (open != string::npos)
+				return Fail(path, line, "expected key before {");
+			continue;
+		}
+		if (word != "key" || (words >> word))
+			return Fail(path, line, "expected key, found " + word);
+		if (open == string::npos || close == string::npos || close < open
+			|| text.find_first_not_of(" \t\r", close + 1) != string::npos)
+			return Fail(path, line, "expected key { time  x y z  yaw pitch  [fov] }");
+
+		//angles are written in degrees
+		CameraKey key;
+		istringstream values(text.substr(open + 1, close - open - 1));
+		values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch;
+		if (!values)
+			return Fail(path, line, "expected time, position, yaw and pitch");
+		if (!(values >> key.fov))
+		{
+			if (!values.eof())
+				return Fail(path, line, "expected a field of view or }");
+			key.fov = 30;
+		}
+		else if ((values >> word) || !(key.fov > 0 && key.fov < 180))
+			return Fail(path, line, "expected a field of view between 0 and 180 degrees, then }");
+		key.yaw = radians(key.yaw);
+		key.pitch = radians(key.pitch);
+		if (!loaded.empty() && !(key.time > loaded.back().time))
+			return Fail(path, line, "keys must come in order of increasing time");
+		loaded.push_back(key);
+	}
+	if (loaded.empty())
+	{
+		cout << "ERROR: " << path << " has no keys" << endl;
+		return false;
+	}
+	keys = move(loaded);
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Interpolation
+
+//Catmull-Rom between b and c at u in [0, 1], with a before and d after
+template <typename T>
+static T CatmullRom(T a, T b, T c, T d, float u)
+{
+	return 0.5f * (2.f * b + (c - a) * u + (2.f * a - 5.f * b + 4.f * c - d) * (u * u)
+		+ (3.f * b - a - 3.f * c + d) * (u * u * u));
+}
+
+Camera CameraAt(const vector<CameraKey> &keys, float time)
+{
+	const CameraKey &first = keys.front(), &last = keys.back();
+	if (keys.size() == 1 || time <= first.time)
+		return MakeCamera(first.position, first.yaw, first.pitch, first.fov);
+	if (time >= last.time)
+		return MakeCamera(last.position, last.yaw, last.pitch, last.fov);
+
+	//the segment from key i to i + 1, its neighbours repeating the end keys
+	int n = (int)keys.size();
+	int i = (int)(upper_bound(keys.begin(), keys.end(), time,
+		[](float t, const CameraKey &key) { return t < key.time; }) - keys.begin()) - 1;
+	const CameraKey &a = keys[std::max(i - 1, 0)], &b = keys[i], &c = keys[i + 1], &d = keys[std::min(i + 2, n - 1)];
+	float u = (time - b.time) / (c.time - b.time);
+	return MakeCamera(CatmullRom(a.position, b.position, c.position, d.position, u),
+		CatmullRom(a.yaw, b.yaw, c.yaw, d.yaw, u), CatmullRom(a.pitch, b.pitch, c.pitch, d.pitch, u),
+		CatmullRom(a.fov, b.fov, c.fov, d.fov, u));
+}
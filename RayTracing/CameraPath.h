@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "CpuTracer.h"
+
+using namespace glm;
+using namespace std;
+
+//a pose of the viewer at a moment of a camera path: where it stands, as the
+//WASD keys move it, and how it is turned, as the mouse turns it
+struct CameraKey {
+	float time = 0;      //seconds
+	vec3 position = vec3(0);
+	float yaw = 0;       //radians about the vertical axis
+	float pitch = 0;     //radians about the sideways axis, after the yaw
+	float fov = 30;      //degrees
+};
+
+//the camera the viewer draws from at a pose: transform turns the primary
+//rays by yaw then pitch and oTransform moves the origin to position
+Camera MakeCamera(vec3 position, float yaw, float pitch, float fov = 30);
+
+//read a camera path file, one keyframe per line with times increasing (see
+//scenes/orbit.path for the syntax). Prints the first error with its line
+//number and returns false
+bool LoadCameraPath(const string &path, vector<CameraKey> &keys);
+
+//the camera at time along the path: a Catmull-Rom curve through the keys,
+//held at the first and last beyond them
+Camera CameraAt(const vector<CameraKey> &keys, float time);
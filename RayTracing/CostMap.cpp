@@ -0,0 +1,198 @@
+#include "CostMap.h"
+#include "imagebuffer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+using namespace std;
+using namespace glm;
+
+void CostMap::Allocate(int w, int h)
+{
+	width = w;
+	height = h;
+	pixels.assign((size_t)w * h, PixelCost());
+}
+
+// --------------------------------------------------------------------------
+// Heatmaps
+
+//the counters a heatmap can show, with the suffix of its file
+static const struct {
+	const char *name;
+	const char *suffix;
+	uint32_t PixelCost::*field;
+} counters[] = {
+	{ "intersection tests", "-tests.png", &PixelCost::tests },
+	{ "BVH nodes", "-nodes.png", &PixelCost::nodes },
+	{ "shadow rays", "-shadow.png", &PixelCost::shadowRays },
+	{ "bounces", "-bounces.png", &PixelCost::bounces },
+	{ "nanoseconds", "-time.png", &PixelCost::nanoseconds },
+};
+
+//black through blue, red and yellow to white as u goes from 0 to 1
+static vec3 FalseColour(float u)
+{
+	static const vec3 stops[] = { vec3(0), vec3(0.1f, 0.1f, 0.9f), vec3(0.9f, 0.1f, 0.1f), vec3(1, 0.9f, 0),
+		vec3(1) };
+	float scaled = glm::clamp(u, 0.f, 1.f) * 4;
+	int i = std::min((int)scaled, 3);
+	return mix(stops[i], stops[i + 1], scaled - i);
+}
+
+bool SaveHeatmaps(const CostMap &costs, const string &base)
+{
+	bool ok = true;
+	vector<uint32_t> values(costs.pixels.size());
+	for (const auto &counter : counters)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			values[i] = costs.pixels[i].*counter.field;
+			sum += values[i];
+		}
+		uint32_t most = values.empty() ? 0 : *max_element(values.begin(), values.end());
+		//a few outliers would otherwise leave the rest of the frame dark
+		size_t rank = values.size() * 99 / 100;
+		uint32_t scale = most;
+		if (rank < values.size())
+		{
+			nth_element(values.begin(), values.begin() + rank, values.end());
+			scale = values[rank];
+		}
+		scale = std::max(scale, 1u);
+
+		ImageBuffer image;
+		image.Allocate(costs.width, costs.height);
+		for (int y = 0; y < costs.height; y++)
+		{
+			vec3 *row = image.Row(y);
+			for (int x = 0; x < costs.width; x++)
+				row[x] = FalseColour((float)(costs.At(x, y).*counter.field) / scale);
+		}
+		cout << counter.name << " per pixel: mean " << (double)sum / std::max<size_t>(values.size(), 1)
+			<< ", white at " << scale << ", most " << most << endl;
+		ok = image.SaveToFile(base + counter.suffix) && ok;
+	}
+	return ok;
+}
+
+// --------------------------------------------------------------------------
+// Per-object costs
+
+namespace {
+struct ObjectCost {
+	int objectType;
+	int object;
+	uint64_t pixels = 0;
+	uint64_t tests = 0, nodes = 0, shadowRays = 0, bounces = 0, nanoseconds = 0;
+};
+}
+
+static const char *TypeName(int objectType)
+{
+	switch (objectType)
+	{
+	case 0: return "sphere";
+	case 1: return "plane";
+	case 2: return "triangle";
+	case 3: return "instance";
+	default: return "background";
+	}
+}
+
+//an object's material and a point on it to find it by, since the BVH build
+//reorders the primitives away from the order of the scene file
+static void Describe(const Scene &scene, int objectType, int object, int &material, vec3 &position)
+{
+	material = -1;
+	position = vec3(0);
+	switch (objectType)
+	{
+	case 0:
+		material = scene.sphereMaterials[object];
+		position = scene.spheres.Center(object);
+		break;
+	case 1:
+		material = scene.planeMaterials[object];
+		position = scene.planePoints[object];
+		break;
+	case 2:
+		material = scene.triangleMaterials[object];
+		position = (scene.triangles.A(object) + scene.triangles.B(object) + scene.triangles.C(object)) / 3.f;
+		break;
+	case 3:
+	{
+		//the mesh origin, where the world to mesh transform takes it from
+		const Instance &instance = scene.instances[object];
+		mat3 linear(instance.toMesh);
+		material = instance.material;
+		position = inverse(linear) * -instance.toMesh[3];
+		break;
+	}
+	}
+}
+
+bool WriteObjectCosts(const CostMap &costs, const Scene &scene, const string &path, int printed)
+{
+	map<pair<int, int>, ObjectCost> byObject;
+	uint64_t totalNanoseconds = 0;
+	for (const PixelCost &pixel : costs.pixels)
+	{
+		ObjectCost &cost = byObject[{ pixel.objectType, pixel.object }];
+		cost.objectType = pixel.objectType;
+		cost.object = pixel.object;
+		cost.pixels++;
+		cost.tests += pixel.tests;
+		cost.nodes += pixel.nodes;
+		cost.shadowRays += pixel.shadowRays;
+		cost.bounces += pixel.bounces;
+		cost.nanoseconds += pixel.nanoseconds;
+		totalNanoseconds += pixel.nanoseconds;
+	}
+	vector<ObjectCost> sorted;
+	sorted.reserve(byObject.size());
+	for (const auto &entry : byObject)
+		sorted.push_back(entry.second);
+	sort(sorted.begin(), sorted.end(), [](const ObjectCost &a, const ObjectCost &b) {
+		return a.nanoseconds > b.nanoseconds;
+	});
+
+	ofstream out(path);
+	if (!out)
+	{
+		cout << "ERROR: Could not write object costs to " << path << endl;
+		return false;
+	}
+	out << "type,index,material,x,y,z,pixels,tests,nodes,shadow_rays,bounces,ms" << endl;
+	cout << sorted.size() << " objects seen; the most expensive by time:" << endl;
+	cout << "  " << left << setw(10) << "object" << right << setw(6) << "index" << setw(10) << "material" << setw(8)
+		<< "pixels" << setw(10) << "tests/px" << setw(10) << "nodes/px" << setw(11) << "shadow/px" << setw(12)
+		<< "bounces/px" << setw(7) << "ms" << setw(6) << "time" << endl;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const ObjectCost &cost = sorted[i];
+		int material;
+		vec3 position;
+		Describe(scene, cost.objectType, cost.object, material, position);
+		out << TypeName(cost.objectType) << "," << cost.object << "," << material << "," << position.x << ","
+			<< position.y << "," << position.z << "," << cost.pixels << "," << cost.tests << "," << cost.nodes << ","
+			<< cost.shadowRays << "," << cost.bounces << "," << cost.nanoseconds / 1e6 << endl;
+		if ((int)i < printed)
+		{
+			double pixels = (double)cost.pixels;
+			cout << fixed << setprecision(1) << "  " << left << setw(10) << TypeName(cost.objectType) << right
+				<< setw(6) << cost.object << setw(10) << material << setw(8) << cost.pixels << setw(10)
+				<< cost.tests / pixels << setw(10) << cost.nodes / pixels << setw(11) << cost.shadowRays / pixels
+				<< setw(12) << cost.bounces / pixels << setw(7) << cost.nanoseconds / 1e6 << setw(5)
+				<< 100.0 * cost.nanoseconds / std::max<uint64_t>(totalNanoseconds, 1) << "%" << defaultfloat
+				<< setprecision(6) << endl;
+		}
+	}
+	cout << "Object costs written to " << path << endl;
+	return (bool)out;
+}
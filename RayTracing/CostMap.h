@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+using namespace std;
+
+//what tracing one pixel took, and what its centre primary ray hit
+struct PixelCost {
+	uint32_t tests = 0;       //sphere, plane and triangle intersection tests
+	uint32_t nodes = 0;       //BVH nodes visited
+	uint32_t shadowRays = 0;
+	uint32_t bounces = 0;     //closest-hit rays, the primary ones included
+	uint32_t nanoseconds = 0;
+	int objectType = -1;      //as Hit::objectType, -1 for a miss
+	int object = -1;          //sphere, plane or triangle index, or for type 3 the instance
+};
+
+//the cost of every pixel of a frame, as RenderCpuCosts records it
+struct CostMap {
+	int width = 0, height = 0;
+	vector<PixelCost> pixels; //row by row from the bottom, as in an ImageBuffer
+
+	void Allocate(int w, int h);
+	PixelCost &At(int x, int y) { return pixels[(size_t)y * width + x]; }
+	const PixelCost &At(int x, int y) const { return pixels[(size_t)y * width + x]; }
+};
+
+//save each counter as a false-colour image named base plus -tests.png,
+//-nodes.png, -shadow.png, -bounces.png and -time.png: black for nothing
+//through blue, red and yellow to white at the frame's 99th percentile, which
+//is printed for each as the key. False if any could not be saved
+bool SaveHeatmaps(const CostMap &costs, const string &base);
+
+//sum the costs of the pixels whose centre ray hit each object, print the
+//printed most expensive by time and write them all to path as CSV
+bool WriteObjectCosts(const CostMap &costs, const Scene &scene, const string &path, int printed = 10);
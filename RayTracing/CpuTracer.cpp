@@ -0,0 +1,627 @@
+#include "CpuTracer.h"
+#include "CostMap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+const float pi = 3.1415926535897931f;
+
+// --------------------------------------------------------------------------
+// Intersection tests, ported from ray.frag
+
+float IntersectSphere(vec3 center, float radius, vec3 origin, vec3 ray)
+{
+	vec3 d = ray;
+	vec3 oc = origin - center;
+	float r = radius;
+
+	float b = dot(d, oc);
+	float c = dot(oc, oc) - r * r;
+
+	float disc = b * b - c;
+	if (disc < 0)
+		return -1;
+
+	disc = sqrt(disc);
+	float t0 = -(b - disc);
+	float t1 = -(b + disc);
+
+	return (t0 < t1) ? t0 : t1;
+}
+
+float IntersectPlane(vec3 normal, vec3 point, vec3 origin, vec3 ray)
+{
+	vec3 q = point;
+	vec3 n = normalize(normal);
+
+	float qn = dot(q, n);
+	float on = dot(origin, n);
+	float dn = dot(ray, n);
+	return (qn - on) / dn;
+}
+
+float IntersectTriangle(vec4 U, vec4 V, vec4 W, vec3 origin, vec3 ray)
+{
+	//where the ray leaves the plane w = 0, then the barycentrics of that point
+	float t = -(dot(vec3(W), origin) + W.w) / dot(vec3(W), ray);
+	if (!(t > 0))
+		return -1;
+	vec3 p = origin + t * ray;
+	float u = dot(vec3(U), p) + U.w;
+	float v = dot(vec3(V), p) + V.w;
+	return (u >= 0 && v >= 0 && u + v <= 1) ? t : -1;
+}
+
+// --------------------------------------------------------------------------
+// Tracing
+
+void TraceStats::Add(const TraceStats &other)
+{
+	primaryRays += other.primaryRays;
+	secondaryRays += other.secondaryRays;
+	shadowRays += other.shadowRays;
+	occludedRays += other.occludedRays;
+	occluderCacheHits += other.occluderCacheHits;
+	timedShadowRays += other.timedShadowRays;
+	timedShadowSeconds += other.timedShadowSeconds;
+	tests.Add(other.tests);
+	for (int i = 0; i < maxBounce; i++)
+	{
+		bounceRays[i] += other.bounceRays[i];
+		timedBounces[i] += other.timedBounces[i];
+		timedBounceSeconds[i] += other.timedBounceSeconds[i];
+	}
+}
+
+void PrimaryRay(const Camera &camera, vec2 pixel, vec3 &origin, vec3 &ray, float aspect)
+{
+	float rads = camera.fov * pi / 180;
+	float z = 1 / (2 * tan(rads / 2.0f));
+	vec3 dir = normalize(vec3(pixel.x * aspect, pixel.y, -z));
+
+	ray = vec3(camera.transform * vec4(dir, 1.0));
+	origin = vec3(camera.oTransform * vec4(camera.origin, 1.0));
+}
+
+vec2 PixelJitter(int x, int y, int sample)
+{
+	uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)sample * 83492791u;
+	h ^= h >> 16; h *= 0x7feb352du;
+	h ^= h >> 15; h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return vec2(h & 0xffff, h >> 16) / 65536.f;
+}
+
+vec3 ShadePrimary(const Scene &scene, const PrimaryHit &hit, vec3 ray)
+{
+	//the same arithmetic as the light loop in Trace
+	const Material &m = scene.materials[hit.material];
+	vec3 diffuse = vec3(0), specular = vec3(0);
+	for (size_t l = 0; l < scene.lights.size(); l++)
+	{
+		if (!(hit.visibleLights & (1u << l)))
+			continue;
+		const Light &light = scene.lights[l];
+		vec3 rLight = normalize(vec3(light.center) - hit.position);
+		vec3 shadow = vec3(light.color) * light.intensity;
+		vec3 R = rLight - 2 * (dot(rLight, hit.normal)) * hit.normal;
+		specular += pow(glm::max(0.f, dot(R, ray)), m.phongExp) * shadow;
+		diffuse += glm::max(0.f, dot(rLight, hit.normal)) * shadow;
+	}
+	return ambientLight * m.diffuseColor + diffuse * m.diffuseColor + specular * m.specularColor;
+}
+
+void SurfaceAt(const Scene &scene, const Hit &hit, vec3 point, vec3 &normal, uint32_t &material)
+{
+	switch (hit.objectType) //0 = sphere; 1 = plane; 2 = triangle; 3 = instanced triangle
+	{
+	case 0:
+		material = scene.sphereMaterials[hit.index];
+		normal = normalize(point - scene.spheres.Center(hit.index));
+		break;
+	case 1:
+		material = scene.planeMaterials[hit.index];
+		normal = scene.planeNormals[hit.index];
+		break;
+	case 2:
+	{
+		material = scene.triangleMaterials[hit.index];
+		normal = normalize(scene.triangles.Normal(hit.index));
+		break;
+	}
+	default:
+	{
+		//normals leave mesh space by the inverse transpose of the placement,
+		//which is the transpose of what the instance stores
+		const Instance &placed = scene.instances[hit.instance];
+		material = placed.material;
+		normal = normalize(transpose(mat3(placed.toMesh)) * scene.meshTriangles.Normal(hit.index));
+		break;
+	}
+	}
+}
+
+//a number in [0, 1) from the bits of a point or direction and a salt, the
+//same for the same arguments on every run; ray.frag's hashSample() computes
+//the same
+static float HashSample(vec3 v, int salt)
+{
+	uint32_t bits[3];
+	memcpy(bits, &v, sizeof(bits));
+	uint32_t h = bits[0] * 0x9E3779B1u ^ bits[1] * 0x85EBCA77u ^ bits[2] * 0xC2B2AE3Du ^ (uint32_t)salt;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return (h >> 8) * (1.0f / 16777216);
+}
+
+bool ContinuePath(const TraceSettings &settings, int bounce, vec3 ray, float &weight, float &scale)
+{
+	scale = 1;
+	if (bounce >= settings.bounces || !(weight > settings.minWeight))
+		return false;
+	if (settings.rouletteBounce > 0 && bounce >= settings.rouletteBounce && weight < 1)
+	{
+		if (HashSample(ray, bounce) >= weight)
+			return false;
+		scale = 1 / weight;
+		weight = 1;
+	}
+	return true;
+}
+
+int ShadowLights(const Scene &scene, const BVH &bvh, const TraceSettings &settings, vec3 point, vec3 normal,
+	int bounce, int *lights, float *shares)
+{
+	int count = (int)scene.lights.size();
+	int samples = glm::clamp(settings.lightSamples, 1, maxLightSamples);
+	if (count <= samples)
+	{
+		for (int l = 0; l < count; l++)
+		{
+			lights[l] = l;
+			shares[l] = 1;
+		}
+		return count;
+	}
+
+	float offset = HashSample(point, bounce);
+	float u[maxLightSamples];
+	for (int k = 0; k < samples; k++)
+		u[k] = (k + offset) / samples;
+	SampleLights(bvh.lightNodes, point, normal, u, samples, lights, shares);
+	for (int k = 0; k < samples; k++)
+		shares[k] = lights[k] < 0 ? 0 : 1 / (shares[k] * samples);
+	return samples;
+}
+
+//Trace, compiled separately for when the primary hit is recorded so the
+//common case carries none of that code
+template <bool recordPrimary>
+static vec3 TracePath(const Scene &scene, const BVH &bvh, const TraceSettings &settings, vec3 origin, vec3 ray,
+	TraceStats &stats, OccluderCache *cache, PrimaryHit *primary)
+{
+	if (cache)
+		cache->occluders.resize(maxLightSamples * maxBounce);
+	if (recordPrimary)
+		*primary = PrimaryHit();
+	bool timed = stats.primaryRays % timingInterval == 0;
+
+	//fwdPass collects the following information
+	vec3 specularCalc[maxBounce] = {}; //max(0, dot(R, V)^P) * shadow
+	vec3 diffuseCalc[maxBounce] = {};  //max(0, dot(L, N))   * shadow
+	float reflectance[maxBounce] = {};
+	vec3 diffuseColor[maxBounce] = {};
+	vec3 specularColor[maxBounce] = {};
+	float scale[maxBounce];            //roulette's factor for what a pass and those after it gather
+	fill(scale, scale + maxBounce, 1.f);
+	float weight = 1;
+
+	for (int fwdPass = 0; fwdPass < settings.bounces; fwdPass++)
+	{
+		chrono::high_resolution_clock::time_point bounceStart;
+		if (timed)
+			bounceStart = chrono::high_resolution_clock::now();
+
+		//find intersection point and type of object
+		Hit hit;
+		IntersectClosest(scene, bvh, origin, ray, hit, &stats.tests);
+		if (fwdPass == 0)
+			stats.primaryRays++;
+		else
+			stats.secondaryRays++;
+		stats.bounceRays[fwdPass]++;
+		float minT = hit.t;
+
+		//no intersection: this pass and every later one contribute nothing,
+		//which is what the shader computes with its zeroed colours
+		if (minT < 0)
+		{
+			if (timed)
+			{
+				stats.timedBounces[fwdPass]++;
+				stats.timedBounceSeconds[fwdPass] += chrono::duration<double>(chrono::high_resolution_clock::now() - bounceStart).count();
+			}
+			break;
+		}
+
+		//collect data from intersected object:
+		vec3 normal;
+		uint32_t material;
+		vec3 intersect = origin + minT * ray;
+		SurfaceAt(scene, hit, intersect, normal, material);
+		const Material &m = scene.materials[material];
+		diffuseColor[fwdPass] = m.diffuseColor;
+		specularColor[fwdPass] = m.specularColor;
+		reflectance[fwdPass] = m.reflectance;
+		float phongExp = m.phongExp;
+		intersect = intersect + 0.00001f * normal;
+		uint32_t visibleLights = 0;
+		int shadowLights[maxLightSamples];
+		float shares[maxLightSamples];
+		int shadowRays = ShadowLights(scene, bvh, settings, intersect, normal, fwdPass, shadowLights, shares);
+		//drawn lights would have to be drawn again to reshade, so only a
+		//primary point that sees every light, one bit each, is recorded
+		bool recordLights = recordPrimary && fwdPass == 0 && shadowRays == (int)scene.lights.size()
+			&& shadowRays <= 32;
+
+		//collect phong lighting for each light source
+		chrono::high_resolution_clock::time_point shadowStart;
+		if (timed)
+			shadowStart = chrono::high_resolution_clock::now();
+		for (int sample = 0; sample < shadowRays; sample++)
+		{
+			int l = shadowLights[sample];
+			if (l < 0)
+				continue;
+			const Light &light = scene.lights[l];
+			//check if in shadow from light, sum shadow
+			vec3 rayToLight = vec3(light.center) - intersect;
+			vec3 rLight = normalize(rayToLight);
+			float dist = length(rayToLight);
+
+			//check if an object is between light and object
+			stats.shadowRays++;
+			Occluder *last = cache ? &cache->Get(sample, fwdPass) : nullptr;
+			Occluder before = last ? *last : Occluder();
+			if (IntersectAny(scene, bvh, intersect, rLight, dist, last, &stats.tests))
+			{
+				stats.occludedRays++;
+				if (last && last->leaf == before.leaf && last->plane == before.plane)
+					stats.occluderCacheHits++;
+				continue;
+			}
+
+
+			//calculate phong data
+			vec3 shadow = vec3(light.color) * (light.intensity * shares[sample]);
+			vec3 R = rLight - 2 * (dot(rLight, normal)) * normal;
+			specularCalc[fwdPass] += pow(glm::max(0.f, dot(R, ray)), phongExp) * shadow;
+			diffuseCalc[fwdPass] += glm::max(0.f, dot(rLight, normal)) * shadow;
+			if (recordLights)
+				visibleLights |= 1u << l;
+		}
+
+		if (recordLights)
+		{
+			primary->position = intersect;
+			primary->normal = normal;
+			primary->material = material;
+			primary->visibleLights = visibleLights;
+			primary->valid = true;
+		}
+
+		ray = ray - 2 * (dot(ray, normal)) * normal;
+		origin = intersect;
+
+		if (timed)
+		{
+			auto end = chrono::high_resolution_clock::now();
+			stats.timedShadowRays += shadowRays;
+			stats.timedShadowSeconds += chrono::duration<double>(end - shadowStart).count();
+			stats.timedBounces[fwdPass]++;
+			stats.timedBounceSeconds[fwdPass] += chrono::duration<double>(end - bounceStart).count();
+		}
+
+		//passes not traced keep their zeroed colours, like those after a miss
+		weight *= reflectance[fwdPass];
+		float gain;
+		if (!ContinuePath(settings, fwdPass + 1, ray, weight, gain))
+			break;
+		scale[fwdPass + 1] = gain;
+	}
+
+	vec3 reflectedColor = vec3(0);
+	for (int bwdPass = settings.bounces - 1; bwdPass >= 0; bwdPass--)
+	{
+		vec3 temp = ambientLight * diffuseColor[bwdPass];
+		temp += diffuseCalc[bwdPass] * diffuseColor[bwdPass];
+		temp += specularCalc[bwdPass] * specularColor[bwdPass];
+		if (bwdPass < settings.bounces - 1)
+		{
+			float ref = reflectance[bwdPass];
+			temp = (1 - ref) * temp + ref * reflectedColor;
+		}
+		reflectedColor = temp * scale[bwdPass];
+	}
+	return reflectedColor;
+}
+
+vec3 Trace(const Scene &scene, const BVH &bvh, const TraceSettings &settings, vec3 origin, vec3 ray,
+	TraceStats &stats, OccluderCache *cache, PrimaryHit *primary)
+{
+	return primary ? TracePath<true>(scene, bvh, settings, origin, ray, stats, cache, primary)
+		: TracePath<false>(scene, bvh, settings, origin, ray, stats, cache, primary);
+}
+
+// --------------------------------------------------------------------------
+// Multithreaded rendering
+
+//one thread's share of the tiles, [front, back): the owner takes from the
+//front and thieves from the back
+struct TileRange {
+	mutex lock;
+	int front = 0;
+	int back = 0;
+};
+
+//move the back half of the largest other range into the empty range of self;
+//false once every range is empty
+static bool StealTiles(vector<TileRange> &ranges, int self)
+{
+	for (;;)
+	{
+		int victim = -1, largest = 0;
+		for (int i = 0; i < (int)ranges.size(); i++)
+		{
+			if (i == self)
+				continue;
+			lock_guard<mutex> guard(ranges[i].lock);
+			if (ranges[i].back - ranges[i].front > largest)
+			{
+				largest = ranges[i].back - ranges[i].front;
+				victim = i;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		int front, back;
+		{
+			lock_guard<mutex> guard(ranges[victim].lock);
+			TileRange &v = ranges[victim];
+			if (v.front == v.back)
+				continue; //emptied since the scan, look again
+			back = v.back;
+			front = v.back - (v.back - v.front + 1) / 2;
+			v.back = front;
+		}
+		//only the owner fills its range, and it is empty, so nothing was lost
+		//while neither lock was held
+		lock_guard<mutex> guard(ranges[self].lock);
+		ranges[self].front = front;
+		ranges[self].back = back;
+		return true;
+	}
+}
+
+bool ParallelTiles(int tileCount, int threads, const function<void(int, TraceStats &)> &work, TraceStats *stats,
+	const atomic<bool> *cancel)
+{
+	if (threads <= 0)
+		threads = std::max(1u, thread::hardware_concurrency());
+	threads = std::min(threads, std::max(tileCount, 1));
+
+	//contiguous shares keep each thread on neighbouring tiles, and stealing
+	//half of what is left moves work in few, large pieces
+	vector<TileRange> ranges(threads);
+	for (int i = 0; i < threads; i++)
+	{
+		ranges[i].front = (int)((int64_t)tileCount * i / threads);
+		ranges[i].back = (int)((int64_t)tileCount * (i + 1) / threads);
+	}
+
+	atomic<int> completed(0);
+	mutex statsLock;
+	auto worker = [&](int self) {
+		TraceStats local;
+		int done = 0;
+		while (!(cancel && cancel->load(memory_order_relaxed)))
+		{
+			int tile = -1;
+			{
+				lock_guard<mutex> guard(ranges[self].lock);
+				if (ranges[self].front < ranges[self].back)
+					tile = ranges[self].front++;
+			}
+			if (tile >= 0)
+			{
+				work(tile, local);
+				done++;
+			}
+			else if (!StealTiles(ranges, self))
+				break;
+		}
+		completed += done;
+		if (stats)
+		{
+			lock_guard<mutex> guard(statsLock);
+			stats->Add(local);
+		}
+	};
+
+	vector<thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.emplace_back(worker, i);
+	worker(0);
+	for (thread &t : pool)
+		t.join();
+	return completed == tileCount;
+}
+
+//the bits of v spread out to every other bit
+static uint32_t SpreadBits(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+vector<ivec2> MortonOrder(int tilesX, int tilesY)
+{
+	vector<pair<uint32_t, ivec2>> keyed;
+	keyed.reserve((size_t)tilesX * tilesY);
+	for (int y = 0; y < tilesY; y++)
+		for (int x = 0; x < tilesX; x++)
+			keyed.push_back({ SpreadBits(x) | SpreadBits(y) << 1, ivec2(x, y) });
+	sort(keyed.begin(), keyed.end(), [](const pair<uint32_t, ivec2> &a, const pair<uint32_t, ivec2> &b) {
+		return a.first < b.first;
+	});
+	vector<ivec2> order;
+	order.reserve(keyed.size());
+	for (const auto &k : keyed)
+		order.push_back(k.second);
+	return order;
+}
+
+//what RenderRegion does around each pixel when nothing is recorded: calls
+//that inline to nothing, so the plain renderers carry no instrumentation
+struct NoPixelHook {
+	void Begin(const TraceStats &) {}
+	void End(int, int, const TraceStats &, vec3, vec3) {}
+};
+
+//records what each pixel cost into a CostMap, from the counts the pixel
+//added to its thread's stats and the clock around it
+struct CostHook {
+	CostMap *costs;
+	const Scene *scene;
+	const BVH *bvh;
+	TraceStats before;
+	chrono::high_resolution_clock::time_point start;
+
+	void Begin(const TraceStats &local)
+	{
+		before.tests = local.tests;
+		before.shadowRays = local.shadowRays;
+		before.primaryRays = local.primaryRays;
+		before.secondaryRays = local.secondaryRays;
+		start = chrono::high_resolution_clock::now();
+	}
+	void End(int x, int y, const TraceStats &local, vec3 origin, vec3 ray)
+	{
+		auto end = chrono::high_resolution_clock::now();
+		PixelCost &cost = costs->At(x, y);
+		cost.nanoseconds = (uint32_t)std::min<int64_t>(
+			chrono::duration_cast<chrono::nanoseconds>(end - start).count(), UINT32_MAX);
+		cost.tests = (uint32_t)(local.tests.spheres + local.tests.triangles + local.tests.planes
+			- before.tests.spheres - before.tests.triangles - before.tests.planes);
+		cost.nodes = (uint32_t)(local.tests.nodes - before.tests.nodes);
+		cost.shadowRays = (uint32_t)(local.shadowRays - before.shadowRays);
+		cost.bounces = (uint32_t)(local.primaryRays + local.secondaryRays - before.primaryRays - before.secondaryRays);
+
+		//what the centre ray hit, found again outside the timing and counts
+		Hit hit;
+		if (IntersectClosest(*scene, *bvh, origin, ray, hit))
+		{
+			cost.objectType = hit.objectType;
+			cost.object = hit.objectType == 3 ? hit.instance : hit.index;
+		}
+	}
+};
+
+//RenderCpu over the part of a larger frame that image holds, from corner,
+//calling a copy of hook per tile around every pixel
+template <typename PixelHook>
+static double RenderRegion(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	ivec2 frameSize, ivec2 corner, int threads, TraceStats *stats, int tileEdge, const atomic<bool> *cancel,
+	const TraceSettings &settings, const PixelHook &hook)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	int width = image->Width();
+	int height = image->Height();
+	tileEdge = std::max(tileEdge, 1);
+	vector<ivec2> tiles = MortonOrder((width + tileEdge - 1) / tileEdge, (height + tileEdge - 1) / tileEdge);
+	float aspect = (float)frameSize.x / frameSize.y;
+
+	ParallelTiles((int)tiles.size(), threads, [&](int tile, TraceStats &local) {
+		int x0 = tiles[tile].x * tileEdge;
+		int y0 = tiles[tile].y * tileEdge;
+		int x1 = std::min(x0 + tileEdge, width);
+		int y1 = std::min(y0 + tileEdge, height);
+
+		PixelHook pixelHook = hook;
+		OccluderCache occluders;
+		for (int y = y0; y < y1; y++)
+		{
+			vec3 *row = image->Row(y);
+			for (int x = x0; x < x1; x++)
+			{
+				//the first sample goes through the centre, any more are
+				//jittered by frame position so every split of the frame agrees
+				ivec2 position = corner + ivec2(x, y);
+				vec3 color = vec3(0);
+				vec3 centreOrigin, centreRay;
+				pixelHook.Begin(local);
+				for (int s = 0; s < settings.samples; s++)
+				{
+					vec2 offset = s == 0 ? vec2(0.5f) : PixelJitter(position.x, position.y, s);
+					vec2 pixel = (vec2(position) + offset) / vec2(frameSize) * 2.f - 1.f;
+					vec3 origin, ray;
+					PrimaryRay(camera, pixel, origin, ray, aspect);
+					if (s == 0)
+					{
+						centreOrigin = origin;
+						centreRay = ray;
+					}
+					color += Trace(scene, bvh, settings, origin, ray, local, &occluders);
+				}
+				pixelHook.End(x, y, local, centreOrigin, centreRay);
+				row[x] = color / float(settings.samples);
+			}
+		}
+	}, stats, cancel);
+
+	image->MarkModified(0, height);
+
+	return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+double RenderCpu(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	int threads, TraceStats *stats, int tileEdge, const atomic<bool> *cancel, const TraceSettings &settings)
+{
+	return RenderRegion(scene, bvh, camera, image, ivec2(image->Width(), image->Height()), ivec2(0), threads, stats,
+		tileEdge, cancel, settings, NoPixelHook());
+}
+
+double RenderCpuRegion(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *region, ivec2 frameSize,
+	ivec2 corner, int threads, TraceStats *stats, int tileEdge, const TraceSettings &settings)
+{
+	return RenderRegion(scene, bvh, camera, region, frameSize, corner, threads, stats, tileEdge, nullptr, settings,
+		NoPixelHook());
+}
+
+double RenderCpuCosts(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, CostMap *costs,
+	int threads, TraceStats *stats, int tileEdge, const TraceSettings &settings)
+{
+	costs->Allocate(image->Width(), image->Height());
+	CostHook hook = { costs, &scene, &bvh, TraceStats(), {} };
+	return RenderRegion(scene, bvh, camera, image, ivec2(image->Width(), image->Height()), ivec2(0), threads, stats,
+		tileEdge, nullptr, settings, hook);
+}
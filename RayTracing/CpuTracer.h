@@ -0,0 +1,181 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+#include "BVH.h"
+#include "imagebuffer.h"
+
+using namespace glm;
+
+struct CostMap;
+
+//constants shared with ray.frag
+const int maxBounce = 8; //the most bounces TraceSettings may ask for, sizing the per-bounce arrays
+const vec3 ambientLight = vec3(0.1, 0.1, 0.1);
+const int tileSize = 32; //default edge length of the square tiles handed to threads
+const int timingInterval = 64; //pixels per pixel whose bounces and shadow rays are timed
+
+//camera pose, mirroring the cameraOrigin, fov, transform and oTransform uniforms
+struct Camera {
+	vec3 origin;
+	float fov;
+	mat4 transform;  //rotates primary ray directions
+	mat4 oTransform; //moves the origin
+
+	bool operator==(const Camera &other) const
+	{
+		return origin == other.origin && fov == other.fov && transform == other.transform
+			&& oTransform == other.oTransform;
+	}
+};
+
+//how deep paths are traced, mirroring the bounces, minWeight and
+//rouletteBounce uniforms. A path's weight is the product of the reflectances
+//it has bounced off, the share of the pixel the next bounce could still add
+struct TraceSettings {
+	int bounces = 4;             //closest-hit rays per path at most, 1 to maxBounce
+	float minWeight = 1 / 256.f; //paths stop once their weight is no more than this
+	//from this bounce on, a path goes on with probability equal to its weight
+	//and has what it gathers scaled up to match, so that dim paths end early
+	//without darkening the image on average; 0 = never
+	int rouletteBounce = 0;
+	//shadow rays per shading point once a scene has more lights than this,
+	//to lights drawn from the light hierarchy and weighted to match the sum
+	//over all of them on average; 1 to maxLightSamples
+	int lightSamples = 4;
+	//primary rays per pixel in RenderCpu and RenderCpuRegion, averaged: the
+	//first through the centre and the rest at PixelJitter offsets. The other
+	//renderers keep to one (the progressive one adds its own samples)
+	int samples = 1;
+};
+
+//rays cast while rendering, for reporting rays per second
+struct TraceStats {
+	uint64_t primaryRays = 0;
+	uint64_t secondaryRays = 0; //reflection rays
+	uint64_t shadowRays = 0;
+	uint64_t occludedRays = 0;      //shadow rays that found an occluder
+	uint64_t occluderCacheHits = 0; //of those, found by the occluder cache without traversal
+	uint64_t bounceRays[maxBounce] = {}; //closest-hit rays at each bounce, the first being primary
+	IntersectCounts tests;
+	//one pixel in timingInterval is timed, since reading the clock for every
+	//ray would cost more than many of the rays: its shadow rays, and each of
+	//its bounces including the shadow rays cast there
+	uint64_t timedShadowRays = 0;
+	double timedShadowSeconds = 0;
+	uint64_t timedBounces[maxBounce] = {};
+	double timedBounceSeconds[maxBounce] = {};
+
+	uint64_t TotalRays() const { return primaryRays + secondaryRays + shadowRays; }
+	//shadow rays per second of thread time spent on them
+	double ShadowRate() const { return timedShadowSeconds > 0 ? timedShadowRays / timedShadowSeconds : 0; }
+	//thread seconds per ray at a bounce level, from the timed pixels
+	double BounceTime(int bounce) const
+	{
+		return timedBounces[bounce] > 0 ? timedBounceSeconds[bounce] / timedBounces[bounce] : 0;
+	}
+	void Add(const TraceStats &other);
+};
+
+//the last occluder of every shadow ray of a point (one per light, or per
+//draw of lights) at every bounce, kept by one thread while it traces
+//neighbouring pixels
+struct OccluderCache {
+	vector<Occluder> occluders; //maxBounce entries per shadow ray
+
+	Occluder &Get(size_t ray, int bounce) { return occluders[ray * maxBounce + bounce]; }
+};
+
+//what a primary ray hit, enough to shade it again from another viewpoint:
+//shadows do not depend on the view, so only the Phong terms are recomputed
+struct PrimaryHit {
+	vec3 position;              //nudged off the surface, where the shadow rays start
+	vec3 normal;
+	uint32_t material = 0;
+	uint32_t visibleLights = 0; //bit l set when light l is unoccluded
+	bool valid = false;         //false for a miss, or more lights than bits
+};
+
+//determine intersection point for ray from origin, and the given shape;
+//same arithmetic (and return conventions) as the functions in ray.frag
+float IntersectSphere(vec3 center, float radius, vec3 origin, vec3 ray);
+float IntersectPlane(vec3 normal, vec3 point, vec3 origin, vec3 ray);
+//the triangle test takes the triangle's record, TriangleLanes::U, V and W
+float IntersectTriangle(vec4 U, vec4 V, vec4 W, vec3 origin, vec3 ray);
+
+//calculate the primary ray for a point on screen, pixel in [-1, 1] like vPos;
+//fov spans the height, and a frame aspect (width over height) times as wide
+//sees that much further to the sides rather than being stretched
+void PrimaryRay(const Camera &camera, vec2 pixel, vec3 &origin, vec3 &ray, float aspect = 1);
+
+//offset in [0, 1)^2 within pixel (x, y) for the given sample beyond its
+//centre, from a hash of all three so repeated runs produce the same image
+vec2 PixelJitter(int x, int y, int sample);
+
+//unit normal and material of the surface a closest-hit query found, at the
+//point the ray reached it
+void SurfaceAt(const Scene &scene, const Hit &hit, vec3 point, vec3 &normal, uint32_t &material);
+
+//the lights a shading point's shadow rays head for, returning how many
+//rays: one per light, each with share 1, or settings.lightSamples once there
+//are more lights than that, drawn from the light hierarchy stratified over
+//the rays and with shares receiving the factor for what each adds. -1 for a
+//ray no light can reach. lights and shares hold maxLightSamples
+int ShadowLights(const Scene &scene, const BVH &bvh, const TraceSettings &settings, vec3 point, vec3 normal,
+	int bounce, int *lights, float *shares);
+
+//whether a path shaded up to bounce - 1, with the given weight, goes on to
+//trace ray at bounce. When roulette lets it, scale receives the factor for
+//what it gathers from there on and weight starts again from 1
+bool ContinuePath(const TraceSettings &settings, int bounce, vec3 ray, float &weight, float &scale);
+
+//the tracing operation; returns pixel color. Shadow rays try the occluders
+//in cache first when one is given, and primary receives the first hit
+vec3 Trace(const Scene &scene, const BVH &bvh, const TraceSettings &settings, vec3 origin, vec3 ray,
+	TraceStats &stats, OccluderCache *cache = nullptr, PrimaryHit *primary = nullptr);
+
+//the colour Trace gives a hit seen along ray, when its material does not
+//reflect; identical to Trace's result for the ray that made the hit
+vec3 ShadePrimary(const Scene &scene, const PrimaryHit &hit, vec3 ray);
+
+//run work(tile, stats) for every tile index below tileCount on the given number
+//of threads (0 = one per core). Each thread starts with a contiguous share of
+//the indices and, once it runs out, steals the back half of the largest share
+//left. The per-thread stats are added to stats when given. Threads stop
+//between tiles once cancel is set; returns whether every tile ran
+bool ParallelTiles(int tileCount, int threads, const function<void(int, TraceStats &)> &work,
+	TraceStats *stats = nullptr, const atomic<bool> *cancel = nullptr);
+
+//positions of the tiles in a grid, in Morton order, so that tiles close in
+//the order are close in the image
+vector<ivec2> MortonOrder(int tilesX, int tilesY);
+
+//trace every pixel of the image in tiles of tileEdge pixels, in Morton order,
+//on the given number of threads (0 = one per core) and as deep as settings
+//allow, then mark the whole image modified; returns seconds taken. Setting
+//cancel, e.g. because the camera moved, stops the frame after the tiles in
+//progress, leaving the rest as it was
+double RenderCpu(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	int threads = 0, TraceStats *stats = nullptr, int tileEdge = tileSize, const atomic<bool> *cancel = nullptr,
+	const TraceSettings &settings = TraceSettings());
+
+//trace the part of a frame frameSize pixels large that region covers, its
+//bottom-left corner at corner, into region, as RenderCpu traces those pixels;
+//a frame too large to hold, or to trace in one process, can be rendered a
+//band or tile at a time
+double RenderCpuRegion(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *region, ivec2 frameSize,
+	ivec2 corner, int threads = 0, TraceStats *stats = nullptr, int tileEdge = tileSize,
+	const TraceSettings &settings = TraceSettings());
+
+//RenderCpu, also recording into costs what each pixel of the image cost and
+//what its centre primary ray hit. The counters are kept by a per-pixel hook
+//that RenderCpu and RenderCpuRegion are compiled without, so they cost the
+//normal renders nothing
+double RenderCpuCosts(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, CostMap *costs,
+	int threads = 0, TraceStats *stats = nullptr, int tileEdge = tileSize,
+	const TraceSettings &settings = TraceSettings());
@@ -0,0 +1,783 @@
+#include "Distributed.h"
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Sockets
+
+#ifdef _WIN32
+
+typedef SOCKET Socket;
+const Socket noSocket = INVALID_SOCKET;
+#define PollSockets WSAPoll
+
+static bool StartSockets()
+{
+	static bool started = [] {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return started;
+}
+
+static void CloseSocket(Socket s)
+{
+	closesocket(s);
+}
+
+#else
+
+typedef int Socket;
+const Socket noSocket = -1;
+#define PollSockets poll
+
+static bool StartSockets()
+{
+	//writing to a connection the other end has closed should fail, not
+	//raise a signal that ends the process
+	signal(SIGPIPE, SIG_IGN);
+	return true;
+}
+
+static void CloseSocket(Socket s)
+{
+	close(s);
+}
+
+#endif
+
+//tiles and results are small, and each is waited on
+static void NoDelay(Socket s)
+{
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+}
+
+static bool SendAll(Socket s, const char *data, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		int chunk = (int)std::min(bytes, (size_t)1 << 30);
+		int sent = (int)send(s, data, chunk, 0);
+		if (sent <= 0)
+			return false;
+		data += sent;
+		bytes -= sent;
+	}
+	return true;
+}
+
+static bool ReceiveAll(Socket s, char *data, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		int chunk = (int)std::min(bytes, (size_t)1 << 30);
+		int received = (int)recv(s, data, chunk, 0);
+		if (received <= 0)
+			return false;
+		data += received;
+		bytes -= received;
+	}
+	return true;
+}
+
+//whether a read would not block, because data or a hangup is waiting
+static bool Readable(Socket s)
+{
+	pollfd fd = {};
+	fd.fd = s;
+	fd.events = POLLIN;
+	return PollSockets(&fd, 1, 0) > 0;
+}
+
+// --------------------------------------------------------------------------
+// Protocol
+
+//every message is a header and then its body. Both ends are the same build
+//on the same byte order, which the hello checks, so bodies are plain structs
+enum MessageType : uint32_t {
+	HelloMessage = 1, //worker: HelloBody
+	SceneMessage,     //coordinator: the compiled scene, as PackScene makes it
+	ViewMessage,      //coordinator: ViewBody, starting a frame
+	TileMessage,      //coordinator: TileBody, a tile of the current frame to trace
+	ResultMessage,    //worker: the TileBody it was given, then the tile's pixels
+	DoneMessage       //coordinator: no more frames
+};
+
+const uint32_t protocolVersion = 1;
+
+struct MessageHeader {
+	uint32_t type;
+	uint32_t pad;
+	uint64_t bytes;
+};
+
+struct HelloBody {
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t viewSize;
+	uint32_t tileSize;
+};
+
+struct ViewBody {
+	uint32_t frame;
+	int32_t width, height;
+	Camera camera;
+	TraceSettings settings;
+};
+
+struct TileBody {
+	uint32_t frame;
+	int32_t id;
+	int32_t x, y, width, height; //bottom-left corner and size
+};
+
+static HelloBody MakeHello()
+{
+	HelloBody hello;
+	hello.version = protocolVersion;
+	hello.byteOrder = 0x01020304;
+	hello.viewSize = sizeof(ViewBody);
+	hello.tileSize = sizeof(TileBody);
+	return hello;
+}
+
+//send a message whose body is body followed by more, in one piece
+static bool WriteMessage(Socket s, uint32_t type, const void *body = nullptr, size_t bytes = 0,
+	const void *more = nullptr, size_t moreBytes = 0)
+{
+	MessageHeader header = { type, 0, bytes + moreBytes };
+	return SendAll(s, (const char *)&header, sizeof(header)) && SendAll(s, (const char *)body, bytes)
+		&& SendAll(s, (const char *)more, moreBytes);
+}
+
+struct Message {
+	uint32_t type;
+	string body;
+};
+
+static bool ReadMessage(Socket s, Message &message)
+{
+	MessageHeader header;
+	if (!ReceiveAll(s, (char *)&header, sizeof(header)))
+		return false;
+	message.type = header.type;
+	message.body.resize((size_t)header.bytes);
+	return ReceiveAll(s, &message.body[0], message.body.size());
+}
+
+// --------------------------------------------------------------------------
+// Coordinator
+
+struct RenderCoordinator::FrameState {
+	struct Tile {
+		ivec2 corner, size;
+		double sentAt = 0; //when it was last handed out
+		int copies = 0;    //workers holding it
+		bool done = false;
+	};
+
+	ViewBody view;
+	ImageBuffer *image;
+	vector<Tile> tiles;
+	deque<int> pending;
+	int done = 0;
+	double tileSeconds = 0; //from handing a tile out to its result, summed over the results kept
+	DistributedStats stats;
+	chrono::high_resolution_clock::time_point start;
+
+	double Now() const
+	{
+		return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+bool RenderCoordinator::Listen(int port, bool local)
+{
+	Close();
+	if (!StartSockets())
+	{
+		cout << "ERROR: sockets are unavailable" << endl;
+		return false;
+	}
+	Socket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == noSocket)
+	{
+		cout << "ERROR: could not create a socket" << endl;
+		return false;
+	}
+#ifndef _WIN32
+	//a coordinator run again straight away may take the same port
+	int one = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+#endif
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(local ? INADDR_LOOPBACK : INADDR_ANY);
+	address.sin_port = htons((uint16_t)port);
+	socklen_t length = sizeof(address);
+	if (bind(s, (const sockaddr *)&address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0
+		|| getsockname(s, (sockaddr *)&address, &length) != 0)
+	{
+		cout << "ERROR: could not listen on port " << port << endl;
+		CloseSocket(s);
+		return false;
+	}
+	m_listener = (intptr_t)s;
+	m_port = ntohs(address.sin_port);
+	return true;
+}
+
+void RenderCoordinator::SetScene(const Scene &scene, const BVH &bvh)
+{
+	m_scene = PackScene(scene, bvh);
+	for (Connection &connection : m_connections)
+		connection.hasScene = false;
+}
+
+void RenderCoordinator::Close()
+{
+	for (Connection &connection : m_connections)
+	{
+		if (connection.ready)
+			WriteMessage((Socket)connection.socket, DoneMessage);
+		CloseSocket((Socket)connection.socket);
+	}
+	m_connections.clear();
+	if (m_listener != -1)
+		CloseSocket((Socket)m_listener);
+	m_listener = -1;
+	m_port = 0;
+}
+
+void RenderCoordinator::Accept()
+{
+	Socket s = accept((Socket)m_listener, nullptr, nullptr);
+	if (s == noSocket)
+		return;
+	NoDelay(s);
+	Connection connection;
+	connection.socket = (intptr_t)s;
+	m_connections.push_back(move(connection));
+}
+
+//take in what has arrived and act on every whole message; false if the
+//connection has failed or broken the protocol
+bool RenderCoordinator::Receive(Connection &connection, FrameState &frame)
+{
+	char buffer[1 << 16];
+	int received = (int)recv((Socket)connection.socket, buffer, sizeof(buffer), 0);
+	if (received <= 0)
+		return false;
+	connection.inbox.append(buffer, received);
+
+	//nothing a worker sends is larger than the result of the first tile, a
+	//whole one at the corner
+	ivec2 largest = frame.tiles[0].size;
+	size_t limit = sizeof(TileBody) + (size_t)largest.x * largest.y * sizeof(vec3);
+	size_t used = 0;
+	bool ok = true;
+	while (ok && connection.inbox.size() - used >= sizeof(MessageHeader))
+	{
+		MessageHeader header;
+		memcpy(&header, connection.inbox.data() + used, sizeof(header));
+		if (header.bytes > limit)
+			return false;
+		if (connection.inbox.size() - used - sizeof(header) < header.bytes)
+			break;
+		ok = Handle(connection, header.type, connection.inbox.data() + used + sizeof(header), (size_t)header.bytes,
+			frame);
+		used += sizeof(header) + (size_t)header.bytes;
+	}
+	connection.inbox.erase(0, used);
+	return ok;
+}
+
+bool RenderCoordinator::Handle(Connection &connection, uint32_t type, const char *body, size_t bytes,
+	FrameState &frame)
+{
+	if (type == HelloMessage && !connection.ready)
+	{
+		HelloBody expected = MakeHello();
+		if (bytes != sizeof(expected) || memcmp(body, &expected, sizeof(expected)) != 0)
+		{
+			cout << "ERROR: a worker of another build or version tried to connect" << endl;
+			return false;
+		}
+		connection.ready = true;
+		return true;
+	}
+	if (type != ResultMessage || !connection.ready || bytes < sizeof(TileBody))
+		return false;
+
+	//results of an earlier frame come from tiles duplicated or left over
+	TileBody tile;
+	memcpy(&tile, body, sizeof(tile));
+	if (tile.frame != m_frame)
+		return true;
+	if (tile.id < 0 || tile.id >= (int)frame.tiles.size())
+		return false;
+	FrameState::Tile &state = frame.tiles[tile.id];
+	if (ivec2(tile.x, tile.y) != state.corner || ivec2(tile.width, tile.height) != state.size
+		|| bytes != sizeof(TileBody) + (size_t)tile.width * tile.height * sizeof(vec3))
+		return false;
+
+	auto held = find(connection.tiles.begin(), connection.tiles.end(), tile.id);
+	if (held != connection.tiles.end())
+	{
+		connection.tiles.erase(held);
+		state.copies--;
+	}
+	if (!state.done)
+	{
+		frame.image->SetRegion(tile.x, tile.y, tile.width, tile.height, (const vec3 *)(body + sizeof(TileBody)));
+		state.done = true;
+		frame.done++;
+		frame.tileSeconds += frame.Now() - state.sentAt;
+	}
+	return true;
+}
+
+//the next tile for connection: one never handed out or given up on, or once
+//there are none, the one out longest if it is overdue; -1 if there is none
+int RenderCoordinator::NextTile(const Connection &connection, FrameState &frame)
+{
+	while (!frame.pending.empty())
+	{
+		int tile = frame.pending.front();
+		frame.pending.pop_front();
+		if (!frame.tiles[tile].done)
+			return tile;
+	}
+
+	double now = frame.Now();
+	double limit = std::max(slowTileSeconds, slowTileFactor * frame.tileSeconds / std::max(frame.done, 1));
+	int oldest = -1;
+	for (int i = 0; i < (int)frame.tiles.size(); i++)
+	{
+		const FrameState::Tile &tile = frame.tiles[i];
+		if (tile.done || tile.copies != 1 || now - tile.sentAt <= limit
+			|| find(connection.tiles.begin(), connection.tiles.end(), i) != connection.tiles.end())
+			continue;
+		if (oldest < 0 || tile.sentAt < frame.tiles[oldest].sentAt)
+			oldest = i;
+	}
+	if (oldest >= 0)
+		frame.stats.duplicatedTiles++;
+	return oldest;
+}
+
+//bring a worker up to date with the scene and view, and top up its tiles
+void RenderCoordinator::Assign(Connection &connection, FrameState &frame)
+{
+	if (!connection.ready || connection.failed)
+		return;
+	Socket s = (Socket)connection.socket;
+	if (!connection.hasScene)
+	{
+		double start = frame.Now();
+		connection.failed = !WriteMessage(s, SceneMessage, m_scene.data(), m_scene.size());
+		connection.hasScene = !connection.failed;
+		frame.stats.sceneSeconds += frame.Now() - start;
+		frame.stats.sceneShipments++;
+	}
+	if (!connection.hasView && !connection.failed)
+	{
+		connection.failed = !WriteMessage(s, ViewMessage, &frame.view, sizeof(frame.view));
+		connection.hasView = !connection.failed;
+		frame.stats.workers++;
+	}
+	while (!connection.failed && (int)connection.tiles.size() < tilesPerWorker)
+	{
+		int id = NextTile(connection, frame);
+		if (id < 0)
+			break;
+		FrameState::Tile &state = frame.tiles[id];
+		TileBody tile = { m_frame, id, state.corner.x, state.corner.y, state.size.x, state.size.y };
+		connection.failed = !WriteMessage(s, TileMessage, &tile, sizeof(tile));
+		connection.tiles.push_back(id);
+		state.copies++;
+		state.sentAt = frame.Now();
+	}
+}
+
+//close a failed connection, handing its tiles out again
+void RenderCoordinator::Drop(Connection &connection, FrameState &frame)
+{
+	CloseSocket((Socket)connection.socket);
+	connection.failed = true;
+	for (int id : connection.tiles)
+	{
+		FrameState::Tile &tile = frame.tiles[id];
+		if (--tile.copies == 0 && !tile.done)
+		{
+			frame.pending.push_front(id);
+			frame.stats.requeuedTiles++;
+		}
+	}
+	connection.tiles.clear();
+	if (connection.ready)
+		frame.stats.lostWorkers++;
+}
+
+bool RenderCoordinator::RenderFrame(const Camera &camera, const TraceSettings &settings, ImageBuffer *image,
+	int tileEdge, DistributedStats *stats)
+{
+	FrameState frame;
+	frame.start = chrono::high_resolution_clock::now();
+	frame.image = image;
+	frame.stats.sceneBytes = m_scene.size();
+	if (m_listener == -1 || m_scene.empty())
+	{
+		cout << "ERROR: the coordinator needs a scene and a port to listen on" << endl;
+		return false;
+	}
+
+	m_frame++;
+	frame.view.frame = m_frame;
+	frame.view.width = image->Width();
+	frame.view.height = image->Height();
+	frame.view.camera = camera;
+	frame.view.settings = settings;
+
+	tileEdge = std::max(tileEdge, 1);
+	vector<ivec2> order = MortonOrder((image->Width() + tileEdge - 1) / tileEdge,
+		(image->Height() + tileEdge - 1) / tileEdge);
+	frame.tiles.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		FrameState::Tile &tile = frame.tiles[i];
+		tile.corner = order[i] * tileEdge;
+		tile.size = glm::min(ivec2(tileEdge), ivec2(image->Width(), image->Height()) - tile.corner);
+		frame.pending.push_back((int)i);
+	}
+	frame.stats.tiles = (int)frame.tiles.size();
+	for (Connection &connection : m_connections)
+	{
+		connection.tiles.clear();
+		connection.hasView = false;
+	}
+
+	double lastProgress = 0;
+	int lastDone = 0;
+	vector<pollfd> fds;
+	while (frame.done < (int)frame.tiles.size())
+	{
+		for (Connection &connection : m_connections)
+			Assign(connection, frame);
+
+		fds.assign(1 + m_connections.size(), pollfd());
+		fds[0].fd = (Socket)m_listener;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < m_connections.size(); i++)
+		{
+			fds[i + 1].fd = (Socket)m_connections[i].socket;
+			fds[i + 1].events = POLLIN;
+		}
+		//wake now and then to look for overdue tiles
+		if (PollSockets(fds.data(), (unsigned)fds.size(), 50) < 0)
+		{
+			cout << "ERROR: waiting on the workers failed" << endl;
+			return false;
+		}
+		for (size_t i = 0; i < m_connections.size(); i++)
+			if (!m_connections[i].failed && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+				&& !Receive(m_connections[i], frame))
+				m_connections[i].failed = true;
+		if (fds[0].revents & POLLIN)
+			Accept();
+
+		for (Connection &connection : m_connections)
+			if (connection.failed)
+				Drop(connection, frame);
+		m_connections.erase(remove_if(m_connections.begin(), m_connections.end(),
+			[](const Connection &connection) { return connection.failed; }), m_connections.end());
+
+		double now = frame.Now();
+		if (frame.done != lastDone)
+		{
+			lastDone = frame.done;
+			lastProgress = now;
+		}
+		bool working = any_of(m_connections.begin(), m_connections.end(),
+			[](const Connection &connection) { return connection.ready; });
+		if (!working && now - lastProgress > workerWaitSeconds)
+		{
+			cout << "ERROR: no worker connected for " << workerWaitSeconds << " s with " << frame.tiles.size()
+				- frame.done << " tiles left" << endl;
+			return false;
+		}
+	}
+
+	image->MarkModified(0, image->Height());
+	frame.stats.seconds = frame.Now();
+	if (stats)
+		*stats = frame.stats;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Worker
+
+//connect to host:port, retrying while the coordinator may still be starting
+static Socket Connect(const string &host, const string &port)
+{
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	auto start = chrono::high_resolution_clock::now();
+	do
+	{
+		addrinfo *found = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) == 0)
+		{
+			for (addrinfo *a = found; a; a = a->ai_next)
+			{
+				Socket s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+				if (s == noSocket)
+					continue;
+				if (connect(s, a->ai_addr, (int)a->ai_addrlen) == 0)
+				{
+					freeaddrinfo(found);
+					return s;
+				}
+				CloseSocket(s);
+			}
+			freeaddrinfo(found);
+		}
+		this_thread::sleep_for(chrono::milliseconds(100));
+	} while (chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() < workerWaitSeconds);
+	return noSocket;
+}
+
+int RunWorker(const string &address, const WorkerOptions &options)
+{
+	size_t colon = address.rfind(':');
+	if (colon == string::npos || !StartSockets())
+	{
+		cout << "ERROR: cannot reach a coordinator at " << address << ", expected host:port" << endl;
+		return 1;
+	}
+	Socket s = Connect(address.substr(0, colon), address.substr(colon + 1));
+	if (s == noSocket)
+	{
+		cout << "ERROR: no coordinator at " << address << endl;
+		return 1;
+	}
+	NoDelay(s);
+	HelloBody hello = MakeHello();
+	if (!WriteMessage(s, HelloMessage, &hello, sizeof(hello)))
+	{
+		CloseSocket(s);
+		cout << "ERROR: lost the coordinator at " << address << endl;
+		return 1;
+	}
+
+	Scene scene;
+	BVH bvh;
+	bool hasScene = false;
+	ViewBody view;
+	bool hasView = false;
+	ImageBuffer tile;
+	int traced = 0;
+	int code = 0;
+	deque<Message> queue;
+	//take in everything that has arrived, if asked waiting for a message
+	//when there is none; nothing follows Done but the connection closing
+	auto intake = [&](bool wait) {
+		while ((wait && queue.empty()) || ((queue.empty() || queue.back().type != DoneMessage) && Readable(s)))
+		{
+			queue.emplace_back();
+			if (!ReadMessage(s, queue.back()))
+				return false;
+		}
+		return true;
+	};
+	//a tile is stale once a later view, or the coordinator finishing, is queued
+	auto superseded = [&] {
+		return any_of(queue.begin(), queue.end(),
+			[](const Message &m) { return m.type == ViewMessage || m.type == DoneMessage; });
+	};
+
+	for (;;)
+	{
+		if (!intake(true))
+		{
+			CloseSocket(s);
+			cout << "ERROR: lost the coordinator at " << address << endl;
+			return 1;
+		}
+		Message message = move(queue.front());
+		queue.pop_front();
+
+		if (message.type == DoneMessage)
+			break;
+		else if (message.type == SceneMessage)
+			hasScene = UnpackScene(message.body.data(), message.body.size(), scene, bvh);
+		else if (message.type == ViewMessage && message.body.size() == sizeof(view))
+		{
+			memcpy(&view, message.body.data(), sizeof(view));
+			hasView = true;
+		}
+		else if (message.type == TileMessage && message.body.size() == sizeof(TileBody) && hasScene && hasView)
+		{
+			TileBody body;
+			memcpy(&body, message.body.data(), sizeof(body));
+			if (body.frame != view.frame || superseded())
+				continue;
+			if (options.failAfter > 0 && traced == options.failAfter)
+			{
+				cout << "Worker stopping unannounced after " << traced << " tiles" << endl;
+				code = 1;
+				break;
+			}
+			if (body.width <= 0 || body.height <= 0 || body.x < 0 || body.y < 0 || body.x + body.width > view.width
+				|| body.y + body.height > view.height)
+			{
+				cout << "ERROR: the coordinator at " << address << " asked for a tile outside the frame" << endl;
+				code = 1;
+				break;
+			}
+			if (tile.Width() != body.width || tile.Height() != body.height)
+				tile.Allocate(body.width, body.height);
+			RenderCpuRegion(scene, bvh, view.camera, &tile, ivec2(view.width, view.height), ivec2(body.x, body.y),
+				options.threads, nullptr, options.tileEdge, view.settings);
+			if (options.delayMs > 0)
+				this_thread::sleep_for(chrono::milliseconds(options.delayMs));
+			//a coordinator that has finished without this tile may have gone
+			bool received = intake(false);
+			if (received && superseded())
+				continue;
+			if (!received || !WriteMessage(s, ResultMessage, &body, sizeof(body), tile.Row(0),
+				(size_t)body.width * body.height * sizeof(vec3)))
+			{
+				CloseSocket(s);
+				cout << "ERROR: lost the coordinator at " << address << endl;
+				return 1;
+			}
+			traced++;
+		}
+		else
+		{
+			cout << "ERROR: the coordinator at " << address << " sent a message this worker cannot use" << endl;
+			code = 1;
+			break;
+		}
+	}
+	CloseSocket(s);
+	return code;
+}
+
+// --------------------------------------------------------------------------
+// Local worker processes
+
+bool LocalWorkers::Start(const string &executable, int port, int count, const WorkerOptions &options)
+{
+	for (int i = 0; i < count; i++)
+	{
+		vector<string> args = { executable, "--worker", "127.0.0.1:" + to_string(port),
+			"--threads", to_string(options.threads), "--tile", to_string(options.tileEdge) };
+		if (i == 0 && options.failAfter > 0)
+			args.insert(args.end(), { "--fail-after", to_string(options.failAfter) });
+		if (i == 0 && options.delayMs > 0)
+			args.insert(args.end(), { "--slow", to_string(options.delayMs) });
+
+#ifdef _WIN32
+		string line;
+		for (const string &arg : args)
+			line += "\"" + arg + "\" ";
+		STARTUPINFOA startup = {};
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION process = {};
+		if (!CreateProcessA(nullptr, &line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+		{
+			cout << "ERROR: could not start worker " << executable << endl;
+			return false;
+		}
+		CloseHandle(process.hThread);
+		m_processes.push_back((intptr_t)process.hProcess);
+#else
+		vector<char *> argv;
+		for (string &arg : args)
+			argv.push_back(&arg[0]);
+		argv.push_back(nullptr);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		if (pid < 0)
+		{
+			cout << "ERROR: could not start worker " << executable << endl;
+			return false;
+		}
+		m_processes.push_back((intptr_t)pid);
+#endif
+	}
+	return true;
+}
+
+void LocalWorkers::Wait(double seconds)
+{
+	auto start = chrono::high_resolution_clock::now();
+	auto left = [&] {
+		return seconds - chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	};
+	for (intptr_t process : m_processes)
+	{
+#ifdef _WIN32
+		HANDLE handle = (HANDLE)process;
+		if (WaitForSingleObject(handle, (DWORD)(std::max(left(), 0.0) * 1000)) != WAIT_OBJECT_0)
+		{
+			TerminateProcess(handle, 1);
+			WaitForSingleObject(handle, INFINITE);
+		}
+		CloseHandle(handle);
+#else
+		pid_t pid = (pid_t)process;
+		int status;
+		while (waitpid(pid, &status, WNOHANG) == 0)
+		{
+			if (left() <= 0)
+			{
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				break;
+			}
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+#endif
+	}
+	m_processes.clear();
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "imagebuffer.h"
+
+using namespace std;
+
+//edge length of the tiles a coordinator hands to workers; each worker shares
+//its tile out to its threads in tiles of its own
+const int remoteTileEdge = 128;
+//tiles a worker is given ahead, so it never waits on the network between two
+const int tilesPerWorker = 2;
+//once no tile is left to hand out, one that has been out longer than this
+//many times the mean tile time is handed to an idle worker as well, and
+//whichever result arrives first is kept...
+const double slowTileFactor = 4;
+//...though never before this many seconds
+const double slowTileSeconds = 2;
+//a frame with no worker connected, or a worker's first connection, is given
+//up on after this long
+const double workerWaitSeconds = 30;
+
+//how a distributed frame went
+struct DistributedStats {
+	int workers = 0;         //connected workers that took part
+	int tiles = 0;
+	int lostWorkers = 0;     //connections that failed during the frame
+	int requeuedTiles = 0;   //tiles handed out again because their worker was lost
+	int duplicatedTiles = 0; //tiles handed to a second worker because the first was slow
+	int sceneShipments = 0;  //workers sent the compiled scene during the frame
+	size_t sceneBytes = 0;   //size of the compiled scene
+	double sceneSeconds = 0; //spent sending it
+	double seconds = 0;
+};
+
+//what a worker process is told on its command line
+struct WorkerOptions {
+	int threads = 0;         //0 = one per core
+	int tileEdge = tileSize; //of the tiles its threads take turns on
+	//to exercise the coordinator: stop without answering once this many
+	//tiles are traced (0 = never), and hold each result back this long
+	int failAfter = 0;
+	int delayMs = 0;
+};
+
+//shares frames out to worker processes, on this machine or others, that
+//connect over TCP. Each worker is sent the compiled scene once and then, for
+//every frame, the view followed by tiles to trace, tilesPerWorker at a time;
+//the pixels it sends back are assembled into the frame's image. Tiles held
+//by a worker whose connection fails are handed out again, and slow tiles
+//are duplicated, so a frame completes as long as one worker remains.
+//Workers may join at any time and stay connected from frame to frame
+class RenderCoordinator
+{
+public:
+	~RenderCoordinator() { Close(); }
+
+	//listen on port (0 = any free one), on the loopback interface alone when
+	//local; false after printing why if it cannot
+	bool Listen(int port, bool local);
+	int Port() const { return m_port; }
+	//pack scene and bvh to send to every worker before its next tile
+	void SetScene(const Scene &scene, const BVH &bvh);
+	//trace every pixel of image on the workers, in Morton order tiles of
+	//tileEdge pixels, as RenderCpu would; false after printing why if no
+	//worker is left to finish it
+	bool RenderFrame(const Camera &camera, const TraceSettings &settings, ImageBuffer *image,
+		int tileEdge = remoteTileEdge, DistributedStats *stats = nullptr);
+	//tell the workers there are no more frames and stop listening
+	void Close();
+
+private:
+	struct Connection {
+		intptr_t socket;
+		string inbox;          //received bytes not yet making a whole message
+		vector<int> tiles;     //of the current frame, handed out and not answered
+		bool ready = false;    //has said hello
+		bool hasScene = false;
+		bool hasView = false;  //has the current frame's view
+		bool failed = false;
+	};
+	struct FrameState;
+
+	void Accept();
+	bool Receive(Connection &connection, FrameState &frame);
+	bool Handle(Connection &connection, uint32_t type, const char *body, size_t bytes, FrameState &frame);
+	void Assign(Connection &connection, FrameState &frame);
+	int NextTile(const Connection &connection, FrameState &frame);
+	void Drop(Connection &connection, FrameState &frame);
+
+	intptr_t m_listener = -1;
+	int m_port = 0;
+	vector<Connection> m_connections;
+	string m_scene;
+	uint32_t m_frame = 0;
+};
+
+//serve as a worker of the coordinator at address ("host:port") until it has
+//no more frames or the connection fails; returns the process exit code
+int RunWorker(const string &address, const WorkerOptions &options);
+
+//worker processes started on this machine for a coordinator listening on
+//the loopback interface
+class LocalWorkers
+{
+public:
+	~LocalWorkers() { Wait(0); }
+
+	//start count copies of executable as workers of the coordinator on port,
+	//all with options' threads and tile size and the first alone with its
+	//faults; false after printing why if one cannot be started
+	bool Start(const string &executable, int port, int count, const WorkerOptions &options);
+	//wait up to seconds for the workers to exit, then kill any left
+	void Wait(double seconds);
+
+private:
+	vector<intptr_t> m_processes;
+};
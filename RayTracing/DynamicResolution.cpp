@@ -0,0 +1,138 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Controller
+
+void ResolutionController::Update(float frameScale, double seconds)
+{
+	const double headroom = 0.9; //of the budget aimed for, leaving room for noise
+	const float growth = 1.1f;   //most the scale may grow by in one update
+	if (!(seconds > 0) || !(budget > 0))
+		return;
+	float fit = frameScale * (float)sqrt(headroom * budget / seconds);
+	float next = scale + 0.5f * (fit - scale);
+	scale = glm::clamp(std::min(next, scale * growth), minScale, 1.f);
+}
+
+// --------------------------------------------------------------------------
+// Drawing
+
+bool DynamicResolution::Initialize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	//8 bits like the window, so colours clamp the same way at either size
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenFramebuffers(1, &m_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGenQueries(resolutionQueries, m_queries);
+	return complete && !CheckGLErrors();
+}
+
+void DynamicResolution::ReadQueries()
+{
+	//queries finish in the order they were issued, from the oldest slot on
+	for (int i = 0; i < resolutionQueries; i++)
+	{
+		int slot = (m_nextQuery + i) % resolutionQueries;
+		if (!m_pending[slot])
+			continue;
+		GLuint available = 0;
+		glGetQueryObjectuiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &nanoseconds);
+		m_pending[slot] = false;
+		Timed(m_queryScale[slot], nanoseconds * 1e-9);
+	}
+}
+
+void DynamicResolution::Timed(float scale, double seconds)
+{
+	m_lastScale = scale;
+	m_lastSeconds = seconds;
+	if (scale == 1)
+		m_fullFits = seconds <= controller.budget;
+	controller.Update(scale, seconds);
+}
+
+void DynamicResolution::Draw(const Camera &camera, const function<void()> &draw, GLuint output)
+{
+	ReadQueries();
+	bool moved = camera.origin != m_lastCamera.origin || camera.fov != m_lastCamera.fov
+		|| camera.transform != m_lastCamera.transform || camera.oTransform != m_lastCamera.oTransform;
+	m_lastCamera = camera;
+	m_stillFrames = moved ? 0 : m_stillFrames + 1;
+
+	//a still view returns to full resolution unless that has been timed over
+	//the budget; the controller then goes on scaling, and the first full
+	//resolution frame timed within it lets still views have it again
+	bool settled = m_stillFrames >= settleFrames && m_fullFits;
+	float scale = (!enabled || settled) ? 1 : controller.scale;
+	int width = std::max(1, (int)lround(m_width * scale));
+	int height = std::max(1, (int)lround(m_height * scale));
+	bool full = width == m_width && height == m_height;
+	m_currentScale = (float)width / m_width;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, full ? output : m_framebuffer);
+	glViewport(0, 0, width, height);
+	//only the draw is timed: it is what the scale changes the cost of. A
+	//frame whose slot is still awaited goes untimed rather than waiting
+	int slot = m_nextQuery;
+	if (cpuTiming)
+	{
+		glFinish();
+		auto start = chrono::high_resolution_clock::now();
+		draw();
+		glFinish();
+		Timed(m_currentScale, chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+	}
+	else if (!m_pending[slot])
+	{
+		glBeginQuery(GL_TIME_ELAPSED, m_queries[slot]);
+		draw();
+		glEndQuery(GL_TIME_ELAPSED);
+		m_pending[slot] = true;
+		m_queryScale[slot] = m_currentScale;
+		m_nextQuery = (slot + 1) % resolutionQueries;
+	}
+	else
+		draw();
+
+	if (!full)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, output);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, output);
+	glViewport(0, 0, m_width, m_height);
+}
+
+void DynamicResolution::Destroy()
+{
+	if (m_queries[0])
+		glDeleteQueries(resolutionQueries, m_queries);
+	glDeleteFramebuffers(1, &m_framebuffer);
+	glDeleteTextures(1, &m_texture);
+	for (int i = 0; i < resolutionQueries; i++)
+	{
+		m_queries[i] = 0;
+		m_pending[i] = false;
+	}
+	m_framebuffer = 0;
+	m_texture = 0;
+}
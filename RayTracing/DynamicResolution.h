@@ -0,0 +1,77 @@
+#pragma once
+#include <functional>
+
+#include "OGLSupport.h"
+#include "CpuTracer.h"
+
+using namespace std;
+
+const int resolutionQueries = 4; //frames whose draw time may be awaited at once
+const int settleFrames = 4;      //frames the view must hold still before full resolution may return
+
+//picks the resolution scale of each frame from the time earlier ones took to
+//draw, to hold a frame time budget. Drawing cost is taken to follow the
+//pixel count, so the scale that fits the budget is a frame's scale times the
+//square root of the budget over its time
+struct ResolutionController {
+	double budget = 1 / 60.0; //seconds of drawing per frame
+	float minScale = 0.25f;
+	float scale = 1;          //for the next frame the view moves in
+
+	//a frame drawn at frameScale took seconds; aims a little under the
+	//budget, and moves only part of the way to what one frame suggests, so
+	//that a single slow frame does not make the picture jump
+	void Update(float frameScale, double seconds);
+};
+
+//draws ray.frag frames into an offscreen target at a fraction of the
+//output's resolution while the camera moves, sized by a ResolutionController,
+//and upsamples them to the output; once the view has held still for
+//settleFrames it draws at full resolution again, unless full resolution
+//frames run over the budget. Draw times come from timer queries read frames
+//later, so measuring never stalls the frame
+class DynamicResolution
+{
+public:
+	bool enabled = false;
+	//time each draw on the CPU, finishing it before and after, instead of by
+	//timer query: for implementations whose queries miss deferred work, as
+	//llvmpipe's miss its rasterization, and where stalling does not matter
+	bool cpuTiming = false;
+	ResolutionController controller;
+
+	//allocate the target, as large as the output; false if the framebuffer
+	//is incomplete
+	bool Initialize(int width, int height);
+	//render one frame: draw is called with the target bound and the viewport
+	//set to the frame's size, then the frame is stretched over framebuffer
+	//output, which is left bound with the viewport covering it. Drawn
+	//straight to output while disabled
+	void Draw(const Camera &camera, const function<void()> &draw, GLuint output = 0);
+	//delete the target and queries; must be called while their context is current
+	void Destroy();
+
+	//scale and draw time of the last frame whose query has been read, -1
+	//before any has
+	float LastScale() const { return m_lastScale; }
+	double LastSeconds() const { return m_lastSeconds; }
+	//the scale the latest frame was drawn at
+	float CurrentScale() const { return m_currentScale; }
+
+private:
+	void ReadQueries();
+	void Timed(float scale, double seconds);
+
+	int m_width = 0, m_height = 0;
+	GLuint m_texture = 0, m_framebuffer = 0;
+	GLuint m_queries[resolutionQueries] = {};
+	float m_queryScale[resolutionQueries] = {};
+	bool m_pending[resolutionQueries] = {};
+	int m_nextQuery = 0;
+	Camera m_lastCamera = Camera();
+	int m_stillFrames = 0;
+	bool m_fullFits = true; //the latest full resolution frame timed was within the budget
+	float m_currentScale = 1;
+	float m_lastScale = -1;
+	double m_lastSeconds = -1;
+};
@@ -0,0 +1,214 @@
+#include "HdrImage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/packing.hpp>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Layout
+
+static bool HasExtension(const string &path, const char *extension)
+{
+	size_t length = strlen(extension);
+	if (path.size() < length)
+		return false;
+	for (size_t i = 0; i < length; i++)
+		if (tolower((unsigned char)path[path.size() - length + i]) != extension[i])
+			return false;
+	return true;
+}
+
+bool IsHdrPath(const string &path)
+{
+	return HasExtension(path, ".pfm") || HasExtension(path, ".exr");
+}
+
+template <typename T>
+static void Put(string &out, T value)
+{
+	out.append((const char *)&value, sizeof(value));
+}
+
+//an EXR attribute: name, type, size of the value, then the value
+static void PutAttribute(string &out, const char *name, const char *type, const string &value)
+{
+	out.append(name, strlen(name) + 1);
+	out.append(type, strlen(type) + 1);
+	Put(out, (int32_t)value.size());
+	out += value;
+}
+
+//the magic number, version and the header attributes every EXR file needs,
+//for half-float B, G and R channels (channels are listed, and stored in each
+//chunk, in name order) without compression
+static string ExrHeader(int width, int height)
+{
+	string header;
+	Put(header, (int32_t)20000630);
+	Put(header, (int32_t)2);
+
+	string channels;
+	for (const char *name : { "B", "G", "R" })
+	{
+		channels.append(name, 2);
+		Put(channels, (int32_t)1); //HALF
+		Put(channels, (uint32_t)0); //pLinear and reserved bytes
+		Put(channels, (int32_t)1);  //x and y sampling
+		Put(channels, (int32_t)1);
+	}
+	channels.push_back(0);
+	PutAttribute(header, "channels", "chlist", channels);
+	PutAttribute(header, "compression", "compression", string(1, 0)); //NO_COMPRESSION
+
+	string window;
+	for (int32_t v : { 0, 0, width - 1, height - 1 })
+		Put(window, v);
+	PutAttribute(header, "dataWindow", "box2i", window);
+	PutAttribute(header, "displayWindow", "box2i", window);
+	PutAttribute(header, "lineOrder", "lineOrder", string(1, 0)); //INCREASING_Y, top row first
+
+	string one, center;
+	Put(one, 1.f);
+	Put(center, 0.f);
+	Put(center, 0.f);
+	PutAttribute(header, "pixelAspectRatio", "float", one);
+	PutAttribute(header, "screenWindowCenter", "v2f", center);
+	PutAttribute(header, "screenWindowWidth", "float", one);
+	header.push_back(0);
+	return header;
+}
+
+// --------------------------------------------------------------------------
+// Writing
+
+bool HdrWriter::Open(const string &path, int width, int height)
+{
+	m_exr = HasExtension(path, ".exr");
+	m_width = width;
+	m_height = height;
+	if (!IsHdrPath(path) || width <= 0 || height <= 0)
+	{
+		cout << "ERROR: cannot write a " << width << "x" << height << " float image to " << path << endl;
+		return false;
+	}
+	m_out.open(path, ios::binary | ios::trunc);
+	if (!m_out)
+	{
+		cout << "ERROR: could not create " << path << endl;
+		return false;
+	}
+
+	uint64_t end;
+	if (m_exr)
+	{
+		//an offset table of one chunk per scanline, then the chunks, each a
+		//line number and size ahead of the line's B, G and R halves; the
+		//pixel data itself is only written as regions arrive
+		string header = ExrHeader(width, height);
+		m_dataStart = header.size() + 8 * (uint64_t)height;
+		uint64_t chunkBytes = 8 + 6 * (uint64_t)width;
+		m_out.write(header.data(), header.size());
+		vector<uint64_t> offsets(height);
+		for (int line = 0; line < height; line++)
+			offsets[line] = m_dataStart + line * chunkBytes;
+		m_out.write((const char *)offsets.data(), offsets.size() * sizeof(uint64_t));
+		for (int line = 0; line < height; line++)
+		{
+			int32_t chunk[2] = { line, 6 * width };
+			m_out.seekp(offsets[line]);
+			m_out.write((const char *)chunk, sizeof(chunk));
+		}
+		end = m_dataStart + height * chunkBytes;
+	}
+	else
+	{
+		//PFM stores rows bottom first, as ImageBuffer does; a negative scale
+		//marks the floats little-endian
+		string header = "PF\n" + to_string(width) + " " + to_string(height) + "\n-1.0\n";
+		m_out.write(header.data(), header.size());
+		m_dataStart = header.size();
+		end = m_dataStart + 12 * (uint64_t)width * height;
+	}
+
+	//give the file its full size now, so unwritten pixels read as zero
+	m_out.seekp(end - 1);
+	m_out.put(0);
+	if (!m_out)
+	{
+		cout << "ERROR: could not write " << path << endl;
+		return false;
+	}
+	return true;
+}
+
+bool HdrWriter::WriteRegion(int x, int y, int width, int height, const vec3 *pixels)
+{
+	if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > m_width || y + height > m_height)
+	{
+		cout << "ERROR: region " << width << "x" << height << " at " << x << "," << y << " is outside the "
+			<< m_width << "x" << m_height << " image" << endl;
+		return false;
+	}
+
+	if (!m_exr)
+	{
+		//rows as wide as the image lie one after another in the file
+		if (width == m_width)
+		{
+			m_out.seekp(m_dataStart + 12 * (uint64_t)y * m_width);
+			m_out.write((const char *)pixels, 12 * (streamsize)width * height);
+		}
+		else
+			for (int row = 0; row < height; row++)
+			{
+				m_out.seekp(m_dataStart + 12 * ((uint64_t)(y + row) * m_width + x));
+				m_out.write((const char *)(pixels + (size_t)row * width), 12 * (streamsize)width);
+			}
+		return (bool)m_out;
+	}
+
+	uint64_t chunkBytes = 8 + 6 * (uint64_t)m_width;
+	m_halves.resize(3 * (size_t)width);
+	for (int row = 0; row < height; row++)
+	{
+		const vec3 *source = pixels + (size_t)row * width;
+		for (int i = 0; i < width; i++)
+		{
+			m_halves[i] = (uint16_t)packHalf1x16(source[i].b);
+			m_halves[width + i] = (uint16_t)packHalf1x16(source[i].g);
+			m_halves[2 * width + i] = (uint16_t)packHalf1x16(source[i].r);
+		}
+		//EXR lines count down from the top
+		uint64_t chunk = m_dataStart + (uint64_t)(m_height - 1 - (y + row)) * chunkBytes + 8;
+		for (int c = 0; c < 3; c++)
+		{
+			m_out.seekp(chunk + 2 * ((uint64_t)c * m_width + x));
+			m_out.write((const char *)&m_halves[(size_t)c * width], 2 * (streamsize)width);
+		}
+	}
+	return (bool)m_out;
+}
+
+bool HdrWriter::Close()
+{
+	bool ok = (bool)m_out;
+	m_out.close();
+	return ok && !m_out.fail();
+}
+
+bool SaveHdr(const ImageBuffer &image, const string &path)
+{
+	HdrWriter writer;
+	if (!writer.Open(path, image.Width(), image.Height()))
+		return false;
+	bool ok = writer.WriteRegion(0, 0, image.Width(), image.Height(), image.Row(0));
+	ok = writer.Close() && ok;
+	if (!ok)
+		cout << "ERROR: failed writing " << path << endl;
+	return ok;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "imagebuffer.h"
+
+using namespace glm;
+using namespace std;
+
+//whether path names one of the float formats HdrWriter writes, by its extension
+bool IsHdrPath(const string &path);
+
+//writes an image of float colours, unclamped, as .pfm (32-bit floats) or
+//.exr (half floats in uncompressed one-scanline chunks), a region at a time
+//straight from the caller's rows. Every pixel has a fixed place in the file,
+//so regions may come in any order and an image far larger than memory can be
+//rendered and written a band or tile at a time; pixels never written are
+//black. Both formats are written little-endian, as every target here is
+class HdrWriter
+{
+public:
+	//create path, in the format its extension names, for a width x height
+	//image; false after printing why if it cannot be
+	bool Open(const string &path, int width, int height);
+	//store a width x height block of tightly packed pixels, bottom row first
+	//as in an ImageBuffer, with its bottom-left corner at (x, y)
+	bool WriteRegion(int x, int y, int width, int height, const vec3 *pixels);
+	//finish the file; false if any write failed
+	bool Close();
+
+private:
+	ofstream m_out;
+	bool m_exr = false;
+	int m_width = 0, m_height = 0;
+	uint64_t m_dataStart = 0;  //offset of the first row (PFM) or scanline chunk (EXR)
+	vector<uint16_t> m_halves; //one row of a region, a channel at a time, for EXR
+};
+
+//save a whole image in the float format path names, streaming its rows
+bool SaveHdr(const ImageBuffer &image, const string &path);
@@ -0,0 +1,1319 @@
+#include "Headless.h"
+#include "Tracer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Windowless rendering on the CPU tracer
+
+static void PrintUsage()
+{
+	cout << "usage: RayTracing [options]" << endl
+		<< "  --scene <n|file>   scenes/scene<n>.txt or any scene file to render (default 1)" << endl
+		<< "  --synthetic <n>    render a generated scene of about n triangles instead" << endl
+		<< "  --instances <n>    render a generated field of n instances of one mesh instead" << endl
+		<< "  --flatten          replace instances by world space triangles before building the BVH" << endl
+		<< "  --no-cache         always parse the scene file and build its BVH" << endl
+		<< "  --size <pixels|WxH>  width and height of the image (default 1024); WxH for the CPU modes" << endl
+		<< "  --threads <n>      worker threads, 0 = one per core (default 0)" << endl
+		<< "  --tile <pixels>    edge length of the tiles threads take turns on (default 32)" << endl
+		<< "  --wavefront        trace a bounce at a time over waves of pixels rather than pixel by pixel" << endl
+		<< "  --wave <pixels>    edge length of the square waves of --wavefront (default 64)" << endl
+		<< "  --bounces <n>      most bounces a path may take, 1-" << maxBounce << " (default 4)" << endl
+		<< "  --min-weight <w>   end paths whose reflected weight falls to w or below (default 1/256)" << endl
+		<< "  --roulette <n>     from bounce n on, end paths by Russian roulette on their weight (default 0 = off)" << endl
+		<< "  --lights <n>       replace the lights by n point lights scattered through their spheres" << endl
+		<< "  --spp <n>          primary rays per pixel, jittered after the first and averaged (default 1)" << endl
+		<< "  --light-samples <n>  shadow rays per point, to lights drawn from the light BVH once there are more (default 4, at most " << maxLightSamples << ")" << endl
+		<< "  --out <file>       save the rendered image: .png clamped to 8 bits, .pfm or .exr keeping the float colours" << endl
+		<< "  --band <rows>      trace and write to a .pfm or .exr --out this many rows at a time, never holding the whole image" << endl
+		<< "  --path <file>      render every frame of a camera path (see scenes/orbit.path) to --out, its last run" << endl
+		<< "                     of #s replaced by the frame number (default frame####.png)" << endl
+		<< "  --fps <n>          frames per second of camera path time (default 24)" << endl
+		<< "  --jobs <n>         frames of the path traced at once, sharing the threads (default 1)" << endl
+		<< "  --scaling          time the frame on 1, 2, 4, ... threads, or with --workers on 1, 2, 4, ... workers" << endl
+		<< "  --workers <n>      trace the frame on n worker processes started on this machine, --threads each" << endl
+		<< "  --coordinator <port>  trace the frame on workers connecting to this port from other machines" << endl
+		<< "  --worker <host:port>  serve as a worker of the coordinator at host:port, with --threads and --tile" << endl
+		<< "  --remote-tile <pixels>  edge length of the tiles handed to workers (default " << remoteTileEdge << ")" << endl
+		<< "  --fail-after <n>   the (first) worker stops unannounced after n tiles, to exercise re-queueing" << endl
+		<< "  --slow <ms>        the (first) worker holds back each result this long, to exercise duplicating tiles" << endl
+		<< "  --bench <file.json>  time scenes 1-3 and generated ones from fixed poses, writing rates and counters" << endl
+		<< "  --heatmap <base>   record what each pixel costs, saving false-colour base-tests.png, -nodes, -shadow," << endl
+		<< "                     -bounces and -time images and the cost of every object hit to base-objects.csv" << endl
+		<< "  --cancel <ms>      cancel the frame from another thread after this long and time the stop" << endl
+		<< "  --progressive      render progressively until converged, timing each stage" << endl
+		<< "  --reproject        move the camera after a frame and time warping it against a full render" << endl
+		<< "  --gltest           also render with ray.frag in a hidden window, compare the two and save that one" << endl
+		<< "  --bench-kernels    compare the packet intersection kernels with the scalar tests" << endl
+		<< "  --stress-buffers <n>  switch scenes n times in one set of shader buffers and check they stay flat" << endl
+		<< "  --dynamic-res <n>  draw n ray.frag frames with dynamic resolution, the camera turning for the first half" << endl
+		<< "                     then still, reporting each frame's scale; --out saves the last moving frame" << endl
+		<< "  --budget <ms>      frame time the dynamic resolution aims for (default 16.7)" << endl
+		<< "  --permutations     draw scenes 1-3 and generated ones with the generic ray.frag and each one's own" << endl
+		<< "                     build, comparing and timing the two, then switch again through the program cache" << endl
+		<< "  --screenshot       draw ray.frag frames in a hidden window, save one to --out (default screenshot.png)" << endl
+		<< "                     blocking and one asynchronously, and time both on the drawing thread" << endl;
+}
+
+//a number names one of the files behind the number keys, anything else a path
+static string ScenePath(const string &scene)
+{
+	bool number = !scene.empty() && scene.find_first_not_of("0123456789") == string::npos;
+	return number ? NumberedScenePath(atoi(scene.c_str())) : scene;
+}
+
+//parse a scene file, or load its cache, and report how fast it went
+static bool ReadScene(const string &path, bool useCache, Scene &scene, BVH &bvh)
+{
+	if (useCache)
+	{
+		SceneLoadInfo info;
+		if (!LoadCachedScene(path, scene, bvh, &info))
+			return false;
+		cout << "Loaded " << path << (info.fromCache ? " from its cache" : ", cache rebuilt") << " in "
+			<< info.seconds * 1000 << " ms" << endl;
+		return true;
+	}
+
+	size_t bytes = 0;
+	auto start = chrono::high_resolution_clock::now();
+	if (!LoadSceneFile(path, scene, &bytes))
+		return false;
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	cout << "Parsed " << path << ": " << bytes / 1e6 << " MB in " << seconds * 1000 << " ms ("
+		<< bytes / 1e6 / std::max(seconds, 1e-9) << " MB/s)" << endl;
+	return true;
+}
+
+//the pose the interactive view starts from
+static Camera DefaultCamera()
+{
+	Camera camera;
+	camera.origin = vec3(0, 0, 0);
+	camera.fov = 30;
+	return camera;
+}
+
+// --------------------------------------------------------------------------
+// Progressive rendering
+
+//steps the progressive renderer with a window-like frame budget and reports
+//when the preview, the first full sample and convergence arrive
+static void RenderProgressive(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, int threads,
+	const TraceSettings &settings)
+{
+	const double frameBudget = 0.03;
+	ProgressiveRender progressive;
+	progressive.trace = settings;
+	double elapsed = 0, preview = 0, fullSample = 0;
+	int frames = 0;
+	while (!progressive.Converged())
+	{
+		elapsed += progressive.Step(scene, bvh, camera, image, frameBudget, threads);
+		frames++;
+		if (!preview && progressive.PreviewBlock() > 0)
+			preview = elapsed;
+		if (!fullSample && progressive.PreviewBlock() == 1)
+			fullSample = elapsed;
+	}
+	cout << "Preview (" << ProgressiveRender::coarsestBlock << "x" << ProgressiveRender::coarsestBlock
+		<< " blocks) in " << preview * 1000 << " ms, 1 spp in " << fullSample * 1000 << " ms, converged in "
+		<< elapsed * 1000 << " ms over " << frames << " frames and " << progressive.Passes() << " passes: "
+		<< progressive.MeanSamples() << " samples per pixel, " << progressive.Stats().TotalRays() / elapsed / 1e6
+		<< " Mrays/s" << endl;
+}
+
+//settles one view, then moves the camera as the keys would and reports how
+//long each warped frame took, how much of it was traced and how far it is
+//from tracing the new view in full
+static void RenderReprojected(const Scene &scene, const BVH &bvh, const Camera &start, ImageBuffer *image,
+	int threads, const TraceSettings &settings)
+{
+	const int moves = 12;
+	ProgressiveRender progressive;
+	progressive.trace = settings;
+	while (progressive.PreviewBlock() != 1)
+		progressive.Step(scene, bvh, start, image, 1.0, threads);
+
+	ImageBuffer full;
+	full.Allocate(image->Width(), image->Height());
+	size_t pixels = (size_t)image->Width() * image->Height();
+	vec3 position(0);
+	float turn = 0;
+	double warpTotal = 0, fullTotal = 0;
+	for (int i = 0; i < moves; i++)
+	{
+		//alternate a step forward with a turn, one key press each
+		if (i % 2 == 0)
+			position.z -= 0.1f;
+		else
+			turn += 0.01f;
+		Camera camera = start;
+		camera.transform = glm::rotate(start.transform, turn, vec3(0, 1, 0));
+		camera.oTransform = glm::translate(start.oTransform, position);
+
+		double warpSeconds = progressive.Step(scene, bvh, camera, image, 0, threads);
+		double fullSeconds = RenderCpu(scene, bvh, camera, &full, threads, nullptr, tileSize, nullptr, settings);
+		warpTotal += warpSeconds;
+		fullTotal += fullSeconds;
+
+		size_t differing = 0;
+		for (int y = 0; y < image->Height(); y++)
+			for (int x = 0; x < image->Width(); x++)
+			{
+				vec3 d = abs(clamp(image->Row(y)[x], 0.f, 1.f) - clamp(full.Row(y)[x], 0.f, 1.f));
+				if (std::max(d.x, std::max(d.y, d.z)) > 2.f / 255)
+					differing++;
+			}
+		cout << "Move " << i + 1 << ": " << (progressive.Reprojected() ? "warped" : "preview") << " in "
+			<< warpSeconds * 1000 << " ms, " << 100.0 * progressive.Retraced() / pixels << "% traced, "
+			<< 100.0 * differing / pixels << "% off by more than 2/255; full frame " << fullSeconds * 1000
+			<< " ms" << endl;
+
+		//let the view settle again before the next move, as it would between
+		//key presses
+		while (progressive.PreviewBlock() != 1)
+			progressive.Step(scene, bvh, camera, image, 1.0, threads);
+	}
+	cout << "Warped frames " << fullTotal / std::max(warpTotal, 1e-9) << "x faster than full frames" << endl;
+}
+
+// --------------------------------------------------------------------------
+// Cancellation
+
+//renders while another thread cancels the frame after cancelSeconds, as a
+//camera move would, and reports how long the frame took to stop
+static void RenderCancelled(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	int threads, int tileEdge, double cancelSeconds, const TraceSettings &settings)
+{
+	atomic<bool> cancel(false);
+	thread mover([&]() {
+		this_thread::sleep_for(chrono::duration<double>(cancelSeconds));
+		cancel = true;
+	});
+	TraceStats stats;
+	double seconds = RenderCpu(scene, bvh, camera, image, threads, &stats, tileEdge, &cancel, settings);
+	mover.join();
+
+	size_t pixels = (size_t)image->Width() * image->Height();
+	if (stats.primaryRays == pixels)
+		cout << "Frame finished in " << seconds * 1000 << " ms, before the cancel at " << cancelSeconds * 1000
+			<< " ms" << endl;
+	else
+		cout << "Cancelled at " << cancelSeconds * 1000 << " ms, stopped " << (seconds - cancelSeconds) * 1000
+			<< " ms later with " << 100.0 * stats.primaryRays / pixels << "% of the pixels traced" << endl;
+}
+
+// --------------------------------------------------------------------------
+// Cost heatmaps
+
+//renders once plainly and once counting the cost of every pixel, so that the
+//instrumentation's own cost shows, then saves the heatmaps and object table
+static bool RenderCosts(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, int threads,
+	int tileEdge, const TraceSettings &settings, const string &base)
+{
+	double plainSeconds = RenderCpu(scene, bvh, camera, image, threads, nullptr, tileEdge, nullptr, settings);
+	CostMap costs;
+	double seconds = RenderCpuCosts(scene, bvh, camera, image, &costs, threads, nullptr, tileEdge, settings);
+	cout << "Frame traced in " << plainSeconds * 1000 << " ms, " << seconds * 1000 << " ms counting per pixel"
+		<< endl;
+	bool saved = SaveHeatmaps(costs, base);
+	return WriteObjectCosts(costs, scene, base + "-objects.csv") && saved;
+}
+
+// --------------------------------------------------------------------------
+// Banded output
+
+//traces a width x height frame bandRows rows at a time into one band's
+//worth of pixels, writing each band to path before tracing the next, so the
+//frame need never fit in memory
+static int RenderInBands(const Scene &scene, const BVH &bvh, const Camera &camera, int width, int height,
+	int bandRows, int threads, int tileEdge, const TraceSettings &settings, const string &path)
+{
+	HdrWriter writer;
+	if (!writer.Open(path, width, height))
+		return -1;
+	ImageBuffer band;
+	double traceSeconds = 0, writeSeconds = 0;
+	int bands = 0;
+	bool ok = true;
+	for (int y = 0; y < height && ok; y += bandRows, bands++)
+	{
+		int rows = std::min(bandRows, height - y);
+		if (band.Height() != rows)
+			band.Allocate(width, rows);
+		traceSeconds += RenderCpuRegion(scene, bvh, camera, &band, ivec2(width, height), ivec2(0, y), threads, nullptr,
+			tileEdge, settings);
+		auto start = chrono::high_resolution_clock::now();
+		ok = writer.WriteRegion(0, y, width, rows, band.Row(0));
+		writeSeconds += chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	}
+	ok = writer.Close() && ok;
+	cout << width << "x" << height << " in " << bands << " bands of " << bandRows << " rows: " << traceSeconds * 1000
+		<< " ms tracing, " << writeSeconds * 1000 << " ms writing " << path << ", holding "
+		<< (size_t)width * std::min(bandRows, height) * sizeof(vec3) / 1024 << " KB of pixels" << endl;
+	if (!ok)
+		cout << "ERROR: failed writing " << path << endl;
+	return ok ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+// Distributed rendering
+
+static void PrintDistributed(const DistributedStats &stats)
+{
+	cout << "  " << stats.tiles << " tiles, scene of " << stats.sceneBytes / 1024 << " KB sent to "
+		<< stats.sceneShipments << " workers in " << stats.sceneSeconds * 1000 << " ms";
+	if (stats.lostWorkers > 0 || stats.duplicatedTiles > 0)
+		cout << ", " << stats.lostWorkers << " workers lost, " << stats.requeuedTiles << " tiles handed out again and "
+			<< stats.duplicatedTiles << " duplicated";
+	cout << endl;
+}
+
+//one frame on count workers started for it, timed from before they start;
+//negative if it could not be rendered
+static double RenderOnLocalWorkers(const string &executable, const Scene &scene, const BVH &bvh,
+	const Camera &camera, const TraceSettings &settings, ImageBuffer *image, int count, int remoteTile,
+	const WorkerOptions &options, DistributedStats &stats)
+{
+	auto start = chrono::high_resolution_clock::now();
+	RenderCoordinator coordinator;
+	LocalWorkers workers;
+	if (!coordinator.Listen(0, true))
+		return -1;
+	coordinator.SetScene(scene, bvh);
+	if (!workers.Start(executable, coordinator.Port(), count, options))
+		return -1;
+	bool ok = coordinator.RenderFrame(camera, settings, image, remoteTile, &stats);
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	coordinator.Close();
+	workers.Wait(5);
+	return ok ? seconds : -1;
+}
+
+//traces the frame on worker processes: localWorkers started on this machine,
+//or 1, 2, 4, ... of them in turn when scaling, or otherwise those that
+//connect to port
+static int RenderDistributed(const string &executable, const Scene &scene, const BVH &bvh, const Camera &camera,
+	const TraceSettings &settings, ImageBuffer *image, int localWorkers, int port, bool scaling, int remoteTile,
+	const WorkerOptions &options)
+{
+	if (localWorkers == 0)
+	{
+		RenderCoordinator coordinator;
+		if (!coordinator.Listen(port, false))
+			return -1;
+		cout << "Waiting for workers on port " << coordinator.Port() << endl;
+		coordinator.SetScene(scene, bvh);
+		DistributedStats stats;
+		if (!coordinator.RenderFrame(camera, settings, image, remoteTile, &stats))
+			return -1;
+		coordinator.Close();
+		cout << image->Width() << "x" << image->Height() << " on " << stats.workers << " workers in "
+			<< stats.seconds * 1000 << " ms" << endl;
+		PrintDistributed(stats);
+		return 0;
+	}
+
+	double base = 0;
+	for (int n = scaling ? 1 : localWorkers; ; n = std::min(n * 2, localWorkers))
+	{
+		DistributedStats stats;
+		double seconds = RenderOnLocalWorkers(executable, scene, bvh, camera, settings, image, n, remoteTile,
+			options, stats);
+		if (seconds < 0)
+			return -1;
+		if (n == 1)
+			base = seconds;
+		double speedup = base / seconds;
+		cout << n << " worker processes: " << seconds * 1000 << " ms including their start";
+		if (scaling)
+			cout << ", speedup " << speedup << ", efficiency " << 100 * speedup / n << "%";
+		cout << endl;
+		PrintDistributed(stats);
+		if (n == localWorkers)
+			break;
+	}
+	return 0;
+}
+
+// --------------------------------------------------------------------------
+// Shader comparison
+
+//renders with ray.frag and on the CPU, reporting how far apart the two are;
+//image receives the shader's picture. False if the shader could not render
+//or more than one pixel in a thousand is off by more than rounding
+static bool CompareWithShader(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, int threads,
+	const TraceSettings &settings)
+{
+	double shaderSeconds = 0;
+	if (!RenderShader(scene, bvh, camera, image, &shaderSeconds, settings))
+		return false;
+	ImageBuffer cpu;
+	cpu.Allocate(image->Width(), image->Height());
+	double cpuSeconds = RenderCpu(scene, bvh, camera, &cpu, threads, nullptr, tileSize, nullptr, settings);
+
+	//the two differ by rounding, which only matters where it flips an edge or shadow
+	const float tolerance = 2 / 255.f;
+	size_t differing = 0;
+	float largest = 0;
+	for (int y = 0; y < image->Height(); y++)
+		for (int x = 0; x < image->Width(); x++)
+		{
+			vec3 d = abs(clamp(image->Row(y)[x], 0.f, 1.f) - clamp(cpu.Row(y)[x], 0.f, 1.f));
+			float m = std::max(std::max(d.x, d.y), d.z);
+			largest = std::max(largest, m);
+			differing += m > tolerance;
+		}
+	cout << "Shader: " << shaderSeconds * 1000 << " ms, CPU: " << cpuSeconds * 1000 << " ms; "
+		<< differing << " pixels (" << 100.0 * differing / ((size_t)image->Width() * image->Height())
+		<< "%) differ by more than 2/255, at most " << largest * 255 << "/255" << endl;
+	if (differing > (size_t)image->Width() * image->Height() / 1000)
+	{
+		cout << "ERROR: ray.frag does not match the CPU tracer" << endl;
+		return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Screenshot timing
+
+//draws ray.frag frames into a texture in a hidden window and saves one to
+//path the way the P key used to, reading back, setting pixels one by one and
+//encoding between two frames; then captures another with ScreenshotCapture
+//while drawing goes on, and reports what each took on the drawing thread
+static int TimeScreenshot(const Scene &scene, const BVH &bvh, const Camera &camera, int size,
+	const TraceSettings &settings, const string &path)
+{
+	GLFWwindow *window = OpenHiddenWindow(size, size);
+	if (!window)
+		return -1;
+	GLuint program = InitializeShaders();
+	Geometry geometry;
+	SceneBuffers buffers;
+	ScreenshotCapture capture;
+	GLuint texture = 0, framebuffer = 0;
+	bool ok = program && InitializeVAO(&geometry) && LoadGeometry(&geometry, ScreenQuad())
+		&& LoadShapes(scene, bvh, program, buffers);
+	if (ok)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glViewport(0, 0, size, size);
+		glUseProgram(program);
+		glBindVertexArray(geometry.vertexArray);
+		SetCameraUniforms(program, camera);
+		SetTraceUniforms(program, settings);
+
+		auto since = [](chrono::high_resolution_clock::time_point start) {
+			return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() * 1000;
+		};
+		auto drawFrame = [&]() {
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount);
+			glFinish();
+		};
+
+		drawFrame();
+		auto start = chrono::high_resolution_clock::now();
+		vector<vec3> pixels((size_t)size * size);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, size, size, GL_RGB, GL_FLOAT, pixels.data());
+		double readMs = since(start);
+		ImageBuffer image;
+		image.Allocate(size, size);
+		auto ingestStart = chrono::high_resolution_clock::now();
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				image.SetPixel(x, y, pixels[x + y * size]);
+		double setPixelMs = since(ingestStart);
+		auto encodeStart = chrono::high_resolution_clock::now();
+		ok = image.SaveToFile(path);
+		double encodeMs = since(encodeStart);
+		double blockingMs = since(start);
+		ingestStart = chrono::high_resolution_clock::now();
+		image.SetRegion(0, 0, size, size, pixels.data());
+		double setRegionMs = since(ingestStart);
+
+		cout << "Blocking screenshot: " << blockingMs << " ms on the drawing thread (read " << readMs << ", SetPixel "
+			<< setPixelMs << ", encode " << encodeMs << "); SetRegion ingests the same pixels in " << setRegionMs
+			<< " ms" << endl;
+
+		//each capture is taken after a frame and polled after every later
+		//one, as the window's loop does; the first also allocates the
+		//capture's buffers, which later ones reuse
+		for (int round = 0; round < 2 && ok; round++)
+		{
+			double beginMs = 0, worstPollMs = 0;
+			int frames = 0;
+			for (; ok && frames < 1000 && (frames == 0 || capture.Busy()); frames++)
+			{
+				drawFrame();
+				auto captureStart = chrono::high_resolution_clock::now();
+				if (frames == 0)
+				{
+					ok = capture.Begin(size, size, path);
+					beginMs = since(captureStart);
+				}
+				else
+				{
+					capture.Poll();
+					worstPollMs = std::max(worstPollMs, since(captureStart));
+				}
+			}
+			if (capture.Busy())
+			{
+				cout << "ERROR: the screenshot was not written within " << frames << " frames" << endl;
+				ok = false;
+			}
+			cout << (round == 0 ? "Async screenshot" : "Async screenshot again") << ": written after " << frames - 1
+				<< " more frames, taking " << beginMs << " ms to queue and at most " << worstPollMs
+				<< " ms of a later frame" << endl;
+		}
+		capture.Finish();
+		ok = ok && !CheckGLErrors();
+	}
+
+	capture.Destroy();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &texture);
+	buffers.Destroy();
+	DestroyGeometry(&geometry);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDeleteProgram(program);
+	CloseHiddenWindow(window);
+	return ok ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+// Scene switching stress test
+
+//loads scenes 1-3 and a generated one into the same buffers over and over,
+//as the number keys do, with a material and a light edited in place after
+//each; fails if the buffers are still growing once every scene has been
+//seen or if the last upload does not read back intact
+static int StressSceneBuffers(int switches)
+{
+	const int sceneCount = 4;
+	vector<Scene> scenes(sceneCount);
+	vector<BVH> bvhs(sceneCount);
+	for (int i = 0; i < sceneCount - 1; i++)
+		if (!ReadScene(ScenePath(to_string(i + 1)), true, scenes[i], bvhs[i]))
+			return -1;
+	scenes.back() = MakeSyntheticScene(20000);
+	BuildBVH(bvhs.back(), scenes.back());
+
+	GLFWwindow *window = OpenHiddenWindow(64, 64);
+	if (!window)
+		return -1;
+	GLuint program = InitializeShaders();
+	SceneBuffers buffers;
+	bool ok = program != 0;
+	size_t settledBytes = 0;
+	int settledAllocations = 0;
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < switches && ok; i++)
+	{
+		const Scene &scene = scenes[i % sceneCount];
+		ok = LoadShapes(scene, bvhs[i % sceneCount], program, buffers);
+		if (!scene.materials.empty())
+			buffers.UpdateMaterial(scene, (uint32_t)(i % scene.materials.size()));
+		if (!scene.lights.empty())
+			buffers.UpdateLight(scene, 0);
+		if (i == sceneCount - 1)
+		{
+			settledBytes = buffers.AllocatedBytes();
+			settledAllocations = buffers.Allocations();
+		}
+	}
+	glFinish();
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	if (ok && switches > 0)
+	{
+		const Scene &last = scenes[(switches - 1) % sceneCount];
+		vector<Triangle> expected = last.Std140Triangles();
+		vector<Triangle> stored(expected.size());
+		GLint buffer = 0;
+		glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, TriangleBuffer + 1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, stored.size() * sizeof(Triangle), stored.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		if (memcmp(stored.data(), expected.data(), stored.size() * sizeof(Triangle)) != 0)
+		{
+			cout << "ERROR: triangle buffer does not match the scene after " << switches << " switches" << endl;
+			ok = false;
+		}
+		ok = ok && !CheckGLErrors();
+	}
+
+	cout << switches << " scene switches in " << seconds * 1000 << " ms (" << seconds * 1e6 / std::max(switches, 1)
+		<< " us each); buffers hold " << buffers.AllocatedBytes() << " bytes from " << buffers.Allocations()
+		<< " allocations, " << settledBytes << " bytes from " << settledAllocations << " once each scene was seen"
+		<< endl;
+	if (ok && switches >= sceneCount
+		&& (buffers.AllocatedBytes() != settledBytes || buffers.Allocations() != settledAllocations))
+	{
+		cout << "ERROR: scene buffers kept growing" << endl;
+		ok = false;
+	}
+
+	buffers.Destroy();
+	glUseProgram(0);
+	glDeleteProgram(program);
+	CloseHiddenWindow(window);
+	return ok ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+// Shader permutations
+
+//draws scenes 1-3, a generated triangle scene and an instanced one in one
+//hidden window with the generic build of ray.frag and with each scene's own,
+//counting the pixels where the two differ and timing both, then switches
+//through the scenes again, as the number keys do, to check that the cache
+//compiles nothing more
+static int ComparePermutations(int size, const TraceSettings &settings)
+{
+	const int sceneCount = 5;
+	const char *names[sceneCount] = { "scene 1", "scene 2", "scene 3", "synthetic", "instanced" };
+	vector<Scene> scenes(sceneCount);
+	vector<BVH> bvhs(sceneCount);
+	for (int i = 0; i < 3; i++)
+		if (!ReadScene(ScenePath(to_string(i + 1)), true, scenes[i], bvhs[i]))
+			return -1;
+	scenes[3] = MakeSyntheticScene(2000);
+	BuildBVH(bvhs[3], scenes[3]);
+	scenes[4] = MakeInstancedScene(100);
+	BuildBVH(bvhs[4], scenes[4]);
+
+	GLFWwindow *window = OpenHiddenWindow(size, size);
+	if (!window)
+		return -1;
+	QueryGLVersion();
+	ShaderCache cache;
+	Geometry geometry;
+	SceneBuffers buffers;
+	GLuint texture = 0, framebuffer = 0;
+	bool ok = InitializeVAO(&geometry) && LoadGeometry(&geometry, ScreenQuad());
+	if (ok)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glViewport(0, 0, size, size);
+		glBindVertexArray(geometry.vertexArray);
+	}
+
+	//the best of a few draws, and the last one's pixels
+	auto draw = [&](GLuint program, const Scene &scene, const BVH &bvh, vector<vec3> &pixels) {
+		double best = 0;
+		if (!LoadShapes(scene, bvh, program, buffers))
+			return -1.0;
+		SetCameraUniforms(program, DefaultCamera());
+		SetTraceUniforms(program, settings);
+		for (int i = 0; i < 3; i++)
+		{
+			glFinish();
+			auto start = chrono::high_resolution_clock::now();
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount);
+			glFinish();
+			double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+			best = i == 0 ? seconds : std::min(best, seconds);
+		}
+		pixels.resize((size_t)size * size);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, size, size, GL_RGB, GL_FLOAT, pixels.data());
+		return best;
+	};
+
+	GLuint generic = ok ? cache.Get(ShaderPermutation()) : 0;
+	ok = generic != 0;
+	vector<vec3> genericPixels, ownPixels;
+	for (int i = 0; i < sceneCount && ok; i++)
+	{
+		GLuint own = cache.Get(ScenePermutation(scenes[i]));
+		double genericSeconds = draw(generic, scenes[i], bvhs[i], genericPixels);
+		double ownSeconds = own ? draw(own, scenes[i], bvhs[i], ownPixels) : -1;
+		if (!own || genericSeconds < 0 || ownSeconds < 0)
+		{
+			ok = false;
+			break;
+		}
+
+		//the builds should differ only where the compiler reorders arithmetic
+		size_t differing = 0;
+		float largest = 0;
+		for (size_t p = 0; p < genericPixels.size(); p++)
+		{
+			vec3 d = abs(genericPixels[p] - ownPixels[p]);
+			float m = std::max(std::max(d.x, d.y), d.z);
+			largest = std::max(largest, m);
+			differing += m > 2 / 255.f;
+		}
+		cout << names[i] << ": generic " << genericSeconds * 1000 << " ms, specialised " << ownSeconds * 1000
+			<< " ms (" << genericSeconds / ownSeconds << "x); " << differing
+			<< " pixels differ by more than 2/255, at most " << largest * 255 << "/255" << endl;
+		if (differing > genericPixels.size() / 1000)
+		{
+			cout << "ERROR: the specialised build of ray.frag does not match the generic one" << endl;
+			ok = false;
+		}
+	}
+
+	//a second round of switches finds every program already built
+	size_t programs = cache.Programs();
+	int hits = cache.Hits();
+	for (int i = 0; i < sceneCount && ok; i++)
+		ok = cache.Get(ScenePermutation(scenes[i])) != 0;
+	if (ok)
+	{
+		cout << cache.Programs() << " programs compiled in " << cache.CompileSeconds() * 1000 << " ms; switching "
+			<< "through the scenes again took " << cache.Hits() - hits << " cache hits and "
+			<< cache.Programs() - programs << " compiles" << endl;
+		if (cache.Programs() != programs)
+		{
+			cout << "ERROR: the shader cache compiled a permutation it already held" << endl;
+			ok = false;
+		}
+		ok = ok && !CheckGLErrors();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &texture);
+	buffers.Destroy();
+	DestroyGeometry(&geometry);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	cache.Destroy();
+	CloseHiddenWindow(window);
+	return ok ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+// Dynamic resolution
+
+//draws frames with a DynamicResolution in a hidden window, the camera turning
+//a little each frame for the first half and holding still after, as the
+//window's loop would; fails unless the resolution drops while the camera
+//moves if full frames are over budget, and is full once it has stopped
+static int TimeDynamicResolution(const Scene &scene, const BVH &bvh, int size, int frames, double budget,
+	const TraceSettings &settings, const string &path)
+{
+	GLFWwindow *window = OpenHiddenWindow(size, size);
+	if (!window)
+		return -1;
+	QueryGLVersion();
+	GLuint program = InitializeShaders(ScenePermutation(scene).Defines());
+	Geometry geometry;
+	SceneBuffers buffers;
+	DynamicResolution resolution;
+	GLuint texture = 0, framebuffer = 0;
+	bool ok = program && InitializeVAO(&geometry) && LoadGeometry(&geometry, ScreenQuad())
+		&& LoadShapes(scene, bvh, program, buffers) && resolution.Initialize(size, size);
+	if (ok)
+	{
+		//the frames land in a texture of the window's size, standing in for
+		//a window whose pixels need not exist
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glUseProgram(program);
+		glBindVertexArray(geometry.vertexArray);
+		SetTraceUniforms(program, settings);
+		resolution.enabled = true;
+		resolution.controller.budget = budget;
+		//each frame is finished anyway, and llvmpipe's timer queries miss
+		//the rasterizing, which it defers to its own threads
+		resolution.cpuTiming = true;
+
+		int moving = frames / 2;
+		double movingSeconds = 0;
+		int movingTimed = 0;
+		float lowest = 1;
+		bool overBudget = false; //a full resolution frame while moving took longer than the budget
+		for (int frame = 0; frame < frames; frame++)
+		{
+			float turn = 0.02f * std::min(frame, moving);
+			Camera camera = MakeCamera(vec3(0), turn, 0);
+			SetCameraUniforms(program, camera);
+			resolution.Draw(camera, [&]() { glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount); },
+				framebuffer);
+			//as swapping buffers would, let the frame finish before the next
+			glFinish();
+			float scale = resolution.CurrentScale();
+			cout << "Frame " << frame << (frame < moving ? " moving" : " still") << ": scale " << scale << " ("
+				<< (int)lround(size * scale) << "x" << (int)lround(size * scale) << ")";
+			if (resolution.LastSeconds() >= 0)
+				cout << ", latest draw timed " << resolution.LastSeconds() * 1000 << " ms at scale "
+					<< resolution.LastScale();
+			cout << endl;
+			if (frame < moving)
+			{
+				lowest = std::min(lowest, scale);
+				overBudget = overBudget || (resolution.LastScale() == 1 && resolution.LastSeconds() > budget);
+				if (frame >= moving / 2 && resolution.LastSeconds() >= 0)
+				{
+					movingSeconds += resolution.LastSeconds();
+					movingTimed++;
+				}
+			}
+			if (frame == moving - 1 && !path.empty())
+			{
+				ImageBuffer image;
+				image.Allocate(size, size);
+				glReadPixels(0, 0, size, size, GL_RGB, GL_FLOAT, image.Row(0));
+				image.MarkModified(0, size);
+				ok = image.SaveToFile(path) && ok;
+			}
+		}
+
+		if (movingTimed > 0)
+			cout << "Moving frames settled at " << movingSeconds / movingTimed * 1000 << " ms for a " << budget * 1000
+				<< " ms budget, down to scale " << lowest << endl;
+		//still frames go back to full resolution only if it fits the budget
+		if (frames - moving > settleFrames && !overBudget && resolution.CurrentScale() != 1)
+		{
+			cout << "ERROR: full resolution did not return once the camera stopped" << endl;
+			ok = false;
+		}
+		if (frames - moving > settleFrames && overBudget && resolution.CurrentScale() == 1)
+		{
+			cout << "ERROR: still frames went back to full resolution although it runs over budget" << endl;
+			ok = false;
+		}
+		if (overBudget && lowest == 1)
+		{
+			cout << "ERROR: the resolution stayed full while frames ran over budget" << endl;
+			ok = false;
+		}
+		ok = ok && !CheckGLErrors();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &texture);
+	resolution.Destroy();
+	buffers.Destroy();
+	DestroyGeometry(&geometry);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDeleteProgram(program);
+	CloseHiddenWindow(window);
+	return ok ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+// Benchmark
+
+//fixed views for the benchmark: the start pose, one turned and stepped
+//sideways, and one raised and looking down
+static vector<Camera> BenchPoses()
+{
+	vector<Camera> poses(3, DefaultCamera());
+	poses[1].transform = glm::rotate(poses[1].transform, 0.3f, vec3(0, 1, 0));
+	poses[1].oTransform = glm::translate(poses[1].oTransform, vec3(1, 0, 1));
+	poses[2].transform = glm::rotate(poses[2].transform, -0.25f, vec3(1, 0, 0));
+	poses[2].oTransform = glm::translate(poses[2].oTransform, vec3(0, 1.5f, 0));
+	return poses;
+}
+
+//one scene and pose of the benchmark, as a JSON object
+static void WriteBenchRun(ostream &out, const string &scene, const Scene &s, int pose, double seconds,
+	const TraceStats &stats)
+{
+	const IntersectCounts &t = stats.tests;
+	out << "    {\"scene\": \"" << scene << "\", \"pose\": " << pose
+		<< ", \"triangles\": " << s.TriangleCount() << ", \"spheres\": " << s.SphereCount()
+		<< ", \"planes\": " << s.PlaneCount() << ", \"lights\": " << s.lights.size() << "," << endl
+		<< "     \"seconds\": " << seconds << ", \"raysPerSecond\": {\"primary\": " << stats.primaryRays / seconds
+		<< ", \"secondary\": " << stats.secondaryRays / seconds << ", \"shadow\": " << stats.shadowRays / seconds
+		<< ", \"total\": " << stats.TotalRays() / seconds << "}," << endl
+		<< "     \"rays\": {\"primary\": " << stats.primaryRays << ", \"secondary\": " << stats.secondaryRays
+		<< ", \"shadow\": " << stats.shadowRays << ", \"occluded\": " << stats.occludedRays << "}," << endl
+		<< "     \"tests\": {\"nodes\": " << t.nodes << ", \"spheres\": " << t.spheres << ", \"triangles\": "
+		<< t.triangles << ", \"planes\": " << t.planes << "}," << endl
+		<< "     \"bounces\": [";
+	for (int b = 0; b < TraceSettings().bounces; b++)
+		out << (b ? ", " : "") << "{\"rays\": " << stats.bounceRays[b] << ", \"secondsPerRay\": "
+			<< stats.BounceTime(b) << "}";
+	out << "]}";
+}
+
+//renders scenes 1-3 and generated scenes of growing size from every bench
+//pose, keeping the fastest of a few frames, and writes rates and counters as
+//JSON for comparing commits
+static int RunBench(const string &jsonPath, int size, int threads, bool useCache)
+{
+	const int repeats = 3;
+	const int synthetic[] = { 10000, 100000, 1000000 };
+	vector<string> names;
+	for (int i = 1; i <= 3; i++)
+		names.push_back("scene" + to_string(i));
+	for (int count : synthetic)
+		names.push_back("synthetic" + to_string(count));
+
+	ofstream out(jsonPath);
+	if (!out)
+	{
+		cout << "ERROR: could not write " << jsonPath << endl;
+		return -1;
+	}
+	if (threads <= 0)
+		threads = std::max(1u, thread::hardware_concurrency());
+	out << "{" << endl << "  \"size\": " << size << ", \"threads\": " << threads << ", \"bounces\": "
+		<< TraceSettings().bounces << "," << endl << "  \"runs\": [" << endl;
+
+	vector<Camera> poses = BenchPoses();
+	ImageBuffer image;
+	image.Allocate(size, size);
+	bool first = true;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		Scene scene;
+		BVH bvh;
+		if (i < 3)
+		{
+			if (!ReadScene(NumberedScenePath((int)i + 1), useCache, scene, bvh))
+				return -1;
+		}
+		else
+			scene = MakeSyntheticScene(synthetic[i - 3]);
+		if (bvh.nodes.empty())
+			BuildBVH(bvh, scene);
+
+		for (size_t pose = 0; pose < poses.size(); pose++)
+		{
+			double best = 0;
+			TraceStats stats;
+			for (int r = 0; r < repeats; r++)
+			{
+				TraceStats frame;
+				double seconds = RenderCpu(scene, bvh, poses[pose], &image, threads, &frame);
+				if (r == 0 || seconds < best)
+				{
+					best = seconds;
+					stats = frame;
+				}
+			}
+			cout << names[i] << " pose " << pose << ": " << best * 1000 << " ms, " << stats.TotalRays() / best / 1e6
+				<< " Mrays/s" << endl;
+			out << (first ? "" : ",\n");
+			WriteBenchRun(out, names[i], scene, (int)pose, best, stats);
+			first = false;
+		}
+	}
+	out << endl << "  ]" << endl << "}" << endl;
+	if (!out)
+	{
+		cout << "ERROR: could not write " << jsonPath << endl;
+		return -1;
+	}
+	cout << "Wrote " << jsonPath << endl;
+	return 0;
+}
+
+// --------------------------------------------------------------------------
+// Intersection kernel microbenchmark
+
+//runs test() over every ray and reports the rate of ray/primitive tests and the hit count
+template <typename Test>
+static void TimeKernel(const string &name, size_t tests, Test test)
+{
+	auto start = chrono::high_resolution_clock::now();
+	uint64_t hits = test();
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	cout << "  " << name << ": " << tests / seconds / 1e6 << " Mtests/s (" << hits << " hits)" << endl;
+}
+
+static int BenchKernels()
+{
+	const int triangleCount = 4096, rayCount = 2048;
+	mt19937 random(453);
+	uniform_real_distribution<float> unit(-1, 1);
+
+	//small triangles spread over a box in front of the rays' origins
+	vector<vec3> corners(3 * triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		vec3 center = vec3(unit(random), unit(random), -5 + unit(random));
+		for (int c = 0; c < 3; c++)
+			corners[3 * i + c] = center + 0.3f * vec3(unit(random), unit(random), unit(random));
+	}
+	TriangleLanes lanes;
+	auto buildStart = chrono::high_resolution_clock::now();
+	lanes.Resize(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+		lanes.Set(i, corners[3 * i], corners[3 * i + 1], corners[3 * i + 2]);
+	double buildSeconds = chrono::duration<double>(chrono::high_resolution_clock::now() - buildStart).count();
+
+	//coherent packets: 8 neighbouring directions from a shared origin
+	vector<RayPacket> packets(rayCount / packetWidth);
+	vector<vec3> origins(rayCount), rays(rayCount);
+	for (int i = 0; i < rayCount; i++)
+	{
+		origins[i] = vec3(0, 0, 0);
+		vec2 pixel = vec2(unit(random), unit(random)) * 0.8f;
+		if (i % packetWidth)
+			pixel = vec2(rays[i - 1]) / -rays[i - 1].z + 0.01f * vec2(unit(random), unit(random));
+		rays[i] = normalize(vec3(pixel, -1));
+		packets[i / packetWidth].Set(i % packetWidth, origins[i], rays[i], 1e30f);
+	}
+
+	const float far = 1e30f;
+	size_t tests = (size_t)triangleCount * rayCount;
+	cout << "Ray/triangle tests, " << triangleCount << " triangles x " << rayCount << " rays:" << endl;
+	cout << "  intersection records built in " << buildSeconds * 1e9 / triangleCount << " ns per triangle" << endl;
+
+	TimeKernel("scalar corners, old ray.frag", tests, [&]() {
+		uint64_t hits = 0;
+		for (int r = 0; r < rayCount; r++)
+			for (int i = 0; i < triangleCount; i++)
+				hits += IntersectTriangleCorners(lanes.A(i), lanes.B(i), lanes.C(i), origins[r], rays[r]) > 0;
+		return hits;
+	});
+	TimeKernel("scalar records, ray.frag port", tests, [&]() {
+		uint64_t hits = 0;
+		for (int r = 0; r < rayCount; r++)
+			for (int i = 0; i < triangleCount; i++)
+				hits += IntersectTriangle(lanes.U(i), lanes.V(i), lanes.W(i), origins[r], rays[r]) > 0;
+		return hits;
+	});
+	TimeKernel("scalar Moller-Trumbore, corners", tests, [&]() {
+		uint64_t hits = 0;
+		for (int r = 0; r < rayCount; r++)
+			for (int i = 0; i < triangleCount; i++)
+				hits += IntersectTriangleMT(lanes.A(i), lanes.B(i), lanes.C(i), origins[r], rays[r]) > 0;
+		return hits;
+	});
+
+	for (const IntersectKernels *kernels : { &ScalarKernels(), SseKernels(), Avx2Kernels() })
+	{
+		if (!kernels)
+			continue;
+		float t[packetWidth];
+		TimeKernel(string(kernels->name) + " 1 ray x 8 triangles", tests, [&]() {
+			uint64_t hits = 0;
+			for (int r = 0; r < rayCount; r++)
+				for (int i = 0; i < triangleCount; i += packetWidth)
+					hits += LaneCount(kernels->triangles(lanes, i, origins[r], rays[r], 0, far, t));
+			return hits;
+		});
+		TimeKernel(string(kernels->name) + " 8 rays x 1 triangle", tests, [&]() {
+			uint64_t hits = 0;
+			for (const RayPacket &packet : packets)
+				for (int i = 0; i < triangleCount; i++)
+					hits += LaneCount(kernels->packetTriangle(packet, lanes, i, 0, t));
+			return hits;
+		});
+	}
+	cout << "Selected kernels: " << Kernels().name << endl;
+	return 0;
+}
+
+int RunHeadless(int argc, char *argv[])
+{
+	string sceneName = "1";
+	int synthetic = 0;
+	int instances = 0;
+	bool flatten = false;
+	int size = 1024;
+	int width = 0, height = 0;
+	int threads = 0;
+	int tileEdge = tileSize;
+	bool wavefront = false;
+	int wavefrontEdge = waveEdge;
+	TraceSettings settings;
+	int lightCount = 0;
+	int bandRows = 0;
+	double cancelSeconds = 0;
+	bool scaling = false;
+	bool progressive = false;
+	bool reproject = false;
+	bool glTest = false;
+	bool screenshot = false;
+	bool permutations = false;
+	int dynamicFrames = 0;
+	double budget = 1 / 60.0;
+	bool useCache = true;
+	int localWorkers = 0;
+	int coordinatorPort = -1;
+	int remoteTile = remoteTileEdge;
+	string workerAddress;
+	string pathFile;
+	string heatmapBase;
+	BatchSettings batch;
+	WorkerOptions workerOptions;
+	string outFile;
+	string benchFile;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--scene") && hasValue)
+			sceneName = argv[++i];
+		else if (!strcmp(argv[i], "--synthetic") && hasValue)
+			synthetic = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--instances") && hasValue)
+			instances = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--flatten"))
+			flatten = true;
+		else if (!strcmp(argv[i], "--size") && hasValue)
+		{
+			//one number for a square image, or the width and height apart
+			const char *value = argv[++i];
+			const char *x = strchr(value, 'x');
+			width = atoi(value);
+			height = x ? atoi(x + 1) : width;
+			size = width == height ? width : 0;
+		}
+		else if (!strcmp(argv[i], "--threads") && hasValue)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--tile") && hasValue)
+			tileEdge = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--wavefront"))
+			wavefront = true;
+		else if (!strcmp(argv[i], "--wave") && hasValue)
+			wavefrontEdge = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bounces") && hasValue)
+			settings.bounces = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--min-weight") && hasValue)
+			settings.minWeight = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--roulette") && hasValue)
+			settings.rouletteBounce = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--lights") && hasValue)
+			lightCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--spp") && hasValue)
+			settings.samples = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--path") && hasValue)
+			pathFile = argv[++i];
+		else if (!strcmp(argv[i], "--fps") && hasValue)
+			batch.fps = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--jobs") && hasValue)
+			batch.jobs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--light-samples") && hasValue)
+			settings.lightSamples = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--heatmap") && hasValue)
+			heatmapBase = argv[++i];
+		else if (!strcmp(argv[i], "--cancel") && hasValue)
+			cancelSeconds = atof(argv[++i]) / 1000;
+		else if (!strcmp(argv[i], "--out") && hasValue)
+			outFile = argv[++i];
+		else if (!strcmp(argv[i], "--band") && hasValue)
+			bandRows = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bench") && hasValue)
+			benchFile = argv[++i];
+		else if (!strcmp(argv[i], "--scaling"))
+			scaling = true;
+		else if (!strcmp(argv[i], "--workers") && hasValue)
+			localWorkers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--coordinator") && hasValue)
+			coordinatorPort = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--worker") && hasValue)
+			workerAddress = argv[++i];
+		else if (!strcmp(argv[i], "--remote-tile") && hasValue)
+			remoteTile = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--fail-after") && hasValue)
+			workerOptions.failAfter = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--slow") && hasValue)
+			workerOptions.delayMs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--progressive"))
+			progressive = true;
+		else if (!strcmp(argv[i], "--reproject"))
+			reproject = true;
+		else if (!strcmp(argv[i], "--gltest"))
+			glTest = true;
+		else if (!strcmp(argv[i], "--screenshot"))
+			screenshot = true;
+		else if (!strcmp(argv[i], "--no-cache"))
+			useCache = false;
+		else if (!strcmp(argv[i], "--bench-kernels"))
+			return BenchKernels();
+		else if (!strcmp(argv[i], "--dynamic-res") && hasValue)
+			dynamicFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--budget") && hasValue)
+			budget = atof(argv[++i]) / 1000;
+		else if (!strcmp(argv[i], "--permutations"))
+			permutations = true;
+		else if (!strcmp(argv[i], "--stress-buffers") && hasValue)
+			return StressSceneBuffers(atoi(argv[++i]));
+		else
+		{
+			PrintUsage();
+			return -1;
+		}
+	}
+	if (width == 0)
+		width = height = size;
+	//the shader modes and the benchmark keep to square images
+	bool square = !benchFile.empty() || screenshot || glTest || permutations || dynamicFrames > 0;
+	if (width <= 0 || height <= 0 || (square && width != height) || tileEdge <= 0 || wavefrontEdge <= 0
+		|| settings.bounces < 1 || settings.bounces > maxBounce
+		|| settings.minWeight < 0 || settings.rouletteBounce < 0 || settings.lightSamples < 1
+		|| settings.lightSamples > maxLightSamples || lightCount < 0 || bandRows < 0
+		|| (bandRows > 0 && !IsHdrPath(outFile)) || localWorkers < 0 || coordinatorPort > 65535 || remoteTile <= 0
+		|| workerOptions.failAfter < 0 || workerOptions.delayMs < 0 || settings.samples < 1
+		|| (wavefront && (settings.samples > 1 || !heatmapBase.empty())) || !(batch.fps > 0) || batch.jobs < 1
+		|| dynamicFrames < 0 || !(budget > 0))
+	{
+		PrintUsage();
+		return -1;
+	}
+	workerOptions.threads = threads;
+	workerOptions.tileEdge = tileEdge;
+	if (!workerAddress.empty())
+		return RunWorker(workerAddress, workerOptions);
+	if (!benchFile.empty())
+		return RunBench(benchFile, size, threads, useCache);
+	if (permutations)
+		return ComparePermutations(size, settings);
+
+	Scene scene;
+	BVH bvh;
+	if (synthetic > 0)
+		scene = MakeSyntheticScene(synthetic);
+	else if (instances > 0)
+		scene = MakeInstancedScene(instances);
+	else if (!ReadScene(ScenePath(sceneName), useCache, scene, bvh))
+		return -1;
+	Camera camera = DefaultCamera();
+	ImageBuffer image;
+	if (bandRows == 0 && pathFile.empty())
+		image.Allocate(width, height);
+
+	if (flatten && scene.InstanceCount() > 0)
+	{
+		scene.FlattenInstances();
+		bvh = BVH();
+	}
+
+	//a cached scene arrives with its BVH
+	if (bvh.nodes.empty())
+	{
+		double buildSeconds = BuildBVH(bvh, scene);
+		cout << "BVH built in " << buildSeconds * 1000 << " ms" << endl;
+	}
+	if (lightCount > 0 && !scene.lights.empty())
+	{
+		ScatterLights(scene, lightCount);
+		auto start = chrono::high_resolution_clock::now();
+		BuildLightTree(bvh.lightNodes, scene.lights);
+		cout << lightCount << " lights, light BVH of " << bvh.lightNodes.size() << " nodes built in "
+			<< chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() * 1000 << " ms" << endl;
+	}
+	cout << scene.TriangleCount() << " triangles, " << scene.SphereCount() << " spheres: BVH of "
+		<< bvh.nodes.size() << " nodes, depth " << BVHDepth(bvh) << endl;
+	if (scene.TriangleCount() > 0)
+		cout << "Triangle storage: " << scene.TriangleBytes() / scene.TriangleCount() << " bytes per triangle ("
+			<< sizeof(Triangle) << " as std140), plus " << bvh.nodes.size() * sizeof(BVHNode) / scene.TriangleCount()
+			<< " of BVH" << endl;
+	if (scene.InstanceCount() > 0)
+		cout << scene.InstanceCount() << " instances of " << scene.meshes.size() << " meshes place "
+			<< scene.InstancedTriangleCount() << " triangles in " << scene.InstanceBytes() << " bytes ("
+			<< sizeof(Instance) << " per instance), flattened they would take "
+			<< scene.InstancedTriangleCount() * (TriangleLanes::bytesPerTriangle + sizeof(uint32_t)) << endl;
+
+	//the whole frame, pixel by pixel or in waves
+	auto render = [&](ImageBuffer *target, int n, TraceStats *frameStats) {
+		return wavefront ? RenderWavefront(scene, bvh, camera, target, n, frameStats, wavefrontEdge, nullptr, settings)
+			: RenderCpu(scene, bvh, camera, target, n, frameStats, tileEdge, nullptr, settings);
+	};
+
+	if (!pathFile.empty())
+	{
+		vector<CameraKey> keys;
+		if (!LoadCameraPath(pathFile, keys))
+			return -1;
+		batch.width = width;
+		batch.height = height;
+		batch.threads = threads;
+		batch.tileEdge = tileEdge;
+		batch.trace = settings;
+		if (!outFile.empty())
+			batch.outPattern = outFile;
+		return RenderPath(scene, bvh, keys, batch);
+	}
+	else if (bandRows > 0)
+		return RenderInBands(scene, bvh, camera, width, height, bandRows, threads, tileEdge, settings, outFile);
+	else if (localWorkers > 0 || coordinatorPort >= 0)
+	{
+		if (RenderDistributed(argv[0], scene, bvh, camera, settings, &image, localWorkers, coordinatorPort, scaling,
+			remoteTile, workerOptions) != 0)
+			return -1;
+	}
+	else if (scaling)
+	{
+		int cores = std::max(1u, thread::hardware_concurrency());
+		double base = 0;
+		for (int n = 1; ; n = std::min(n * 2, cores))
+		{
+			double seconds = render(&image, n, nullptr);
+			if (n == 1)
+				base = seconds;
+			double speedup = base / seconds;
+			cout << n << " threads: " << seconds * 1000 << " ms, speedup " << speedup
+				<< ", efficiency " << 100 * speedup / n << "%" << endl;
+			if (n == cores)
+				break;
+		}
+	}
+	else if (dynamicFrames > 0)
+		return TimeDynamicResolution(scene, bvh, size, dynamicFrames, budget, settings, outFile);
+	else if (screenshot)
+		return TimeScreenshot(scene, bvh, camera, size, settings, outFile.empty() ? "screenshot.png" : outFile);
+	else if (glTest)
+	{
+		if (!CompareWithShader(scene, bvh, camera, &image, threads, settings))
+			return -1;
+	}
+	else if (progressive)
+		RenderProgressive(scene, bvh, camera, &image, threads, settings);
+	else if (reproject)
+		RenderReprojected(scene, bvh, camera, &image, threads, settings);
+	else if (cancelSeconds > 0)
+		RenderCancelled(scene, bvh, camera, &image, threads, tileEdge, cancelSeconds, settings);
+	else if (!heatmapBase.empty())
+	{
+		if (!RenderCosts(scene, bvh, camera, &image, threads, tileEdge, settings, heatmapBase))
+			return -1;
+	}
+	else
+	{
+		TraceStats stats;
+		double seconds = render(&image, threads, &stats);
+		cout << width << "x" << height << " in " << seconds * 1000 << " ms: "
+			<< stats.primaryRays << " primary, " << stats.secondaryRays << " secondary, "
+			<< stats.shadowRays << " shadow rays, " << stats.TotalRays() / seconds / 1e6
+			<< " Mrays/s" << endl;
+		if (stats.shadowRays > 0)
+			cout << "Shadow rays: " << 100.0 * stats.occludedRays / stats.shadowRays << "% occluded, "
+				<< 100.0 * stats.occluderCacheHits / std::max<uint64_t>(stats.occludedRays, 1)
+				<< "% of those by the cached occluder, " << stats.ShadowRate() / 1e6 << " Mrays/s" << endl;
+	}
+
+	if (!outFile.empty() && !image.SaveToFile(outFile))
+		return -1;
+	return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+//entry point for the windowless modes, selected by command line arguments;
+//returns the process exit code
+int RunHeadless(int argc, char *argv[]);
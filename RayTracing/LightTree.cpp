@@ -0,0 +1,186 @@
+#include "LightTree.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Construction
+
+//node gets the bounds and power of lights[ids[first] .. ids[first + count]),
+//becoming their parent or, for one light, its leaf
+static void BuildNode(vector<LightNode> &nodes, uint32_t index, const vector<Light> &lights,
+	vector<uint32_t> &ids, uint32_t first, uint32_t count)
+{
+	//the sphere is centred on the box around the lights' spheres and reaches
+	//the farthest of them
+	vec3 lo = vec3(numeric_limits<float>::max()), hi = -lo;
+	vec3 centresLo = lo, centresHi = hi;
+	float power = 0;
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		const Light &light = lights[ids[i]];
+		vec3 center = vec3(light.center);
+		lo = glm::min(lo, center - light.radius);
+		hi = glm::max(hi, center + light.radius);
+		centresLo = glm::min(centresLo, center);
+		centresHi = glm::max(centresHi, center);
+		power += light.intensity * (light.color.r + light.color.g + light.color.b) / 3;
+	}
+	vec3 center = (lo + hi) * 0.5f;
+	float radius = 0;
+	for (uint32_t i = first; i < first + count; i++)
+		radius = glm::max(radius, length(vec3(lights[ids[i]].center) - center) + lights[ids[i]].radius);
+	nodes[index] = LightNode();
+	nodes[index].center = center;
+	nodes[index].radius = radius;
+	nodes[index].power = power;
+	if (count == 1)
+	{
+		nodes[index].child = ids[first] | lightLeafBit;
+		return;
+	}
+
+	vec3 extent = centresHi - centresLo;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	uint32_t half = count / 2;
+	nth_element(ids.begin() + first, ids.begin() + first + half, ids.begin() + first + count,
+		[&](uint32_t a, uint32_t b) { return lights[a].center[axis] < lights[b].center[axis]; });
+
+	uint32_t left = (uint32_t)nodes.size();
+	nodes[index].child = left;
+	nodes.resize(nodes.size() + 2);
+	BuildNode(nodes, left, lights, ids, first, half);
+	BuildNode(nodes, left + 1, lights, ids, first + half, count - half);
+	nodes[index].leftPower = nodes[left].power;
+}
+
+void BuildLightTree(vector<LightNode> &nodes, const vector<Light> &lights)
+{
+	nodes.clear();
+	if (lights.empty())
+		return;
+	vector<uint32_t> ids(lights.size());
+	for (uint32_t i = 0; i < ids.size(); i++)
+		ids[i] = i;
+	//children are allocated in pairs, so a tree of n leaves has 2n - 1 nodes
+	nodes.reserve(2 * lights.size() - 1);
+	nodes.resize(1);
+	BuildNode(nodes, 0, lights, ids, 0, (uint32_t)lights.size());
+}
+
+// --------------------------------------------------------------------------
+// Sampling
+
+//the node's power times a bound on the cosine of the normal with a direction
+//into its sphere. A point of the sphere is at most radius further along the
+//normal than its centre, and at least dist - radius away, which costs one
+//square root; the bound is 0 exactly when the whole sphere is behind the
+//surface, as is the true largest cosine
+static inline float Importance(const LightNode &node, vec3 point, vec3 normal)
+{
+	vec3 toNode = node.center - point;
+	float dist = length(toNode);
+	if (dist <= node.radius)
+		return node.power;
+	float cosBound = (dot(toNode, normal) + node.radius) / (dist - node.radius);
+	return node.power * glm::clamp(cosBound, 0.f, 1.f);
+}
+
+//where one draw has got to: while by importance, u is rescaled to [0, 1)
+//within each branch taken; once by power, it runs through the power of the
+//node it switched at, top
+struct LightDraw {
+	uint32_t index = 0;
+	uint32_t top = 0;
+	float u;
+	float pdf = 1;
+	bool byPower = false;
+	bool done = false;
+};
+
+void SampleLights(const vector<LightNode> &nodes, vec3 point, vec3 normal, const float *u, int count,
+	int *lights, float *pdfs)
+{
+	bool reachable = !nodes.empty() && Importance(nodes[0], point, normal) > 0;
+	LightDraw draws[maxLightSamples];
+	for (int k = 0; k < count; k++)
+	{
+		draws[k].u = u[k];
+		draws[k].done = !reachable;
+		lights[k] = -1;
+		pdfs[k] = 0;
+	}
+
+	//the draws take a level each in turn, so that their chains of dependent
+	//loads overlap rather than follow one another
+	for (bool active = reachable; active; )
+	{
+		active = false;
+		for (int k = 0; k < count; k++)
+		{
+			LightDraw &d = draws[k];
+			if (d.done)
+				continue;
+			const LightNode &node = nodes[d.index];
+			if (node.IsLeaf())
+			{
+				d.done = true;
+				float pdf = d.byPower ? d.pdf * node.power / nodes[d.top].power : d.pdf;
+				//rounding may carry a draw by power onto a light of no power
+				if (pdf > 0)
+				{
+					lights[k] = (int)node.Light();
+					pdfs[k] = pdf;
+				}
+				continue;
+			}
+			active = true;
+
+			if (!d.byPower)
+			{
+				vec3 toNode = node.center - point;
+				if (node.radius * node.radius < lightSpreadLimit * lightSpreadLimit * dot(toNode, toNode))
+				{
+					d.byPower = true;
+					d.top = d.index;
+					d.u *= node.power;
+				}
+				else
+				{
+					uint32_t left = node.child;
+					float leftImportance = Importance(nodes[left], point, normal);
+					float rightImportance = Importance(nodes[left + 1], point, normal);
+					//a parent's looser sphere may reach the point where neither child's does
+					if (!(leftImportance + rightImportance > 0))
+					{
+						d.done = true;
+						continue;
+					}
+					float pLeft = leftImportance / (leftImportance + rightImportance);
+					//rounding must not carry u to 1, past a branch of weight 0
+					float v = glm::min(d.u, 0.99999994f);
+					if (v < pLeft)
+					{
+						d.index = left;
+						d.u = v / pLeft;
+						d.pdf *= pLeft;
+					}
+					else
+					{
+						d.index = left + 1;
+						d.u = (v - pLeft) / (1 - pLeft);
+						d.pdf *= 1 - pLeft;
+					}
+					continue;
+				}
+			}
+
+			bool right = d.u >= node.leftPower;
+			d.u -= right ? node.leftPower : 0;
+			d.index = node.child + (right ? 1 : 0);
+		}
+	}
+}
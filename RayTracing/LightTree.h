@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+using namespace glm;
+using namespace std;
+
+//set in LightNode::child for leaves, which hold one light each
+const uint32_t lightLeafBit = 0x80000000u;
+//most lights SampleLights draws for one point
+const int maxLightSamples = 16;
+//a node whose sphere's radius is below this share of its distance from the
+//point looks the same from everywhere on it, so its lights are drawn by power
+const float lightSpreadLimit = 0.125f;
+
+//one node of the light hierarchy; 32 bytes, laid out as ray.frag's LightNode
+struct LightNode {
+	vec3 center;     //of a sphere holding the spheres of the lights below, a point light's being its centre
+	float radius;
+	float power;     //summed intensity times mean colour of the lights below
+	uint32_t child;  //interior: index of the left child (right is +1); leaf: the light, with lightLeafBit
+	float leftPower; //the left child's power, so drawing by power loads one node per level
+	float pad;
+
+	bool IsLeaf() const { return (child & lightLeafBit) != 0; }
+	uint32_t Light() const { return child & ~lightLeafBit; }
+};
+
+//binary hierarchy over the lights, splitting at the median of the longest
+//axis of their centres; nodes[0] is the root and a scene without lights has
+//no nodes. The lights keep their order
+void BuildLightTree(vector<LightNode> &nodes, const vector<Light> &lights);
+
+//draw count (at most maxLightSamples) lights for a point with the given
+//normal, the k'th chosen by u[k] in [0, 1). Each draw descends from the root
+//taking a child in proportion to its importance: its power times a bound on
+//the cosine between the normal and a direction into its sphere. Below a node
+//that looks small from the point the cosine hardly varies, and the draw goes
+//on by power alone. lights[k] receives the light, -1 if none can reach the
+//point, and pdfs[k] its probability. Lights with none of their sphere in
+//front of the surface are never drawn, since their shadow ray would leave
+//through it
+void SampleLights(const vector<LightNode> &nodes, vec3 point, vec3 normal, const float *u, int count,
+	int *lights, float *pdfs);
@@ -0,0 +1,130 @@
+#include "MappedFile.h"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const string &path)
+{
+	Close();
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	file = handle;
+	opened = true;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize))
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0)
+		return true;
+
+	mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+		data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	data = nullptr;
+	mapping = file = nullptr;
+	size = 0;
+	opened = false;
+}
+
+#else
+
+bool MappedFile::Open(const string &path)
+{
+	Close();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	opened = true;
+	size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			close(fd);
+			size = 0;
+			opened = false;
+			return false;
+		}
+		//the parsers read front to back, so let the kernel read ahead aggressively
+		madvise(view, size, MADV_SEQUENTIAL);
+		data = (const char *)view;
+	}
+	//the mapping stays valid after the descriptor is closed
+	close(fd);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		munmap((void *)data, size);
+	data = nullptr;
+	size = 0;
+	opened = false;
+}
+
+#endif
+
+bool FileStamp(const string &path, unsigned long long &size, long long &modified)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+		return false;
+	modified = (long long)info.st_mtime * 1000000000;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+#ifdef __APPLE__
+	modified = (long long)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	modified = (long long)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+	size = (unsigned long long)info.st_size;
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+//read-only view of a whole file mapped into memory; the contents are paged in
+//on first touch and are not null terminated
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	//map the file, replacing any earlier mapping; false if it cannot be opened
+	bool Open(const string &path);
+	void Close();
+
+	const char *Data() const { return data; }
+	size_t Size() const { return size; }
+	bool IsOpen() const { return opened; }
+
+private:
+	const char *data = nullptr;
+	size_t size = 0;
+	bool opened = false; //empty files open with no mapping
+#ifdef _WIN32
+	void *file = nullptr;
+	void *mapping = nullptr;
+#endif
+};
+
+//size and modification time of a file, the latter in nanoseconds where the
+//platform records them; false if the file does not exist
+bool FileStamp(const string &path, unsigned long long &size, long long &modified);
@@ -14,6 +14,14 @@
 using namespace std;
 using namespace glm;
 
+//OpenGL 4.3 tokens used with the 4.0 loader in middleware/glad; the entry
+//points they go with are all from earlier versions
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BUFFER_BINDING 0x90D3
+#define GL_MAX_SHADER_STORAGE_BLOCK_SIZE 0x90DE
+#endif
+
 void QueryGLVersion();
 bool CheckGLErrors();
 string LoadSource(const string &filename);
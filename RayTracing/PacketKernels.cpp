@@ -0,0 +1,401 @@
+#include "PacketKernels.h"
+
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PACKET_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+using namespace glm;
+
+const float detEpsilon = 1e-12f; //determinants smaller than this are parallel to the triangle
+
+// --------------------------------------------------------------------------
+// Ray packets
+
+void RayPacket::Set(int lane, vec3 origin, vec3 ray, float maxT)
+{
+	ox[lane] = origin.x; oy[lane] = origin.y; oz[lane] = origin.z;
+	dx[lane] = ray.x; dy[lane] = ray.y; dz[lane] = ray.z;
+	tMax[lane] = maxT;
+}
+
+// --------------------------------------------------------------------------
+// Scalar kernels
+
+float IntersectTriangleMT(vec3 A, vec3 B, vec3 C, vec3 origin, vec3 ray)
+{
+	vec3 e1 = B - A, e2 = C - A;
+	vec3 pvec = cross(ray, e2);
+	float det = dot(e1, pvec);
+	if (std::abs(det) < detEpsilon)
+		return -1;
+	float invDet = 1 / det;
+
+	vec3 tvec = origin - A;
+	float u = dot(tvec, pvec) * invDet;
+	if (u < 0 || u > 1)
+		return -1;
+
+	vec3 qvec = cross(tvec, e1);
+	float v = dot(ray, qvec) * invDet;
+	if (v < 0 || u + v > 1)
+		return -1;
+
+	return dot(e2, qvec) * invDet;
+}
+
+float IntersectTriangleCorners(vec3 A, vec3 B, vec3 C, vec3 origin, vec3 ray)
+{
+	vec3 N = B - A, M = C - A;
+	vec3 pvec = cross(ray, M);
+	float invDet = 1 / dot(N, pvec);
+	vec3 tvec = origin - A;
+	float u = dot(tvec, pvec) * invDet;
+	if (u < 0 || u > 1)
+		return -1;
+	vec3 qvec = cross(tvec, N);
+	float v = dot(ray, qvec) * invDet;
+	if (v < 0 || u + v > 1)
+		return -1;
+	vec3 n = normalize(cross(N, M));
+	return (dot(A, n) - dot(origin, n)) / dot(ray, n);
+}
+
+//written so that NaN lanes fail every comparison; a ray parallel to the
+//plane gets an infinite or NaN t, which leaves u or v failing too
+static inline bool TriangleLane(const TriangleLanes &l, size_t i, vec3 o, vec3 d, float tMin, float tMax, float &t)
+{
+	vec3 W = vec3(l.wx[i], l.wy[i], l.wz[i]);
+	t = -(dot(W, o) + l.ww[i]) / dot(W, d);
+	vec3 p = o + t * d;
+	float u = l.ux[i] * p.x + l.uy[i] * p.y + l.uz[i] * p.z + l.uw[i];
+	float v = l.vx[i] * p.x + l.vy[i] * p.y + l.vz[i] * p.z + l.vw[i];
+	return u >= 0 && v >= 0 && u + v <= 1 && t > tMin && t <= tMax;
+}
+
+static inline bool SphereLane(const SphereLanes &l, size_t i, vec3 o, vec3 d, float tMin, float tMax, float &t)
+{
+	vec3 oc = o - l.Center(i);
+	float b = dot(d, oc);
+	float disc = b * b - (dot(oc, oc) - l.r[i] * l.r[i]);
+	t = -b - sqrt(std::max(disc, 0.f));
+	return disc >= 0 && t > tMin && t <= tMax;
+}
+
+static uint32_t TrianglesScalar(const TriangleLanes &lanes, size_t first, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < packetWidth; i++)
+		if (TriangleLane(lanes, first + i, origin, ray, tMin, tMax, t[i]))
+			mask |= 1u << i;
+	return mask;
+}
+
+static uint32_t SpheresScalar(const SphereLanes &lanes, size_t first, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < packetWidth; i++)
+		if (SphereLane(lanes, first + i, origin, ray, tMin, tMax, t[i]))
+			mask |= 1u << i;
+	return mask;
+}
+
+static uint32_t PacketTriangleScalar(const RayPacket &p, const TriangleLanes &lanes, size_t index,
+	float tMin, float *t)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < packetWidth; i++)
+	{
+		vec3 o = vec3(p.ox[i], p.oy[i], p.oz[i]), d = vec3(p.dx[i], p.dy[i], p.dz[i]);
+		if (TriangleLane(lanes, index, o, d, tMin, p.tMax[i], t[i]))
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+static uint32_t PacketSphereScalar(const RayPacket &p, const SphereLanes &lanes, size_t index,
+	float tMin, float *t)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < packetWidth; i++)
+	{
+		vec3 o = vec3(p.ox[i], p.oy[i], p.oz[i]), d = vec3(p.dx[i], p.dy[i], p.dz[i]);
+		if (SphereLane(lanes, index, o, d, tMin, p.tMax[i], t[i]))
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+const IntersectKernels &ScalarKernels()
+{
+	static const IntersectKernels kernels = { "scalar",
+		TrianglesScalar, SpheresScalar, PacketTriangleScalar, PacketSphereScalar };
+	return kernels;
+}
+
+#ifdef PACKET_X86
+
+// --------------------------------------------------------------------------
+// SSE kernels, 4 lanes at a time
+
+//the precomputed-record test on 4 lanes; u*, v*, w* the rows, o*/d* the rays
+static inline int TriangleSse(__m128 ux, __m128 uy, __m128 uz, __m128 uw, __m128 vx, __m128 vy, __m128 vz,
+	__m128 vw, __m128 wx, __m128 wy, __m128 wz, __m128 ww, __m128 ox, __m128 oy, __m128 oz,
+	__m128 dx, __m128 dy, __m128 dz, __m128 tMin, __m128 tMax, float *t)
+{
+	__m128 wo = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, ox), _mm_mul_ps(wy, oy)), _mm_add_ps(_mm_mul_ps(wz, oz), ww));
+	__m128 wd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, dx), _mm_mul_ps(wy, dy)), _mm_mul_ps(wz, dz));
+	__m128 dist = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), wo), wd);
+	_mm_storeu_ps(t, dist);
+
+	__m128 px = _mm_add_ps(ox, _mm_mul_ps(dist, dx));
+	__m128 py = _mm_add_ps(oy, _mm_mul_ps(dist, dy));
+	__m128 pz = _mm_add_ps(oz, _mm_mul_ps(dist, dz));
+	__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, px), _mm_mul_ps(uy, py)), _mm_add_ps(_mm_mul_ps(uz, pz), uw));
+	__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, px), _mm_mul_ps(vy, py)), _mm_add_ps(_mm_mul_ps(vz, pz), vw));
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 hit = _mm_cmpge_ps(u, zero);
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(dist, tMin));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(dist, tMax));
+	return _mm_movemask_ps(hit);
+}
+
+static inline int SphereSse(__m128 cx, __m128 cy, __m128 cz, __m128 r,
+	__m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz, __m128 tMin, __m128 tMax, float *t)
+{
+	__m128 ocx = _mm_sub_ps(ox, cx), ocy = _mm_sub_ps(oy, cy), ocz = _mm_sub_ps(oz, cz);
+	__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+	__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+		_mm_mul_ps(r, r));
+	__m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), c);
+	__m128 dist = _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), b), _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps())));
+	_mm_storeu_ps(t, dist);
+
+	__m128 hit = _mm_cmpge_ps(disc, _mm_setzero_ps());
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(dist, tMin));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(dist, tMax));
+	return _mm_movemask_ps(hit);
+}
+
+static uint32_t TrianglesSse(const TriangleLanes &l, size_t first, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	uint32_t mask = 0;
+	for (int half = 0; half < packetWidth; half += 4)
+	{
+		size_t i = first + half;
+		mask |= TriangleSse(_mm_loadu_ps(&l.ux[i]), _mm_loadu_ps(&l.uy[i]), _mm_loadu_ps(&l.uz[i]),
+			_mm_loadu_ps(&l.uw[i]), _mm_loadu_ps(&l.vx[i]), _mm_loadu_ps(&l.vy[i]), _mm_loadu_ps(&l.vz[i]),
+			_mm_loadu_ps(&l.vw[i]), _mm_loadu_ps(&l.wx[i]), _mm_loadu_ps(&l.wy[i]), _mm_loadu_ps(&l.wz[i]),
+			_mm_loadu_ps(&l.ww[i]),
+			_mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z),
+			_mm_set1_ps(ray.x), _mm_set1_ps(ray.y), _mm_set1_ps(ray.z),
+			_mm_set1_ps(tMin), _mm_set1_ps(tMax), t + half) << half;
+	}
+	return mask;
+}
+
+static uint32_t SpheresSse(const SphereLanes &l, size_t first, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	uint32_t mask = 0;
+	for (int half = 0; half < packetWidth; half += 4)
+	{
+		size_t i = first + half;
+		mask |= SphereSse(_mm_loadu_ps(&l.x[i]), _mm_loadu_ps(&l.y[i]), _mm_loadu_ps(&l.z[i]),
+			_mm_loadu_ps(&l.r[i]),
+			_mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z),
+			_mm_set1_ps(ray.x), _mm_set1_ps(ray.y), _mm_set1_ps(ray.z),
+			_mm_set1_ps(tMin), _mm_set1_ps(tMax), t + half) << half;
+	}
+	return mask;
+}
+
+static uint32_t PacketTriangleSse(const RayPacket &p, const TriangleLanes &l, size_t index,
+	float tMin, float *t)
+{
+	uint32_t mask = 0;
+	for (int half = 0; half < packetWidth; half += 4)
+	{
+		mask |= TriangleSse(_mm_set1_ps(l.ux[index]), _mm_set1_ps(l.uy[index]), _mm_set1_ps(l.uz[index]),
+			_mm_set1_ps(l.uw[index]), _mm_set1_ps(l.vx[index]), _mm_set1_ps(l.vy[index]), _mm_set1_ps(l.vz[index]),
+			_mm_set1_ps(l.vw[index]), _mm_set1_ps(l.wx[index]), _mm_set1_ps(l.wy[index]), _mm_set1_ps(l.wz[index]),
+			_mm_set1_ps(l.ww[index]),
+			_mm_load_ps(p.ox + half), _mm_load_ps(p.oy + half), _mm_load_ps(p.oz + half),
+			_mm_load_ps(p.dx + half), _mm_load_ps(p.dy + half), _mm_load_ps(p.dz + half),
+			_mm_set1_ps(tMin), _mm_load_ps(p.tMax + half), t + half) << half;
+	}
+	return mask;
+}
+
+static uint32_t PacketSphereSse(const RayPacket &p, const SphereLanes &l, size_t index,
+	float tMin, float *t)
+{
+	uint32_t mask = 0;
+	for (int half = 0; half < packetWidth; half += 4)
+	{
+		mask |= SphereSse(_mm_set1_ps(l.x[index]), _mm_set1_ps(l.y[index]), _mm_set1_ps(l.z[index]),
+			_mm_set1_ps(l.r[index]),
+			_mm_load_ps(p.ox + half), _mm_load_ps(p.oy + half), _mm_load_ps(p.oz + half),
+			_mm_load_ps(p.dx + half), _mm_load_ps(p.dy + half), _mm_load_ps(p.dz + half),
+			_mm_set1_ps(tMin), _mm_load_ps(p.tMax + half), t + half) << half;
+	}
+	return mask;
+}
+
+// --------------------------------------------------------------------------
+// AVX2 kernels, 8 lanes at a time
+
+TARGET_AVX2 static inline int TriangleAvx(__m256 ux, __m256 uy, __m256 uz, __m256 uw, __m256 vx, __m256 vy,
+	__m256 vz, __m256 vw, __m256 wx, __m256 wy, __m256 wz, __m256 ww, __m256 ox, __m256 oy, __m256 oz,
+	__m256 dx, __m256 dy, __m256 dz, __m256 tMin, __m256 tMax, float *t)
+{
+	__m256 wo = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, ox), _mm256_mul_ps(wy, oy)),
+		_mm256_add_ps(_mm256_mul_ps(wz, oz), ww));
+	__m256 wd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, dx), _mm256_mul_ps(wy, dy)), _mm256_mul_ps(wz, dz));
+	__m256 dist = _mm256_div_ps(_mm256_sub_ps(_mm256_setzero_ps(), wo), wd);
+	_mm256_storeu_ps(t, dist);
+
+	__m256 px = _mm256_add_ps(ox, _mm256_mul_ps(dist, dx));
+	__m256 py = _mm256_add_ps(oy, _mm256_mul_ps(dist, dy));
+	__m256 pz = _mm256_add_ps(oz, _mm256_mul_ps(dist, dz));
+	__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ux, px), _mm256_mul_ps(uy, py)),
+		_mm256_add_ps(_mm256_mul_ps(uz, pz), uw));
+	__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, px), _mm256_mul_ps(vy, py)),
+		_mm256_add_ps(_mm256_mul_ps(vz, pz), vw));
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 hit = _mm256_cmp_ps(u, zero, _CMP_GE_OQ);
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tMin, _CMP_GT_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tMax, _CMP_LE_OQ));
+	return _mm256_movemask_ps(hit);
+}
+
+TARGET_AVX2 static inline int SphereAvx(__m256 cx, __m256 cy, __m256 cz, __m256 r,
+	__m256 ox, __m256 oy, __m256 oz, __m256 dx, __m256 dy, __m256 dz, __m256 tMin, __m256 tMax, float *t)
+{
+	__m256 ocx = _mm256_sub_ps(ox, cx), ocy = _mm256_sub_ps(oy, cy), ocz = _mm256_sub_ps(oz, cz);
+	__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+	__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+		_mm256_mul_ps(ocz, ocz)), _mm256_mul_ps(r, r));
+	__m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+	__m256 dist = _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b),
+		_mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps())));
+	_mm256_storeu_ps(t, dist);
+
+	__m256 hit = _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ);
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tMin, _CMP_GT_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tMax, _CMP_LE_OQ));
+	return _mm256_movemask_ps(hit);
+}
+
+TARGET_AVX2 static uint32_t TrianglesAvx(const TriangleLanes &l, size_t i, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	return TriangleAvx(_mm256_loadu_ps(&l.ux[i]), _mm256_loadu_ps(&l.uy[i]), _mm256_loadu_ps(&l.uz[i]),
+		_mm256_loadu_ps(&l.uw[i]), _mm256_loadu_ps(&l.vx[i]), _mm256_loadu_ps(&l.vy[i]), _mm256_loadu_ps(&l.vz[i]),
+		_mm256_loadu_ps(&l.vw[i]), _mm256_loadu_ps(&l.wx[i]), _mm256_loadu_ps(&l.wy[i]), _mm256_loadu_ps(&l.wz[i]),
+		_mm256_loadu_ps(&l.ww[i]),
+		_mm256_set1_ps(origin.x), _mm256_set1_ps(origin.y), _mm256_set1_ps(origin.z),
+		_mm256_set1_ps(ray.x), _mm256_set1_ps(ray.y), _mm256_set1_ps(ray.z),
+		_mm256_set1_ps(tMin), _mm256_set1_ps(tMax), t);
+}
+
+TARGET_AVX2 static uint32_t SpheresAvx(const SphereLanes &l, size_t i, vec3 origin, vec3 ray,
+	float tMin, float tMax, float *t)
+{
+	return SphereAvx(_mm256_loadu_ps(&l.x[i]), _mm256_loadu_ps(&l.y[i]), _mm256_loadu_ps(&l.z[i]),
+		_mm256_loadu_ps(&l.r[i]),
+		_mm256_set1_ps(origin.x), _mm256_set1_ps(origin.y), _mm256_set1_ps(origin.z),
+		_mm256_set1_ps(ray.x), _mm256_set1_ps(ray.y), _mm256_set1_ps(ray.z),
+		_mm256_set1_ps(tMin), _mm256_set1_ps(tMax), t);
+}
+
+TARGET_AVX2 static uint32_t PacketTriangleAvx(const RayPacket &p, const TriangleLanes &l, size_t index,
+	float tMin, float *t)
+{
+	return TriangleAvx(_mm256_set1_ps(l.ux[index]), _mm256_set1_ps(l.uy[index]), _mm256_set1_ps(l.uz[index]),
+		_mm256_set1_ps(l.uw[index]), _mm256_set1_ps(l.vx[index]), _mm256_set1_ps(l.vy[index]),
+		_mm256_set1_ps(l.vz[index]), _mm256_set1_ps(l.vw[index]), _mm256_set1_ps(l.wx[index]),
+		_mm256_set1_ps(l.wy[index]), _mm256_set1_ps(l.wz[index]), _mm256_set1_ps(l.ww[index]),
+		_mm256_load_ps(p.ox), _mm256_load_ps(p.oy), _mm256_load_ps(p.oz),
+		_mm256_load_ps(p.dx), _mm256_load_ps(p.dy), _mm256_load_ps(p.dz),
+		_mm256_set1_ps(tMin), _mm256_load_ps(p.tMax), t);
+}
+
+TARGET_AVX2 static uint32_t PacketSphereAvx(const RayPacket &p, const SphereLanes &l, size_t index,
+	float tMin, float *t)
+{
+	return SphereAvx(_mm256_set1_ps(l.x[index]), _mm256_set1_ps(l.y[index]), _mm256_set1_ps(l.z[index]),
+		_mm256_set1_ps(l.r[index]),
+		_mm256_load_ps(p.ox), _mm256_load_ps(p.oy), _mm256_load_ps(p.oz),
+		_mm256_load_ps(p.dx), _mm256_load_ps(p.dy), _mm256_load_ps(p.dz),
+		_mm256_set1_ps(tMin), _mm256_load_ps(p.tMax), t);
+}
+
+// --------------------------------------------------------------------------
+// Runtime selection
+
+static bool CpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool osSaves = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+	if (!osSaves || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+const IntersectKernels *SseKernels()
+{
+	static const IntersectKernels kernels = { "SSE",
+		TrianglesSse, SpheresSse, PacketTriangleSse, PacketSphereSse };
+	return &kernels;
+}
+
+const IntersectKernels *Avx2Kernels()
+{
+	static const IntersectKernels kernels = { "AVX2",
+		TrianglesAvx, SpheresAvx, PacketTriangleAvx, PacketSphereAvx };
+	static const bool supported = CpuHasAvx2();
+	return supported ? &kernels : nullptr;
+}
+
+#else
+
+const IntersectKernels *SseKernels() { return nullptr; }
+const IntersectKernels *Avx2Kernels() { return nullptr; }
+
+#endif
+
+const IntersectKernels &Kernels()
+{
+	static const IntersectKernels &best =
+		Avx2Kernels() ? *Avx2Kernels() : SseKernels() ? *SseKernels() : ScalarKernels();
+	return best;
+}
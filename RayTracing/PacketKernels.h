@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+using namespace glm;
+using namespace std;
+
+//widest group of primitives or rays handled by one kernel call
+const int packetWidth = 8;
+static_assert(packetWidth <= lanePadding, "kernels read whole packets past the last lane");
+
+//up to packetWidth coherent rays; directions must be unit length
+struct RayPacket {
+	alignas(32) float ox[packetWidth], oy[packetWidth], oz[packetWidth];
+	alignas(32) float dx[packetWidth], dy[packetWidth], dz[packetWidth];
+	alignas(32) float tMax[packetWidth];
+
+	void Set(int lane, vec3 origin, vec3 ray, float maxT);
+};
+
+//a set of intersection kernels for one instruction set. Each returns a bit
+//mask of the lanes hit with tMin < t <= tMax and writes the distance of every
+//lane to t[]; triangle distances come from the precomputed records as in
+//IntersectTriangle, sphere distances the nearer root as intersectSphere()
+//in ray.frag
+struct IntersectKernels {
+	const char *name;
+
+	//one ray against the packetWidth triangles or spheres starting at first
+	uint32_t (*triangles)(const TriangleLanes &lanes, size_t first, vec3 origin, vec3 ray,
+		float tMin, float tMax, float *t);
+	uint32_t (*spheres)(const SphereLanes &lanes, size_t first, vec3 origin, vec3 ray,
+		float tMin, float tMax, float *t);
+
+	//every ray of a packet against the single triangle or sphere at index,
+	//with each lane's upper bound taken from packet.tMax
+	uint32_t (*packetTriangle)(const RayPacket &packet, const TriangleLanes &lanes, size_t index,
+		float tMin, float *t);
+	uint32_t (*packetSphere)(const RayPacket &packet, const SphereLanes &lanes, size_t index,
+		float tMin, float *t);
+};
+
+//kernels for each instruction set; the SSE and AVX2 ones are null when the
+//build target cannot run them
+const IntersectKernels &ScalarKernels();
+const IntersectKernels *SseKernels();
+const IntersectKernels *Avx2Kernels();
+
+//the widest kernels the running CPU supports, chosen on first use
+const IntersectKernels &Kernels();
+
+//number of lanes set in a kernel's result mask
+inline int LaneCount(uint32_t mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+//scalar Moller-Trumbore test of one ray and one triangle, -1 on a miss;
+//works from the corners alone, kept to compare the records against
+float IntersectTriangleMT(vec3 A, vec3 B, vec3 C, vec3 origin, vec3 ray);
+//the same from the corners as ray.frag did before triangles carried records:
+//Moller-Trumbore's inside test, then the distance again from the normalized plane
+float IntersectTriangleCorners(vec3 A, vec3 B, vec3 C, vec3 origin, vec3 ray);
@@ -0,0 +1,233 @@
+#include "ProgressiveRender.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+const int bandRows = tileSize; //a multiple of every preview block size
+
+// --------------------------------------------------------------------------
+// Sampling
+
+static float Luminance(vec3 color)
+{
+	return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+vec3 ProgressiveRender::Sample(const Scene &scene, const BVH &bvh, int x, int y, vec2 offset, TraceStats &stats,
+	OccluderCache &occluders, PrimaryHit *hit) const
+{
+	vec2 pixel = vec2((x + offset.x) / m_width, (y + offset.y) / m_height) * 2.f - 1.f;
+	vec3 origin, ray;
+	PrimaryRay(m_camera, pixel, origin, ray, (float)m_width / m_height);
+	return Trace(scene, bvh, trace, origin, ray, stats, &occluders, hit);
+}
+
+void ProgressiveRender::Accumulate(int i, vec3 color)
+{
+	float l = Luminance(color);
+	m_sum[i] += color;
+	m_luminance[i] += l;
+	m_luminanceSquared[i] += l * l;
+	m_count[i]++;
+}
+
+double ProgressiveRender::MeanSamples() const
+{
+	if (m_count.empty())
+		return 0;
+	double total = 0;
+	for (uint16_t count : m_count)
+		total += count;
+	return total / m_count.size();
+}
+
+// --------------------------------------------------------------------------
+// Passes
+
+void ProgressiveRender::Restart(const Camera &camera, int width, int height)
+{
+	m_camera = camera;
+	m_width = width;
+	m_height = height;
+	size_t pixels = (size_t)width * height;
+	m_sum.assign(pixels, vec3(0));
+	m_luminance.assign(pixels, 0);
+	m_luminanceSquared.assign(pixels, 0);
+	m_count.assign(pixels, 0);
+	m_block = coarsestBlock;
+	m_completedBlock = 0;
+	m_nextBand = 0;
+	m_passes = 0;
+	m_converged = false;
+	m_bandActive.assign((height + bandRows - 1) / bandRows, 1);
+	m_passActive = false;
+	m_stats = TraceStats();
+	m_reprojected = false;
+	m_retraced = 0;
+}
+
+//trace the pixels on this pass's lattice that no earlier pass traced, at
+//their centres, and fill the block each one stands for
+void ProgressiveRender::PreviewBand(const Scene &scene, const BVH &bvh, ImageBuffer *image, int y0, int y1, int threads)
+{
+	int block = m_block;
+	int tilesX = (m_width + tileSize - 1) / tileSize;
+	ParallelTiles(tilesX, threads, [&](int tile, TraceStats &local) {
+		int x0 = tile * tileSize;
+		int x1 = std::min(x0 + tileSize, m_width);
+		OccluderCache occluders;
+		for (int y = y0; y < y1; y += block)
+			for (int x = x0; x < x1; x += block)
+			{
+				if (m_count[y * m_width + x] > 0)
+					continue;
+				vec3 color = Sample(scene, bvh, x, y, vec2(0.5f), local, occluders, &m_reprojection.Hit(x, y));
+				Accumulate(y * m_width + x, color);
+				for (int by = y; by < std::min(y + block, y1); by++)
+				{
+					vec3 *row = image->Row(by);
+					for (int bx = x; bx < std::min(x + block, x1); bx++)
+						row[bx] = color;
+				}
+			}
+	}, &m_stats);
+}
+
+//one more jittered sample for every pixel of the band still short of
+//minSamples or with too uncertain a mean; false if none needed one
+bool ProgressiveRender::AdaptiveBand(const Scene &scene, const BVH &bvh, ImageBuffer *image, int y0, int y1, int threads)
+{
+	atomic<int> sampled(0);
+	int tilesX = (m_width + tileSize - 1) / tileSize;
+	ParallelTiles(tilesX, threads, [&](int tile, TraceStats &local) {
+		int x0 = tile * tileSize;
+		int x1 = std::min(x0 + tileSize, m_width);
+		OccluderCache occluders;
+		int count = 0;
+		for (int y = y0; y < y1; y++)
+		{
+			vec3 *row = image->Row(y);
+			for (int x = x0; x < x1; x++)
+			{
+				int i = y * m_width + x;
+				int n = m_count[i];
+				if (n >= maxSamples)
+					continue;
+				if (n >= std::max(minSamples, 2))
+				{
+					float mean = m_luminance[i] / n;
+					float variance = std::max(0.f, (m_luminanceSquared[i] - mean * m_luminance[i]) / (n - 1));
+					if (sqrt(variance / n) <= threshold)
+						continue;
+				}
+				Accumulate(i, Sample(scene, bvh, x, y, PixelJitter(x, y, n), local, occluders));
+				row[x] = m_sum[i] / float(m_count[i]);
+				count++;
+			}
+		}
+		sampled += count;
+	}, &m_stats);
+	return sampled > 0;
+}
+
+//warp the last frame into the new view and trace the pixels it could not
+//supply, then continue with the per-pixel pass, which traces the warped ones
+//properly; false, leaving the frame to the previews, if too much is missing
+bool ProgressiveRender::ReprojectFrame(const Scene &scene, const BVH &bvh, ImageBuffer *image, int threads)
+{
+	m_retraced = m_reprojection.Reproject(scene, m_camera, image, m_retrace, threads);
+	if (m_retraced > maxRetrace * m_width * m_height)
+		return false;
+
+	int tilesX = (m_width + tileSize - 1) / tileSize;
+	int tilesY = (m_height + tileSize - 1) / tileSize;
+	ParallelTiles(tilesX * tilesY, threads, [&](int tile, TraceStats &local) {
+		int x0 = (tile % tilesX) * tileSize;
+		int y0 = (tile / tilesX) * tileSize;
+		OccluderCache occluders;
+		for (int y = y0; y < std::min(y0 + tileSize, m_height); y++)
+		{
+			vec3 *row = image->Row(y);
+			for (int x = x0; x < std::min(x0 + tileSize, m_width); x++)
+			{
+				int i = y * m_width + x;
+				if (!m_retrace[i])
+					continue;
+				row[x] = Sample(scene, bvh, x, y, vec2(0.5f), local, occluders, &m_reprojection.Hit(x, y));
+				Accumulate(i, row[x]);
+			}
+		}
+	}, &m_stats);
+	image->MarkModified(0, m_height);
+
+	m_block = 1;
+	m_reprojected = true;
+	return true;
+}
+
+double ProgressiveRender::Step(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	double budgetSeconds, int threads)
+{
+	auto start = chrono::high_resolution_clock::now();
+	double seconds = 0;
+	if (m_width != image->Width() || m_height != image->Height() || !(m_camera == camera))
+	{
+		//only a camera move keeps the last frame worth warping
+		bool moved = m_width == image->Width() && m_height == image->Height()
+			&& m_reprojection.Width() == m_width && m_reprojection.Height() == m_height;
+		Restart(camera, image->Width(), image->Height());
+		if (!(reproject && moved && ReprojectFrame(scene, bvh, image, threads)))
+			m_reprojection.Reset(m_width, m_height);
+		else
+		{
+			seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+			if (seconds >= budgetSeconds)
+				return seconds;
+		}
+	}
+
+	int bands = (int)m_bandActive.size();
+	while (!m_converged && m_width > 0 && m_height > 0)
+	{
+		int y0 = m_nextBand * bandRows;
+		int y1 = std::min(y0 + bandRows, m_height);
+		if (m_block > 0)
+		{
+			PreviewBand(scene, bvh, image, y0, y1, threads);
+			image->MarkModified(y0, y1);
+		}
+		else if (m_bandActive[m_nextBand])
+		{
+			//a pixel that passed the test keeps passing, since only sampling
+			//changes its sums, so a band with nothing to do stays that way
+			m_bandActive[m_nextBand] = AdaptiveBand(scene, bvh, image, y0, y1, threads);
+			m_passActive |= m_bandActive[m_nextBand] != 0;
+			image->MarkModified(y0, y1);
+		}
+
+		if (++m_nextBand == bands)
+		{
+			m_nextBand = 0;
+			if (m_block > 0)
+			{
+				m_completedBlock = m_block;
+				m_block /= 2;
+			}
+			else
+			{
+				m_passes++;
+				m_converged = !m_passActive;
+				m_passActive = false;
+			}
+		}
+
+		seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+		if (seconds >= budgetSeconds)
+			break;
+	}
+	return seconds;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "Reprojection.h"
+#include "imagebuffer.h"
+
+using namespace glm;
+using namespace std;
+
+//progressive CPU rendering into an ImageBuffer, a few rows at a time so each
+//Step only uploads what changed. The image first appears at one sample per
+//8x8 block and is refined to one per pixel (identical to RenderCpu), after
+//which jittered samples go only to pixels whose mean is still uncertain.
+//When the camera moves, the last frame is instead warped into the new view
+//and only what it cannot supply is traced before the per-pixel pass
+class ProgressiveRender
+{
+public:
+	static const int coarsestBlock = 8; //block size of the first preview
+	int minSamples = 2;                 //samples every pixel gets before its variance is trusted, at least 2
+	int maxSamples = 64;
+	float threshold = 0.5f / 255;       //standard error of the mean luminance at which a pixel is done
+	bool reproject = true;              //start from the warped last frame after a camera move
+	float maxRetrace = 0.5f;            //fraction of pixels to trace beyond which a preview is quicker
+	TraceSettings trace;                //Reset after changing it
+
+	//start over on the next Step, e.g. when the scene changed
+	void Reset()
+	{
+		m_width = 0;
+		m_reprojection.Reset(0, 0);
+	}
+
+	//render for about budgetSeconds (always at least one band of rows) and
+	//mark the rows written; starts over when the camera or image size changed.
+	//Returns the seconds spent
+	double Step(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+		double budgetSeconds, int threads = 0);
+
+	//block size of the last complete preview pass, 0 before the first; 1 means
+	//every pixel has been traced once
+	int PreviewBlock() const { return m_completedBlock; }
+	//adaptive passes completed after the preview
+	int Passes() const { return m_passes; }
+	bool Converged() const { return m_converged; }
+	//samples per pixel so far, averaged over the image
+	double MeanSamples() const;
+	//rays cast since the last restart
+	const TraceStats &Stats() const { return m_stats; }
+	//whether the current view started from the warped last frame, and how
+	//many pixels had to be traced for it
+	bool Reprojected() const { return m_reprojected; }
+	size_t Retraced() const { return m_retraced; }
+
+private:
+	void Restart(const Camera &camera, int width, int height);
+	void PreviewBand(const Scene &scene, const BVH &bvh, ImageBuffer *image, int y0, int y1, int threads);
+	bool AdaptiveBand(const Scene &scene, const BVH &bvh, ImageBuffer *image, int y0, int y1, int threads);
+	bool ReprojectFrame(const Scene &scene, const BVH &bvh, ImageBuffer *image, int threads);
+	vec3 Sample(const Scene &scene, const BVH &bvh, int x, int y, vec2 offset, TraceStats &stats,
+		OccluderCache &occluders, PrimaryHit *hit = nullptr) const;
+	void Accumulate(int i, vec3 color);
+
+	Camera m_camera;
+	int m_width = 0, m_height = 0;
+
+	//running sums per pixel
+	vector<vec3> m_sum;
+	vector<float> m_luminance, m_luminanceSquared;
+	vector<uint16_t> m_count;
+
+	//progress: block size being rendered (0 once in the adaptive passes) and
+	//the next band of rows
+	int m_block = 0;
+	int m_completedBlock = 0;
+	int m_nextBand = 0;
+	int m_passes = 0;
+	bool m_converged = false;
+	vector<char> m_bandActive; //bands where a pixel took a sample in the last adaptive pass
+	bool m_passActive = false;
+
+	TraceStats m_stats;
+
+	ReprojectionCache m_reprojection;
+	vector<char> m_retrace;
+	bool m_reprojected = false;
+	size_t m_retraced = 0;
+};
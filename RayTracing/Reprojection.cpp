@@ -0,0 +1,83 @@
+#include "Reprojection.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace glm;
+
+const int shadeRows = 16; //rows per task when shading the warped frame
+
+void ReprojectionCache::Reset(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_hits.assign((size_t)width * height, PrimaryHit());
+}
+
+size_t ReprojectionCache::Reproject(const Scene &scene, const Camera &camera, ImageBuffer *image,
+	vector<char> &retrace, int threads)
+{
+	size_t pixels = (size_t)m_width * m_height;
+	m_warped.assign(pixels, PrimaryHit());
+	m_depth.assign(pixels, numeric_limits<float>::infinity());
+	retrace.assign(pixels, 1);
+
+	//the inverse of PrimaryRay: a hit's direction from the camera, turned back
+	//into camera space and scaled onto the image plane
+	vec3 origin = vec3(camera.oTransform * vec4(camera.origin, 1.0));
+	mat3 toCamera = transpose(mat3(camera.transform));
+	float z = 1 / (2 * tan(radians(camera.fov) / 2.0f));
+	float aspect = (float)m_width / m_height;
+	for (const PrimaryHit &hit : m_hits)
+	{
+		if (!hit.valid)
+			continue;
+		vec3 d = toCamera * (hit.position - origin);
+		if (d.z >= 0)
+			continue;
+		float s = -z / d.z;
+		float fx = (d.x * s / aspect + 1) * 0.5f * m_width;
+		float fy = (d.y * s + 1) * 0.5f * m_height;
+		if (!(fx >= 0 && fy >= 0 && fx < m_width && fy < m_height))
+			continue;
+		size_t i = (size_t)fy * m_width + (size_t)fx;
+		float depth = length(d);
+		if (depth < m_depth[i])
+		{
+			m_depth[i] = depth;
+			m_warped[i] = hit;
+		}
+	}
+
+	ParallelTiles((m_height + shadeRows - 1) / shadeRows, threads, [&](int band, TraceStats &) {
+		for (int y = band * shadeRows; y < std::min((band + 1) * shadeRows, m_height); y++)
+		{
+			vec3 *row = image->Row(y);
+			for (int x = 0; x < m_width; x++)
+			{
+				size_t i = (size_t)y * m_width + x;
+				const PrimaryHit &hit = m_warped[i];
+				if (!hit.valid || scene.materials[hit.material].reflectance > 0)
+					continue;
+				float nearest = m_depth[i];
+				if (x > 0)
+					nearest = std::min(nearest, m_depth[i - 1]);
+				if (x + 1 < m_width)
+					nearest = std::min(nearest, m_depth[i + 1]);
+				if (y > 0)
+					nearest = std::min(nearest, m_depth[i - m_width]);
+				if (y + 1 < m_height)
+					nearest = std::min(nearest, m_depth[i + m_width]);
+				if (m_depth[i] > nearest * (1 + edgeTolerance))
+					continue;
+				retrace[i] = 0;
+				row[x] = ShadePrimary(scene, hit, normalize(hit.position - origin));
+			}
+		}
+	});
+	image->MarkModified(0, m_height);
+
+	swap(m_hits, m_warped);
+	return (size_t)count(retrace.begin(), retrace.end(), 1);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "Scene.h"
+#include "CpuTracer.h"
+#include "imagebuffer.h"
+
+using namespace glm;
+using namespace std;
+
+//the primary hit behind every pixel of the last frame, so that after a camera
+//move most of the frame can be warped into the new view and shaded again
+//rather than traced. Only surfaces that do not reflect are reused: shadows
+//and the Phong terms can be recomputed from the hit, reflections cannot
+class ReprojectionCache
+{
+public:
+	//depth step to a neighbour, as a fraction of the pixel's own depth, beyond
+	//which a warped pixel is taken to sit on an edge and traced again
+	float edgeTolerance = 0.05f;
+
+	//forget every hit, and size the cache for the image
+	void Reset(int width, int height);
+	int Width() const { return m_width; }
+	int Height() const { return m_height; }
+
+	//hit of a pixel, to be filled by Trace when the pixel's centre is traced
+	PrimaryHit &Hit(int x, int y) { return m_hits[(size_t)y * m_width + x]; }
+
+	//move every cached hit to the pixel it falls on from camera, keeping the
+	//nearest, and shade it into image; the cache then holds the moved hits.
+	//retrace is set for the pixels that still need tracing: those no hit
+	//landed on, those on depth edges, where a hit may show through a gap in a
+	//nearer surface, and reflective ones. Returns how many those are
+	size_t Reproject(const Scene &scene, const Camera &camera, ImageBuffer *image, vector<char> &retrace,
+		int threads = 0);
+
+private:
+	int m_width = 0, m_height = 0;
+	vector<PrimaryHit> m_hits, m_warped;
+	vector<float> m_depth;
+};
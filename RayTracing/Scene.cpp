@@ -0,0 +1,241 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Structure-of-arrays storage
+
+bool Material::operator==(const Material &other) const
+{
+	return diffuseColor == other.diffuseColor && specularColor == other.specularColor
+		&& phongExp == other.phongExp && reflectance == other.reflectance;
+}
+
+static void ResizeLane(vector<float> &lane, size_t count)
+{
+	lane.resize(count + lanePadding, numeric_limits<float>::quiet_NaN());
+	fill(lane.end() - lanePadding, lane.end(), numeric_limits<float>::quiet_NaN());
+}
+
+//store value in the first padding lane and pad again behind it
+static inline void AppendLane(vector<float> &lane, float value)
+{
+	if (lane.empty())
+		lane.assign(lanePadding, numeric_limits<float>::quiet_NaN());
+	lane[lane.size() - lanePadding] = value;
+	lane.push_back(numeric_limits<float>::quiet_NaN());
+}
+
+void TriangleLanes::Resize(size_t count)
+{
+	for (vector<float> *lane : { &ax, &ay, &az, &bx, &by, &bz, &cx, &cy, &cz,
+		&ux, &uy, &uz, &uw, &vx, &vy, &vz, &vw, &wx, &wy, &wz, &ww })
+		ResizeLane(*lane, count);
+}
+
+//rows of the inverse of the matrix with columns B - A, C - A, n and A. With
+//n = cross(B - A, C - A) at right angles to both edges, the inverse rows of
+//the 3x3 part are the cyclic cross products over the determinant |n|^2
+static void BarycentricRows(vec3 A, vec3 B, vec3 C, vec4 &u, vec4 &v, vec4 &w)
+{
+	vec3 e1 = B - A, e2 = C - A;
+	vec3 n = cross(e1, e2);
+	float invDet = 1 / dot(n, n);
+	vec3 ru = cross(e2, n) * invDet, rv = cross(n, e1) * invDet, rw = n * invDet;
+	u = vec4(ru, -dot(ru, A));
+	v = vec4(rv, -dot(rv, A));
+	w = vec4(rw, -dot(rw, A));
+}
+
+void TriangleLanes::Set(size_t i, vec3 A, vec3 B, vec3 C)
+{
+	vec4 u, v, w;
+	BarycentricRows(A, B, C, u, v, w);
+	ax[i] = A.x; ay[i] = A.y; az[i] = A.z;
+	bx[i] = B.x; by[i] = B.y; bz[i] = B.z;
+	cx[i] = C.x; cy[i] = C.y; cz[i] = C.z;
+	ux[i] = u.x; uy[i] = u.y; uz[i] = u.z; uw[i] = u.w;
+	vx[i] = v.x; vy[i] = v.y; vz[i] = v.z; vw[i] = v.w;
+	wx[i] = w.x; wy[i] = w.y; wz[i] = w.z; ww[i] = w.w;
+}
+
+void TriangleLanes::Append(vec3 A, vec3 B, vec3 C)
+{
+	vec4 u, v, w;
+	BarycentricRows(A, B, C, u, v, w);
+	AppendLane(ax, A.x); AppendLane(ay, A.y); AppendLane(az, A.z);
+	AppendLane(bx, B.x); AppendLane(by, B.y); AppendLane(bz, B.z);
+	AppendLane(cx, C.x); AppendLane(cy, C.y); AppendLane(cz, C.z);
+	AppendLane(ux, u.x); AppendLane(uy, u.y); AppendLane(uz, u.z); AppendLane(uw, u.w);
+	AppendLane(vx, v.x); AppendLane(vy, v.y); AppendLane(vz, v.z); AppendLane(vw, v.w);
+	AppendLane(wx, w.x); AppendLane(wy, w.y); AppendLane(wz, w.z); AppendLane(ww, w.w);
+}
+
+void SphereLanes::Resize(size_t count)
+{
+	for (vector<float> *lane : { &x, &y, &z, &r })
+		ResizeLane(*lane, count);
+}
+
+void SphereLanes::Set(size_t i, vec3 center, float radius)
+{
+	x[i] = center.x; y[i] = center.y; z[i] = center.z;
+	r[i] = radius;
+}
+
+void SphereLanes::Append(vec3 center, float radius)
+{
+	AppendLane(x, center.x); AppendLane(y, center.y); AppendLane(z, center.z);
+	AppendLane(r, radius);
+}
+
+uint32_t Scene::AddMaterial(const Material &material)
+{
+	auto existing = find(materials.begin(), materials.end(), material);
+	if (existing != materials.end())
+		return (uint32_t)(existing - materials.begin());
+	materials.push_back(material);
+	return (uint32_t)materials.size() - 1;
+}
+
+void Scene::AddTriangle(vec3 A, vec3 B, vec3 C, uint32_t material)
+{
+	triangles.Append(A, B, C);
+	triangleMaterials.push_back(material);
+}
+
+void Scene::AddSphere(vec3 center, float radius, uint32_t material)
+{
+	spheres.Append(center, radius);
+	sphereMaterials.push_back(material);
+}
+
+void Scene::AddPlane(vec3 normal, vec3 point, uint32_t material)
+{
+	planeNormals.push_back(normalize(normal));
+	planePoints.push_back(point);
+	planeMaterials.push_back(material);
+}
+
+uint32_t Scene::AddMesh()
+{
+	Mesh mesh;
+	mesh.first = (uint32_t)meshTriangles.Size();
+	meshes.push_back(mesh);
+	return (uint32_t)meshes.size() - 1;
+}
+
+void Scene::AddMeshTriangle(vec3 A, vec3 B, vec3 C)
+{
+	meshTriangles.Append(A, B, C);
+	meshes.back().count++;
+}
+
+void Scene::AddInstance(uint32_t mesh, const mat4 &placement, uint32_t material)
+{
+	instances.push_back({ mat4x3(inverse(placement)), mesh, material });
+}
+
+size_t Scene::InstancedTriangleCount() const
+{
+	size_t count = 0;
+	for (const Instance &instance : instances)
+		count += meshes[instance.mesh].count;
+	return count;
+}
+
+void Scene::FlattenInstances()
+{
+	for (const Instance &instance : instances)
+	{
+		mat4 placement = inverse(mat4(instance.toMesh));
+		const Mesh &mesh = meshes[instance.mesh];
+		for (uint32_t i = mesh.first; i < mesh.first + mesh.count; i++)
+			AddTriangle(vec3(placement * vec4(meshTriangles.A(i), 1)), vec3(placement * vec4(meshTriangles.B(i), 1)),
+				vec3(placement * vec4(meshTriangles.C(i), 1)), instance.material);
+	}
+	meshTriangles = TriangleLanes();
+	meshes.clear();
+	instances.clear();
+}
+
+// --------------------------------------------------------------------------
+// Conversion to the std140 structs
+
+Sphere Scene::Std140Sphere(size_t i) const
+{
+	const Material &m = materials[sphereMaterials[i]];
+	return { vec4(spheres.Center(i), 1), vec4(m.diffuseColor, 1), vec4(m.specularColor, 1),
+		m.phongExp, spheres.r[i], m.reflectance };
+}
+
+Triangle Scene::Std140Triangle(size_t i) const
+{
+	const Material &m = materials[triangleMaterials[i]];
+	return { { triangles.U(i), triangles.V(i), triangles.W(i) },
+		vec4(m.diffuseColor, 1), vec4(m.specularColor, 1), m.phongExp, m.reflectance };
+}
+
+Plane Scene::Std140Plane(size_t i) const
+{
+	const Material &m = materials[planeMaterials[i]];
+	return { vec4(planeNormals[i], 0), vec4(planePoints[i], 1), vec4(m.diffuseColor, 1),
+		vec4(m.specularColor, 1), m.phongExp, m.reflectance };
+}
+
+InstanceRecord Scene::Std140Instance(size_t i, uint32_t meshRoot) const
+{
+	const Material &m = materials[instances[i].material];
+	mat3x4 rows = transpose(instances[i].toMesh);
+	return { { rows[0], rows[1], rows[2] }, vec4(m.diffuseColor, 1), vec4(m.specularColor, 1),
+		m.phongExp, m.reflectance, meshRoot };
+}
+
+vector<Sphere> Scene::Std140Spheres() const
+{
+	vector<Sphere> result(SphereCount());
+	for (size_t i = 0; i < result.size(); i++)
+		result[i] = Std140Sphere(i);
+	return result;
+}
+
+vector<Triangle> Scene::Std140Triangles() const
+{
+	vector<Triangle> result(TriangleCount());
+	for (size_t i = 0; i < result.size(); i++)
+		result[i] = Std140Triangle(i);
+	return result;
+}
+
+vector<Plane> Scene::Std140Planes() const
+{
+	vector<Plane> result(PlaneCount());
+	for (size_t i = 0; i < result.size(); i++)
+		result[i] = Std140Plane(i);
+	return result;
+}
+
+vector<InstanceRecord> Scene::Std140Instances(const vector<uint32_t> &meshRoots) const
+{
+	vector<InstanceRecord> result(InstanceCount());
+	for (size_t i = 0; i < result.size(); i++)
+		result[i] = Std140Instance(i, meshRoots[instances[i].mesh]);
+	return result;
+}
+
+vector<vec4> Scene::Std140MeshTriangles() const
+{
+	vector<vec4> result;
+	result.reserve(3 * meshTriangles.Size());
+	for (size_t i = 0; i < meshTriangles.Size(); i++)
+	{
+		result.push_back(meshTriangles.U(i));
+		result.push_back(meshTriangles.V(i));
+		result.push_back(meshTriangles.W(i));
+	}
+	return result;
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+using namespace glm;
+using namespace std;
+
+//primitives are laid out to match the std430 storage blocks declared in
+//ray.frag; they are only used to upload scenes, see Scene for the CPU side
+struct Sphere {
+	vec4 center;
+	vec4 diffuseColor;
+	vec4 specularColor;
+	float phongExp;
+	float radius;
+	float reflectance;
+	float pad2 = 0; //align to 4-float;
+};
+
+struct Plane {
+	vec4 norm;
+	vec4 point;
+	vec4 diffuseColor;
+	vec4 specularColor;
+	float phongExp;
+	float reflectance;
+	float pad2 = 0;//align to 4-float;
+	float pad3 = 0;
+
+};
+
+//toBarycentric holds the rows of TriangleLanes::U, V and W
+struct Triangle {
+	vec4 toBarycentric[3];
+	vec4 diffuseColor;
+	vec4 specularColor;
+	float phongExp;
+	float reflectance;
+	float pad2 = 0;//align to 4-float;
+	float pad3 = 0;
+};
+
+struct Light {
+	vec4 center;
+	vec4 color;
+	float radius; //radius = 0 -> point light source
+	float intensity;
+	float padd01 = 0;
+	float padd02 = 0;
+};
+
+//one placement of a mesh as ray.frag reads it: the rows of the world to mesh
+//transform, the instance's material and the root of the mesh's hierarchy
+struct InstanceRecord {
+	vec4 toMesh[3];
+	vec4 diffuseColor;
+	vec4 specularColor;
+	float phongExp;
+	float reflectance;
+	uint32_t root;
+	float pad = 0;
+};
+
+//shading parameters shared by every primitive that refers to them
+struct Material {
+	vec3 diffuseColor;
+	float phongExp;
+	vec3 specularColor;
+	float reflectance;
+
+	bool operator==(const Material &other) const;
+};
+
+//readable floats past the end of every lane array, so kernels may always
+//load a full packet; padding lanes are NaN and never report a hit
+const int lanePadding = 8;
+
+//triangle corners in structure-of-arrays form, with each triangle's
+//intersection record computed from them by Set and Append: the rows of the
+//transform taking world space to the triangle's barycentric space, where
+//A, B and C are the origin and the u and v axes and w is the distance off the
+//plane in units of the normal. A ray meets the plane where w = 0, and the
+//triangle if u, v >= 0 and u + v <= 1 there. Degenerate triangles get NaN rows
+//and are never hit
+struct TriangleLanes {
+	vector<float> ax, ay, az;
+	vector<float> bx, by, bz;
+	vector<float> cx, cy, cz;
+	vector<float> ux, uy, uz, uw;
+	vector<float> vx, vy, vz, vw;
+	vector<float> wx, wy, wz, ww;
+
+	size_t Size() const { return ax.empty() ? 0 : ax.size() - lanePadding; }
+	void Resize(size_t count);
+	void Set(size_t i, vec3 A, vec3 B, vec3 C);
+	void Append(vec3 A, vec3 B, vec3 C);
+	vec3 A(size_t i) const { return vec3(ax[i], ay[i], az[i]); }
+	vec3 B(size_t i) const { return vec3(bx[i], by[i], bz[i]); }
+	vec3 C(size_t i) const { return vec3(cx[i], cy[i], cz[i]); }
+	vec4 U(size_t i) const { return vec4(ux[i], uy[i], uz[i], uw[i]); }
+	vec4 V(size_t i) const { return vec4(vx[i], vy[i], vz[i], vw[i]); }
+	vec4 W(size_t i) const { return vec4(wx[i], wy[i], wz[i], ww[i]); }
+	//the normal, cross(B - A, C - A) scaled by the inverse of its squared length
+	vec3 Normal(size_t i) const { return vec3(wx[i], wy[i], wz[i]); }
+	static const size_t bytesPerTriangle = 21 * sizeof(float);
+	size_t Bytes() const { return bytesPerTriangle * Size(); }
+};
+
+//sphere centres and radii in structure-of-arrays form, same padding rules
+struct SphereLanes {
+	vector<float> x, y, z, r;
+
+	size_t Size() const { return x.empty() ? 0 : x.size() - lanePadding; }
+	void Resize(size_t count);
+	void Set(size_t i, vec3 center, float radius);
+	void Append(vec3 center, float radius);
+	vec3 Center(size_t i) const { return vec3(x[i], y[i], z[i]); }
+	size_t Bytes() const { return 4 * sizeof(float) * Size(); }
+};
+
+//a triangle mesh in its own space, stored once however often it is placed:
+//triangles [first, first + count) of Scene::meshTriangles
+struct Mesh {
+	uint32_t first = 0;
+	uint32_t count = 0;
+};
+
+//one placement of a mesh. Only the inverse of the placement is kept, since
+//rays are moved into mesh space and normals out of it with that alone
+struct Instance {
+	mat4x3 toMesh; //world to mesh space, an affine 4x3 transform
+	uint32_t mesh;
+	uint32_t material;
+};
+
+//everything needed to trace a frame: geometry in structure-of-arrays form
+//with materials behind an index, converted to the std140 structs for upload
+struct Scene {
+	TriangleLanes triangles;
+	vector<uint32_t> triangleMaterials;
+	SphereLanes spheres;
+	vector<uint32_t> sphereMaterials;
+	vector<vec3> planeNormals; //unit length
+	vector<vec3> planePoints;
+	vector<uint32_t> planeMaterials;
+	vector<Light> lights;
+	vector<Material> materials;
+	TriangleLanes meshTriangles; //the triangles of every mesh, one range each
+	vector<Mesh> meshes;
+	vector<Instance> instances;
+
+	//returns the index of an identical material, adding it if there is none
+	uint32_t AddMaterial(const Material &material);
+	void AddTriangle(vec3 A, vec3 B, vec3 C, uint32_t material);
+	void AddSphere(vec3 center, float radius, uint32_t material);
+	void AddPlane(vec3 normal, vec3 point, uint32_t material);
+	//start a new mesh, which AddMeshTriangle then adds to; returns its index
+	uint32_t AddMesh();
+	void AddMeshTriangle(vec3 A, vec3 B, vec3 C);
+	//place a mesh, with placement taking mesh space to world space; it must
+	//be invertible
+	void AddInstance(uint32_t mesh, const mat4 &placement, uint32_t material);
+
+	size_t TriangleCount() const { return triangles.Size(); }
+	size_t SphereCount() const { return spheres.Size(); }
+	size_t PlaneCount() const { return planeNormals.size(); }
+	size_t InstanceCount() const { return instances.size(); }
+	//triangles the instances place in the world, all stored as meshes
+	size_t InstancedTriangleCount() const;
+	//replace every instance by world space triangles, leaving no meshes
+	void FlattenInstances();
+
+	//std140 form of each primitive list, for uploading to ray.frag
+	vector<Sphere> Std140Spheres() const;
+	vector<Triangle> Std140Triangles() const;
+	vector<Plane> Std140Planes() const;
+	//the same for a single primitive
+	Sphere Std140Sphere(size_t i) const;
+	Triangle Std140Triangle(size_t i) const;
+	Plane Std140Plane(size_t i) const;
+	InstanceRecord Std140Instance(size_t i, uint32_t meshRoot) const;
+	//instances, given the root node of each mesh's hierarchy, and the
+	//intersection record of every mesh triangle, the U, V and W rows in turn
+	vector<InstanceRecord> Std140Instances(const vector<uint32_t> &meshRoots) const;
+	vector<vec4> Std140MeshTriangles() const;
+
+	//memory held by the triangle geometry and its material indices
+	size_t TriangleBytes() const { return triangles.Bytes() + triangleMaterials.size() * sizeof(uint32_t); }
+	//memory held by the meshes and the instances placing them
+	size_t InstanceBytes() const
+	{
+		return meshTriangles.Bytes() + meshes.size() * sizeof(Mesh) + instances.size() * sizeof(Instance);
+	}
+};
@@ -0,0 +1,171 @@
+#include "SceneBuffers.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Storage
+
+void SceneBuffers::Write(SceneBuffer buffer, const void *data, size_t bytes, size_t recordSize)
+{
+	//zero-sized ranges cannot be bound, so an empty array still gets one record
+	vector<char> empty;
+	if (bytes == 0)
+	{
+		empty.assign(recordSize, 0);
+		data = empty.data();
+		bytes = recordSize;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffers[buffer]);
+	if (bytes > m_capacity[buffer])
+	{
+		m_capacity[buffer] = std::max(bytes, 2 * m_capacity[buffer]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity[buffer], nullptr, GL_DYNAMIC_DRAW);
+		m_allocations++;
+	}
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	//bind only the part in use, so the block's array length matches the scene
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, buffer + 1, m_buffers[buffer], 0, bytes);
+}
+
+void SceneBuffers::WriteRange(SceneBuffer buffer, size_t offset, const void *data, size_t bytes)
+{
+	if (!m_buffers[buffer] || offset + bytes > m_capacity[buffer])
+	{
+		cout << "ERROR: update past the end of scene buffer " << buffer << endl;
+		return;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffers[buffer]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, bytes, data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool SceneBuffers::Upload(const Scene &scene, const BVH &bvh)
+{
+	if (!m_buffers[0])
+	{
+		glGenBuffers(SceneBufferCount, m_buffers);
+		glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &m_maxBlock);
+	}
+
+	vector<Sphere> spheres = scene.Std140Spheres();
+	vector<Triangle> triangles = scene.Std140Triangles();
+	vector<Plane> planes = scene.Std140Planes();
+	vector<int32_t> skip = BVHSkipLinks(bvh);
+	vector<InstanceRecord> instances = scene.Std140Instances(bvh.meshRoots);
+	vector<vec4> meshTriangles = scene.Std140MeshTriangles();
+	const vector<Light> &lights = scene.lights;
+
+	//check every block before touching any, so a failed upload leaves the
+	//previous scene intact
+	size_t bytes[SceneBufferCount] = {
+		sizeof(Sphere) * spheres.size(), sizeof(Triangle) * triangles.size(), sizeof(Plane) * planes.size(),
+		sizeof(Light) * lights.size(), sizeof(BVHNode) * bvh.nodes.size(), sizeof(int32_t) * skip.size(),
+		sizeof(InstanceRecord) * instances.size(), sizeof(vec4) * meshTriangles.size(),
+		sizeof(LightNode) * bvh.lightNodes.size() };
+	for (int i = 0; i < SceneBufferCount; i++)
+		if ((GLint64)bytes[i] > m_maxBlock)
+		{
+			cout << "ERROR: scene needs a " << bytes[i] << " byte storage block, this OpenGL allows "
+				<< m_maxBlock << endl;
+			return false;
+		}
+
+	Write(SphereBuffer, spheres.data(), bytes[SphereBuffer], sizeof(Sphere));
+	Write(TriangleBuffer, triangles.data(), bytes[TriangleBuffer], sizeof(Triangle));
+	Write(PlaneBuffer, planes.data(), bytes[PlaneBuffer], sizeof(Plane));
+	Write(LightBuffer, lights.data(), bytes[LightBuffer], sizeof(Light));
+	Write(NodeBuffer, bvh.nodes.data(), bytes[NodeBuffer], sizeof(BVHNode));
+	Write(SkipBuffer, skip.data(), bytes[SkipBuffer], sizeof(int32_t));
+	m_meshRoots = bvh.meshRoots;
+	Write(InstanceBuffer, instances.data(), bytes[InstanceBuffer], sizeof(InstanceRecord));
+	Write(MeshTriangleBuffer, meshTriangles.data(), bytes[MeshTriangleBuffer], 3 * sizeof(vec4));
+	Write(LightNodeBuffer, bvh.lightNodes.data(), bytes[LightNodeBuffer], sizeof(LightNode));
+	return !CheckGLErrors();
+}
+
+void SceneBuffers::Destroy()
+{
+	if (m_buffers[0])
+		glDeleteBuffers(SceneBufferCount, m_buffers);
+	for (int i = 0; i < SceneBufferCount; i++)
+	{
+		m_buffers[i] = 0;
+		m_capacity[i] = 0;
+	}
+}
+
+size_t SceneBuffers::AllocatedBytes() const
+{
+	size_t total = 0;
+	for (size_t capacity : m_capacity)
+		total += capacity;
+	return total;
+}
+
+// --------------------------------------------------------------------------
+// Partial updates
+
+void SceneBuffers::UpdateSphere(const Scene &scene, size_t i)
+{
+	Sphere record = scene.Std140Sphere(i);
+	WriteRange(SphereBuffer, i * sizeof(record), &record, sizeof(record));
+}
+
+void SceneBuffers::UpdateTriangle(const Scene &scene, size_t i)
+{
+	Triangle record = scene.Std140Triangle(i);
+	WriteRange(TriangleBuffer, i * sizeof(record), &record, sizeof(record));
+}
+
+void SceneBuffers::UpdatePlane(const Scene &scene, size_t i)
+{
+	Plane record = scene.Std140Plane(i);
+	WriteRange(PlaneBuffer, i * sizeof(record), &record, sizeof(record));
+}
+
+void SceneBuffers::UpdateLight(const Scene &scene, size_t i)
+{
+	WriteRange(LightBuffer, i * sizeof(Light), &scene.lights[i], sizeof(Light));
+}
+
+void SceneBuffers::UpdateInstance(const Scene &scene, size_t i)
+{
+	InstanceRecord record = scene.Std140Instance(i, m_meshRoots[scene.instances[i].mesh]);
+	WriteRange(InstanceBuffer, i * sizeof(record), &record, sizeof(record));
+}
+
+void SceneBuffers::UpdateMaterial(const Scene &scene, uint32_t material)
+{
+	//materials are copied into each primitive's record, so every record using
+	//this one is rewritten; the BVH keeps primitives of one object together,
+	//so these mostly come in a few long runs
+	auto updateRuns = [&](SceneBuffer buffer, const vector<uint32_t> &indices, auto record) {
+		typedef decltype(record(0)) Record;
+		vector<Record> run;
+		for (size_t i = 0; i <= indices.size(); i++)
+		{
+			if (i < indices.size() && indices[i] == material)
+				run.push_back(record(i));
+			else if (!run.empty())
+			{
+				WriteRange(buffer, (i - run.size()) * sizeof(Record), run.data(), run.size() * sizeof(Record));
+				run.clear();
+			}
+		}
+	};
+	updateRuns(SphereBuffer, scene.sphereMaterials, [&](size_t i) { return scene.Std140Sphere(i); });
+	updateRuns(TriangleBuffer, scene.triangleMaterials, [&](size_t i) { return scene.Std140Triangle(i); });
+	updateRuns(PlaneBuffer, scene.planeMaterials, [&](size_t i) { return scene.Std140Plane(i); });
+	vector<uint32_t> instanceMaterials;
+	for (const Instance &instance : scene.instances)
+		instanceMaterials.push_back(instance.material);
+	updateRuns(InstanceBuffer, instanceMaterials, [&](size_t i) {
+		return scene.Std140Instance(i, m_meshRoots[scene.instances[i].mesh]);
+	});
+}
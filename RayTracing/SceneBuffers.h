@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "OGLSupport.h"
+#include "Scene.h"
+#include "BVH.h"
+
+using namespace glm;
+using namespace std;
+
+//the storage blocks of ray.frag, bound at index + 1
+enum SceneBuffer {
+	SphereBuffer, TriangleBuffer, PlaneBuffer, LightBuffer, NodeBuffer, SkipBuffer, InstanceBuffer, MeshTriangleBuffer,
+	LightNodeBuffer, SceneBufferCount
+};
+
+//shader storage buffers holding the scene ray.frag traces, kept for the life
+//of one OpenGL context. A new scene is written into the existing buffers and
+//one is only reallocated when it must grow, then to at least twice its size,
+//so switching between scenes settles on a fixed set of allocations
+class SceneBuffers
+{
+public:
+	//write a whole scene and bind every buffer; false if a block exceeds what
+	//the OpenGL implementation allows
+	bool Upload(const Scene &scene, const BVH &bvh);
+
+	//rewrite one record in place after it changed in the scene, e.g. a moved
+	//sphere; the BVH is left as it was, so a primitive leaving its node's
+	//bounds, or a light changing its power, needs a full Upload
+	void UpdateSphere(const Scene &scene, size_t i);
+	void UpdateTriangle(const Scene &scene, size_t i);
+	void UpdatePlane(const Scene &scene, size_t i);
+	void UpdateLight(const Scene &scene, size_t i);
+	void UpdateInstance(const Scene &scene, size_t i);
+	//rewrite every primitive using a material after it was edited, one update
+	//per run of consecutive primitives
+	void UpdateMaterial(const Scene &scene, uint32_t material);
+
+	//delete the buffers; must be called while their context is current
+	void Destroy();
+
+	//bytes allocated across all buffers, and how many allocations it took
+	size_t AllocatedBytes() const;
+	int Allocations() const { return m_allocations; }
+
+private:
+	void Write(SceneBuffer buffer, const void *data, size_t bytes, size_t recordSize);
+	void WriteRange(SceneBuffer buffer, size_t offset, const void *data, size_t bytes);
+
+	GLuint m_buffers[SceneBufferCount] = {};
+	size_t m_capacity[SceneBufferCount] = {};
+	GLint64 m_maxBlock = 0;
+	vector<uint32_t> m_meshRoots; //of the uploaded BVH, which instance records refer to
+	int m_allocations = 0;
+};
@@ -0,0 +1,339 @@
+#include "SceneCache.h"
+#include "SceneFile.h"
+#include "MappedFile.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+using namespace std;
+
+const char cacheMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+const uint32_t cacheVersion = 4;        //bump whenever the section list or any stored type changes
+const uint32_t cacheByteOrder = 0x01020304;
+const size_t cacheAlignment = 64;       //every section starts on a cache line
+const int maxCacheSections = 64;
+
+// --------------------------------------------------------------------------
+// Layout
+
+//a cache file is this header followed by the sections it lists, each one
+//the raw contents of one array of the scene or the BVH
+struct CacheSection {
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	//sizes the arrays were written with, so a layout change is never misread
+	uint32_t lanePadding;
+	uint32_t materialSize;
+	uint32_t lightSize;
+	uint32_t nodeSize;
+	uint32_t meshSize;
+	uint32_t instanceSize;
+	//the source file the cache was compiled from
+	uint64_t sourceSize;
+	int64_t sourceModified;
+	uint32_t sectionCount;
+	uint32_t pad;
+	CacheSection sections[maxCacheSections];
+};
+
+//calls visit on every array of the scene and BVH, in file order
+template <typename SceneT, typename BVHT, typename Visit>
+static void ForEachSection(SceneT &scene, BVHT &bvh, Visit visit)
+{
+	auto &t = scene.triangles;
+	auto &s = scene.spheres;
+	auto &m = scene.meshTriangles;
+	visit(t.ax); visit(t.ay); visit(t.az);
+	visit(t.bx); visit(t.by); visit(t.bz);
+	visit(t.cx); visit(t.cy); visit(t.cz);
+	visit(t.ux); visit(t.uy); visit(t.uz); visit(t.uw);
+	visit(t.vx); visit(t.vy); visit(t.vz); visit(t.vw);
+	visit(t.wx); visit(t.wy); visit(t.wz); visit(t.ww);
+	visit(scene.triangleMaterials);
+	visit(s.x); visit(s.y); visit(s.z); visit(s.r);
+	visit(scene.sphereMaterials);
+	visit(scene.planeNormals);
+	visit(scene.planePoints);
+	visit(scene.planeMaterials);
+	visit(scene.lights);
+	visit(scene.materials);
+	visit(m.ax); visit(m.ay); visit(m.az);
+	visit(m.bx); visit(m.by); visit(m.bz);
+	visit(m.cx); visit(m.cy); visit(m.cz);
+	visit(m.ux); visit(m.uy); visit(m.uz); visit(m.uw);
+	visit(m.vx); visit(m.vy); visit(m.vz); visit(m.vw);
+	visit(m.wx); visit(m.wy); visit(m.wz); visit(m.ww);
+	visit(scene.meshes);
+	visit(scene.instances);
+	visit(bvh.nodes);
+	visit(bvh.meshRoots);
+	visit(bvh.lightNodes);
+}
+
+static CacheHeader MakeHeader(unsigned long long sourceSize, long long sourceModified)
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = cacheVersion;
+	header.byteOrder = cacheByteOrder;
+	header.lanePadding = lanePadding;
+	header.materialSize = sizeof(Material);
+	header.lightSize = sizeof(Light);
+	header.nodeSize = sizeof(BVHNode);
+	header.meshSize = sizeof(Mesh);
+	header.instanceSize = sizeof(Instance);
+	header.sourceSize = sourceSize;
+	header.sourceModified = sourceModified;
+	return header;
+}
+
+static size_t AlignUp(size_t offset)
+{
+	return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+}
+
+//the arrays must agree with each other before the kernels are let loose on
+//them, since those read whole packets without bounds checks
+static bool Consistent(const TriangleLanes &t)
+{
+	for (const vector<float> *lane : { &t.ay, &t.az, &t.bx, &t.by, &t.bz, &t.cx, &t.cy, &t.cz,
+		&t.ux, &t.uy, &t.uz, &t.uw, &t.vx, &t.vy, &t.vz, &t.vw, &t.wx, &t.wy, &t.wz, &t.ww })
+		if (lane->size() != t.ax.size())
+			return false;
+	return t.ax.empty() || t.ax.size() >= (size_t)lanePadding;
+}
+
+static bool Consistent(const Scene &scene, const BVH &bvh)
+{
+	if (!Consistent(scene.triangles) || !Consistent(scene.meshTriangles))
+		return false;
+	const SphereLanes &s = scene.spheres;
+	for (const vector<float> *lane : { &s.y, &s.z, &s.r })
+		if (lane->size() != s.x.size())
+			return false;
+	if (!s.x.empty() && s.x.size() < (size_t)lanePadding)
+		return false;
+	if (scene.triangleMaterials.size() != scene.TriangleCount() || scene.sphereMaterials.size() != scene.SphereCount()
+		|| scene.planePoints.size() != scene.PlaneCount() || scene.planeMaterials.size() != scene.PlaneCount())
+		return false;
+	for (const vector<uint32_t> *indices : { &scene.triangleMaterials, &scene.sphereMaterials, &scene.planeMaterials })
+		for (uint32_t material : *indices)
+			if (material >= scene.materials.size())
+				return false;
+	for (const Mesh &mesh : scene.meshes)
+		if (mesh.count == 0 || (size_t)mesh.first + mesh.count > scene.meshTriangles.Size())
+			return false;
+	for (const Instance &instance : scene.instances)
+		if (instance.mesh >= scene.meshes.size() || instance.material >= scene.materials.size())
+			return false;
+	if (!scene.instances.empty() && bvh.meshRoots.size() != scene.meshes.size())
+		return false;
+	for (uint32_t root : bvh.meshRoots)
+		if (root >= bvh.nodes.size())
+			return false;
+
+	//leaves of the meshes' hierarchies come after the scene's and hold mesh
+	//triangles; neither kind of leaf may point past its array
+	size_t sceneNodes = bvh.meshRoots.empty() ? bvh.nodes.size() : bvh.meshRoots[0];
+	for (size_t i = 0; i < bvh.nodes.size(); i++)
+	{
+		const BVHNode &node = bvh.nodes[i];
+		size_t size;
+		if (!node.IsLeaf())
+		{
+			if (node.leftFirst <= i || (size_t)node.leftFirst + 1 >= bvh.nodes.size())
+				return false;
+			continue;
+		}
+		if (i >= sceneNodes)
+			size = node.IsSphereLeaf() || node.IsInstanceLeaf() ? 0 : scene.meshTriangles.Size();
+		else if (node.IsSphereLeaf())
+			size = scene.SphereCount();
+		else if (node.IsInstanceLeaf())
+			size = scene.InstanceCount();
+		else
+			size = scene.TriangleCount();
+		if ((size_t)node.leftFirst + node.Count() > size)
+			return false;
+	}
+
+	//children come after their parents, so the walks end; a hierarchy too deep
+	//for the traversal stacks is built again
+	if (BVHDepth(bvh) > maxBVHDepth)
+		return false;
+	for (uint32_t root : bvh.meshRoots)
+		if (BVHDepth(bvh, root) > maxBVHDepth)
+			return false;
+
+	//the light hierarchy has a leaf per light
+	if (bvh.lightNodes.size() != (scene.lights.empty() ? 0 : 2 * scene.lights.size() - 1))
+		return false;
+	for (const LightNode &node : bvh.lightNodes)
+		if (node.IsLeaf() ? node.Light() >= scene.lights.size() : (size_t)node.child + 1 >= bvh.lightNodes.size())
+			return false;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Reading and writing
+
+//copy the arrays out of a compiled scene held in memory, if its header
+//matches expected up to the section list
+static bool ReadSections(const char *data, size_t size, const CacheHeader &expected, Scene &scene, BVH &bvh)
+{
+	if (size < sizeof(CacheHeader))
+		return false;
+	CacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(&header, &expected, offsetof(CacheHeader, sectionCount)) != 0)
+		return false;
+
+	//each section is one bulk copy straight out of the block
+	Scene loaded;
+	BVH loadedBVH;
+	uint32_t section = 0;
+	bool ok = true;
+	ForEachSection(loaded, loadedBVH, [&](auto &array) {
+		typedef typename remove_reference<decltype(array)>::type::value_type Element;
+		if (!ok || section >= header.sectionCount || section >= (uint32_t)maxCacheSections)
+		{
+			ok = false;
+			return;
+		}
+		const CacheSection &s = header.sections[section++];
+		if (s.offset > size || s.bytes > size - s.offset || s.bytes % sizeof(Element) != 0)
+		{
+			ok = false;
+			return;
+		}
+		const Element *first = (const Element *)(data + s.offset);
+		array.assign(first, first + s.bytes / sizeof(Element));
+	});
+	if (!ok || section != header.sectionCount || !Consistent(loaded, loadedBVH))
+		return false;
+
+	scene = move(loaded);
+	bvh = move(loadedBVH);
+	return true;
+}
+
+//pass the header, padding and arrays of a compiled scene to write in order
+template <typename Write>
+static void WriteSections(CacheHeader header, const Scene &scene, const BVH &bvh, Write write)
+{
+	size_t offset = AlignUp(sizeof(header));
+	ForEachSection(scene, bvh, [&](const auto &array) {
+		CacheSection &s = header.sections[header.sectionCount++];
+		s.offset = offset;
+		s.bytes = array.size() * sizeof(array[0]);
+		offset = AlignUp(offset + (size_t)s.bytes);
+	});
+
+	write((const char *)&header, sizeof(header));
+	size_t written = sizeof(header);
+	const char zeros[cacheAlignment] = {};
+	ForEachSection(scene, bvh, [&](const auto &array) {
+		size_t start = AlignUp(written);
+		write(zeros, start - written);
+		write((const char *)array.data(), array.size() * sizeof(array[0]));
+		written = start + array.size() * sizeof(array[0]);
+	});
+}
+
+bool ReadSceneCache(const string &cachePath, const string &sourcePath, Scene &scene, BVH &bvh)
+{
+	unsigned long long sourceSize;
+	long long sourceModified;
+	if (!FileStamp(sourcePath, sourceSize, sourceModified))
+		return false;
+
+	MappedFile file;
+	if (!file.Open(cachePath))
+		return false;
+	return ReadSections(file.Data(), file.Size(), MakeHeader(sourceSize, sourceModified), scene, bvh);
+}
+
+bool WriteSceneCache(const string &cachePath, const string &sourcePath, const Scene &scene, const BVH &bvh)
+{
+	unsigned long long sourceSize;
+	long long sourceModified;
+	if (!FileStamp(sourcePath, sourceSize, sourceModified))
+		return false;
+
+	//write beside the cache and rename, so a reader never sees half a file
+	string temporary = cachePath + ".tmp";
+	{
+		ofstream out(temporary, ios::binary | ios::trunc);
+		if (!out)
+			return false;
+		WriteSections(MakeHeader(sourceSize, sourceModified), scene, bvh, [&](const char *data, size_t bytes) {
+			out.write(data, bytes);
+		});
+		if (!out)
+		{
+			out.close();
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+	remove(cachePath.c_str());
+	if (rename(temporary.c_str(), cachePath.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+string PackScene(const Scene &scene, const BVH &bvh)
+{
+	string packed;
+	WriteSections(MakeHeader(0, 0), scene, bvh, [&](const char *data, size_t bytes) { packed.append(data, bytes); });
+	return packed;
+}
+
+bool UnpackScene(const char *data, size_t size, Scene &scene, BVH &bvh)
+{
+	return ReadSections(data, size, MakeHeader(0, 0), scene, bvh);
+}
+
+bool LoadCachedScene(const string &path, Scene &scene, BVH &bvh, SceneLoadInfo *info)
+{
+	auto start = chrono::high_resolution_clock::now();
+	SceneLoadInfo result;
+	string cachePath = path + sceneCacheSuffix;
+
+	result.fromCache = ReadSceneCache(cachePath, path, scene, bvh);
+	if (result.fromCache)
+	{
+		unsigned long long size;
+		long long modified;
+		FileStamp(path, size, modified);
+		result.sourceBytes = (size_t)size;
+	}
+	else
+	{
+		if (!LoadSceneFile(path, scene, &result.sourceBytes))
+			return false;
+		result.buildSeconds = BuildBVH(bvh, scene);
+		if (!WriteSceneCache(cachePath, path, scene, bvh))
+			cout << "WARNING: could not write scene cache " << cachePath << endl;
+	}
+
+	result.seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	if (info)
+		*info = result;
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+
+#include "Scene.h"
+#include "BVH.h"
+
+using namespace std;
+
+//how a scene was obtained by LoadCachedScene
+struct SceneLoadInfo {
+	bool fromCache = false;
+	size_t sourceBytes = 0;
+	double seconds = 0;      //whole load, including parsing, building and writing the cache
+	double buildSeconds = 0; //BVH construction, 0 when the cache was used
+};
+
+//compiled form of a scene file, stored beside it with this suffix
+const char sceneCacheSuffix[] = ".cache";
+
+//load a scene file together with its BVH. A compiled copy is kept beside the
+//file: when its recorded size and modification time still match the source it
+//is mapped and copied out array by array, otherwise the text is parsed, the
+//BVH built and the cache rewritten. False if the scene cannot be loaded
+bool LoadCachedScene(const string &path, Scene &scene, BVH &bvh, SceneLoadInfo *info = nullptr);
+
+//read a compiled scene if it is current for the source file; false otherwise
+bool ReadSceneCache(const string &cachePath, const string &sourcePath, Scene &scene, BVH &bvh);
+
+//write scene and bvh as the compiled copy of the source file
+bool WriteSceneCache(const string &cachePath, const string &sourcePath, const Scene &scene, const BVH &bvh);
+
+//the compiled form of a scene as one block, laid out as a cache file but tied
+//to no source file, for handing a scene to another process
+string PackScene(const Scene &scene, const BVH &bvh);
+
+//read back a block PackScene made; false if it is damaged or was packed by a
+//build with other layouts
+bool UnpackScene(const char *data, size_t size, Scene &scene, BVH &bvh);
@@ -0,0 +1,453 @@
+#include "SceneFile.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+using namespace glm;
+
+//shading used by objects that come before any material block
+const Material defaultMaterial = { vec3(1, 1, 1), 10, vec3(1, 1, 1), 0 };
+
+// --------------------------------------------------------------------------
+// Tokens
+
+//a run of characters inside the mapped text; never copied
+struct Token {
+	const char *begin = nullptr;
+	size_t length = 0;
+
+	bool Is(const char *word) const { return length == strlen(word) && !memcmp(begin, word, length); }
+	bool Empty() const { return length == 0; }
+};
+
+//every control character counts as whitespace
+static inline bool IsSpace(char c)
+{
+	return (unsigned char)c <= ' ';
+}
+
+//characters that end a word without being part of it
+static inline bool IsDelimiter(char c)
+{
+	return IsSpace(c) || c == '{' || c == '}' || c == '#';
+}
+
+//exactly representable powers of ten, for the fast path of ParseFloat
+static const double powersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+const int maxExactPower = 22;
+const int maxMantissaDigits = 19; //fits in a uint64_t
+
+//decimal number with optional sign, fraction and exponent, as written by
+//printf, read from p up to the first character that cannot continue it.
+//Mantissas below 2^53 with small exponents are exact in a double, so the
+//only rounding is to float
+static bool ParseFloat(const char *&p, const char *end, float &value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	uint64_t mantissa = 0;
+	int exponent = 0, significant = 0, digits = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	{
+		if (significant < maxMantissaDigits)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += (mantissa != 0);
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+		{
+			if (significant < maxMantissaDigits)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += (mantissa != 0);
+				exponent--;
+			}
+		}
+	}
+	if (digits == 0)
+		return false;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negativeExponent = (*p++ == '-');
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		int written = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			written = std::min(written * 10 + (*p - '0'), 100000);
+		exponent += negativeExponent ? -written : written;
+	}
+
+	double result = (double)mantissa;
+	if (mantissa < (1ull << 53) && std::abs(exponent) <= maxExactPower)
+		result = (exponent < 0) ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+	else if (mantissa != 0)
+		result *= pow(10.0, (double)exponent);
+	value = (float)(negative ? -result : result);
+	return true;
+}
+
+//a whole token holding one number
+static bool ParseFloat(Token token, float &value)
+{
+	const char *p = token.begin, *end = token.begin + token.length;
+	return ParseFloat(p, end, value) && p == end;
+}
+
+// --------------------------------------------------------------------------
+// Parsing
+
+class SceneParser
+{
+public:
+	SceneParser(const char *text, size_t length, const string &name, Scene &scene)
+		: begin(text), p(text), end(text + length), name(name), scene(scene) {}
+
+	bool Parse()
+	{
+		for (Token word = Next(); !word.Empty(); word = Next())
+		{
+			bool ok;
+			if (word.Is("triangle"))
+				ok = Triangle();
+			else if (word.Is("sphere"))
+				ok = Sphere();
+			else if (word.Is("plane"))
+				ok = Plane();
+			else if (word.Is("light"))
+				ok = Light();
+			else if (word.Is("material"))
+				ok = MaterialBlock();
+			else if (word.Is("mesh"))
+				ok = MeshBlock();
+			else if (word.Is("instance"))
+				ok = InstanceBlock();
+			else
+				ok = Fail(word, "unknown object");
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+
+private:
+	const char *begin, *p, *end;
+	const string &name;
+	Scene &scene;
+	uint32_t material = 0;
+	bool hasMaterial = false;
+	vector<pair<string, uint32_t>> namedMaterials;
+	vector<pair<string, uint32_t>> namedMeshes;
+
+	//skips whitespace and # comments
+	void SkipSpace()
+	{
+		for (;;)
+		{
+			while (p < end && IsSpace(*p))
+				p++;
+			if (p == end || *p != '#')
+				return;
+			const char *newline = (const char *)memchr(p, '\n', end - p);
+			p = newline ? newline : end;
+		}
+	}
+
+	//the next word or brace; empty at the end of the text
+	Token Next()
+	{
+		SkipSpace();
+		Token token;
+		token.begin = p;
+		if (p < end && (*p == '{' || *p == '}'))
+			p++;
+		else
+			while (p < end && !IsDelimiter(*p))
+				p++;
+		token.length = p - token.begin;
+		return token;
+	}
+
+	Token Here() const
+	{
+		Token token;
+		token.begin = p;
+		return token;
+	}
+
+	bool Fail(Token at, const char *message)
+	{
+		int line = 1 + (int)count(begin, at.begin, '\n');
+		cout << "ERROR: " << name << ":" << line << ": " << message;
+		if (!at.Empty())
+			cout << " '" << string(at.begin, std::min(at.length, (size_t)32)) << "'";
+		cout << endl;
+		return false;
+	}
+
+	bool Expect(char brace)
+	{
+		Token token = Next();
+		if (token.length == 1 && token.begin[0] == brace)
+			return true;
+		return Fail(token, (brace == '{') ? "expected '{'" : "expected '}'");
+	}
+
+	//numbers are parsed straight out of the text rather than tokenized first
+	bool Floats(float *values, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			SkipSpace();
+			const char *start = p;
+			if (!ParseFloat(p, end, values[i]) || (p < end && !IsDelimiter(*p)))
+			{
+				p = start;
+				return Fail(Next(), "expected a number");
+			}
+		}
+		return true;
+	}
+
+	//count numbers between braces
+	bool Block(float *values, int count)
+	{
+		return Expect('{') && Floats(values, count) && Expect('}');
+	}
+
+	uint32_t CurrentMaterial()
+	{
+		if (!hasMaterial)
+		{
+			material = scene.AddMaterial(defaultMaterial);
+			hasMaterial = true;
+		}
+		return material;
+	}
+
+	bool Triangle()
+	{
+		float v[9];
+		if (!Block(v, 9))
+			return false;
+		scene.AddTriangle(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), vec3(v[6], v[7], v[8]),
+			CurrentMaterial());
+		return true;
+	}
+
+	bool Sphere()
+	{
+		float v[4];
+		if (!Block(v, 4))
+			return false;
+		scene.AddSphere(vec3(v[0], v[1], v[2]), v[3], CurrentMaterial());
+		return true;
+	}
+
+	bool Plane()
+	{
+		float v[6];
+		if (!Block(v, 6))
+			return false;
+		scene.AddPlane(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), CurrentMaterial());
+		return true;
+	}
+
+	//light { x y z [r g b [intensity [radius]]] }
+	bool Light()
+	{
+		float v[8] = { 0, 0, 0, 1, 1, 1, 1, 0 };
+		if (!Expect('{'))
+			return false;
+		int count = 0;
+		for (Token token = Next(); !token.Is("}"); token = Next())
+		{
+			if (count == 8 || !ParseFloat(token, v[count]))
+				return Fail(token, (count == 8) ? "expected '}'" : "expected a number");
+			count++;
+		}
+		if (count != 3 && count < 6)
+			return Fail(Here(), "a light takes a position, then optionally a colour, intensity and radius");
+		scene.lights.push_back({ vec4(v[0], v[1], v[2], 1), vec4(v[3], v[4], v[5], 1), v[7], v[6] });
+		return true;
+	}
+
+	//mesh name { triangle { ... } ... } defines a mesh in its own space, drawn
+	//only where instances place it
+	bool MeshBlock()
+	{
+		Token meshName = Next();
+		if (meshName.Empty() || meshName.Is("{") || meshName.Is("}"))
+			return Fail(meshName, "expected a mesh name");
+		if (!Expect('{'))
+			return false;
+		uint32_t mesh = scene.AddMesh();
+		for (Token token = Next(); !token.Is("}"); token = Next())
+		{
+			float v[9];
+			if (!token.Is("triangle"))
+				return Fail(token, token.Empty() ? "expected '}'" : "a mesh holds only triangles");
+			if (!Block(v, 9))
+				return false;
+			scene.AddMeshTriangle(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), vec3(v[6], v[7], v[8]));
+		}
+		if (scene.meshes[mesh].count == 0)
+			return Fail(meshName, "mesh has no triangles");
+		namedMeshes.push_back({ string(meshName.begin, meshName.length), mesh });
+		return true;
+	}
+
+	//instance name { translate x y z  rotate degrees x y z  scale s | sx sy sz }
+	//places a mesh with the current material; the steps apply in the order
+	//written, each to the result of the ones before
+	bool InstanceBlock()
+	{
+		Token meshName = Next();
+		const pair<string, uint32_t> *mesh = nullptr;
+		for (auto named = namedMeshes.rbegin(); named != namedMeshes.rend() && !mesh; ++named)
+			if (meshName.Is(named->first.c_str()))
+				mesh = &*named;
+		if (!mesh)
+			return Fail(meshName, "unknown mesh");
+		if (!Expect('{'))
+			return false;
+
+		mat4 placement(1.0f);
+		for (Token token = Next(); !token.Is("}"); token = Next())
+		{
+			float v[4];
+			if (token.Is("translate"))
+			{
+				if (!Floats(v, 3))
+					return false;
+				placement = translate(mat4(1.0f), vec3(v[0], v[1], v[2])) * placement;
+			}
+			else if (token.Is("rotate"))
+			{
+				if (!Floats(v, 4))
+					return false;
+				if (vec3(v[1], v[2], v[3]) == vec3(0))
+					return Fail(token, "rotation axis is zero");
+				placement = rotate(mat4(1.0f), radians(v[0]), vec3(v[1], v[2], v[3])) * placement;
+			}
+			else if (token.Is("scale"))
+			{
+				//one factor, or three when more numbers follow
+				if (!Floats(v, 1))
+					return false;
+				const char *afterFirst = p;
+				SkipSpace();
+				vec3 factor(v[0]);
+				if (p < end && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.'))
+				{
+					if (!Floats(v + 1, 2))
+						return false;
+					factor = vec3(v[0], v[1], v[2]);
+				}
+				else
+					p = afterFirst;
+				if (factor.x == 0 || factor.y == 0 || factor.z == 0)
+					return Fail(token, "scale must not be zero");
+				placement = scale(mat4(1.0f), factor) * placement;
+			}
+			else
+				return Fail(token, token.Empty() ? "expected '}'" : "unknown instance transform");
+		}
+		scene.AddInstance(mesh->second, placement, CurrentMaterial());
+		return true;
+	}
+
+	//material [name] { property values ... } defines a material and makes it
+	//current; material name on its own makes an earlier named one current
+	bool MaterialBlock()
+	{
+		Token token = Next();
+		Token materialName;
+		if (!token.Is("{"))
+		{
+			if (token.Empty() || token.Is("}"))
+				return Fail(token, "expected a material name or '{'");
+			materialName = token;
+			const char *afterName = p;
+			if (!Next().Is("{"))
+			{
+				//a reference to an existing material, the latest of that name
+				p = afterName;
+				for (auto named = namedMaterials.rbegin(); named != namedMaterials.rend(); ++named)
+					if (materialName.Is(named->first.c_str()))
+					{
+						material = named->second;
+						hasMaterial = true;
+						return true;
+					}
+				return Fail(materialName, "unknown material");
+			}
+		}
+
+		Material m = defaultMaterial;
+		for (token = Next(); !token.Is("}"); token = Next())
+		{
+			bool ok;
+			if (token.Is("diffuse"))
+				ok = Floats(&m.diffuseColor[0], 3);
+			else if (token.Is("specular"))
+				ok = Floats(&m.specularColor[0], 3);
+			else if (token.Is("phong"))
+				ok = Floats(&m.phongExp, 1);
+			else if (token.Is("reflectance"))
+				ok = Floats(&m.reflectance, 1);
+			else
+				ok = Fail(token, token.Empty() ? "expected '}'" : "unknown material property");
+			if (!ok)
+				return false;
+		}
+
+		material = scene.AddMaterial(m);
+		hasMaterial = true;
+		if (!materialName.Empty())
+			namedMaterials.push_back({ string(materialName.begin, materialName.length), material });
+		return true;
+	}
+};
+
+bool ParseScene(const char *text, size_t length, const string &name, Scene &scene)
+{
+	scene = Scene();
+	return SceneParser(text, length, name, scene).Parse();
+}
+
+bool LoadSceneFile(const string &path, Scene &scene, size_t *bytes)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		cout << "ERROR: Could not open scene file " << path << endl;
+		return false;
+	}
+	if (bytes)
+		*bytes = file.Size();
+	return ParseScene(file.Data(), file.Size(), path, scene);
+}
+
+string NumberedScenePath(int number)
+{
+	return "scenes/scene" + to_string(number) + ".txt";
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+#include "Scene.h"
+
+using namespace std;
+
+//replace scene with the contents of a scene description file, see
+//scenes/scene1.txt for the syntax. The file is mapped rather than read and
+//records go straight into the scene's arrays. Prints the first error with its
+//line number and returns false; bytes receives the file size when given
+bool LoadSceneFile(const string &path, Scene &scene, size_t *bytes = nullptr);
+
+//the same over text already in memory; name only appears in error messages
+bool ParseScene(const char *text, size_t length, const string &name, Scene &scene);
+
+//scenes/scene<number>.txt, the files behind the number keys
+string NumberedScenePath(int number);
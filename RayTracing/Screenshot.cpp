@@ -0,0 +1,124 @@
+#include "Screenshot.h"
+
+using namespace std;
+using namespace glm;
+
+ScreenshotCapture::~ScreenshotCapture()
+{
+	//the GL objects are left to Destroy, which needs the context, but the
+	//encoder must not outlive the image it writes
+	JoinEncoder(true);
+}
+
+// --------------------------------------------------------------------------
+// Readback
+
+bool ScreenshotCapture::Begin(int width, int height, const string &path)
+{
+	JoinEncoder(false);
+	if (Busy())
+		return false;
+
+	size_t bytes = (size_t)width * height * sizeof(vec3);
+	if (!m_buffer)
+		glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffer);
+	if (bytes > m_capacity)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		m_capacity = bytes;
+	}
+	//with a pack buffer bound the read only queues a copy into it
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	//submit the fence now, or polling it without a flush might never see it signal
+	glFlush();
+
+	m_width = width;
+	m_height = height;
+	m_path = path;
+	return !CheckGLErrors();
+}
+
+void ScreenshotCapture::Poll()
+{
+	JoinEncoder(false);
+	if (!m_fence)
+		return;
+	GLenum status = glClientWaitSync(m_fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return;
+	glDeleteSync(m_fence);
+	m_fence = nullptr;
+	if (status == GL_WAIT_FAILED)
+	{
+		cout << "ERROR: screenshot readback failed" << endl;
+		return;
+	}
+	Ingest();
+}
+
+void ScreenshotCapture::Finish()
+{
+	if (m_fence)
+	{
+		glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(m_fence);
+		m_fence = nullptr;
+		Ingest();
+	}
+	JoinEncoder(true);
+}
+
+void ScreenshotCapture::Destroy()
+{
+	//a capture taken just before quitting is still saved
+	Finish();
+	if (m_buffer)
+	{
+		glDeleteBuffers(1, &m_buffer);
+		m_buffer = 0;
+		m_capacity = 0;
+	}
+}
+
+// --------------------------------------------------------------------------
+// Encoding
+
+//copy the finished readback out of the buffer and hand it to a new encoder
+void ScreenshotCapture::Ingest()
+{
+	size_t count = (size_t)m_width * m_height;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffer);
+	const vec3 *pixels = (const vec3 *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * sizeof(vec3),
+		GL_MAP_READ_BIT);
+	if (pixels)
+	{
+		m_pixels.assign(pixels, pixels + count);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (!pixels)
+	{
+		cout << "ERROR: could not map the screenshot readback" << endl;
+		return;
+	}
+
+	m_encoded = false;
+	m_encoder = thread([this] {
+		if (m_image.Width() != m_width || m_image.Height() != m_height)
+			m_image.Allocate(m_width, m_height);
+		m_image.SetRegion(0, 0, m_width, m_height, m_pixels.data());
+		m_image.SaveToFile(m_path);
+		m_encoded = true;
+	});
+}
+
+//join the encoder once it is done, or wait for it
+void ScreenshotCapture::JoinEncoder(bool wait)
+{
+	if (m_encoder.joinable() && (wait || m_encoded))
+		m_encoder.join();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OGLSupport.h"
+#include "imagebuffer.h"
+
+using namespace std;
+
+//saves the framebuffer without stalling the frame it is taken in. The pixels
+//are read into a pixel pack buffer behind a fence and copied out on the
+//first frame after the GPU has written them; a thread of its own takes them
+//into an image and encodes it to PNG. One capture is in flight at a time
+class ScreenshotCapture
+{
+public:
+	~ScreenshotCapture();
+
+	//queue a read of the bottom-left width x height pixels of the bound read
+	//framebuffer, to be saved to path; false, queueing nothing, while an
+	//earlier capture is still in flight
+	bool Begin(int width, int height, const string &path);
+	//call once a frame: copies out a readback the GPU has finished and starts
+	//encoding it, and collects an encoder that is done
+	void Poll();
+	//block until the capture in flight, if any, is written
+	void Finish();
+	//whether a capture is being read back or encoded
+	bool Busy() const { return m_fence != nullptr || m_encoder.joinable(); }
+
+	//finish the capture in flight, then delete the buffer; must be called
+	//while its context is current
+	void Destroy();
+
+private:
+	void Ingest();
+	void JoinEncoder(bool wait);
+
+	GLuint m_buffer = 0;
+	size_t m_capacity = 0;
+	GLsync m_fence = nullptr;
+	int m_width = 0, m_height = 0;
+	string m_path;
+	//the pixels as read back, and the image the encoder fills from them;
+	//both are the encoder's while it runs
+	vector<vec3> m_pixels;
+	ImageBuffer m_image;
+	thread m_encoder;
+	atomic<bool> m_encoded{ false };
+};
@@ -0,0 +1,92 @@
+#include "ShaderCache.h"
+#include "Tracer.h"
+
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+string ShaderPermutation::Defines() const
+{
+	string defines;
+	if (planes >= 0)
+		defines += "#define NUM_PLANES " + to_string(planes) + "\n";
+	if (lights >= 0)
+		defines += "#define NUM_LIGHTS " + to_string(lights) + "\n";
+	if (!spheres)
+		defines += "#define NO_SPHERES\n";
+	if (!triangles)
+		defines += "#define NO_TRIANGLES\n";
+	if (!instances)
+		defines += "#define NO_INSTANCES\n";
+	if (!reflection)
+		defines += "#define NO_REFLECTION\n";
+	return defines;
+}
+
+ShaderPermutation ScenePermutation(const Scene &scene)
+{
+	ShaderPermutation permutation;
+	if (scene.PlaneCount() <= (size_t)maxSpecializedCount)
+		permutation.planes = (int)scene.PlaneCount();
+	if (scene.lights.size() <= (size_t)maxSpecializedCount)
+		permutation.lights = (int)scene.lights.size();
+	permutation.spheres = scene.SphereCount() > 0;
+	permutation.triangles = scene.TriangleCount() > 0;
+	permutation.instances = scene.InstanceCount() > 0;
+	permutation.reflection = false;
+	for (const Material &material : scene.materials)
+		permutation.reflection = permutation.reflection || material.reflectance > 0;
+	return permutation;
+}
+
+//the defines on one line, for reporting
+static string Summary(const string &defines)
+{
+	if (defines.empty())
+		return "generic";
+	string summary;
+	for (size_t start = 0; start < defines.size(); )
+	{
+		size_t end = defines.find('\n', start);
+		summary += (summary.empty() ? "" : ", ") + defines.substr(start + 8, end - start - 8);
+		start = end + 1;
+	}
+	return summary;
+}
+
+GLuint ShaderCache::Get(const ShaderPermutation &permutation)
+{
+	string defines = permutation.Defines();
+	auto found = m_programs.find(defines);
+	if (found != m_programs.end())
+	{
+		m_hits++;
+		return found->second;
+	}
+
+	auto start = chrono::high_resolution_clock::now();
+	GLuint program = InitializeShaders(defines);
+	GLint linked = GL_FALSE;
+	if (program)
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	if (!linked)
+	{
+		cout << "ERROR: ray.frag did not compile for " << Summary(defines) << endl;
+		if (program)
+			glDeleteProgram(program);
+		return 0;
+	}
+	m_compileSeconds += seconds;
+	m_programs[defines] = program;
+	cout << "Compiled ray.frag (" << Summary(defines) << ") in " << seconds * 1000 << " ms" << endl;
+	return program;
+}
+
+void ShaderCache::Destroy()
+{
+	for (const auto &entry : m_programs)
+		glDeleteProgram(entry.second);
+	m_programs.clear();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <map>
+#include <string>
+
+#include "OGLSupport.h"
+#include "Scene.h"
+#include "BVH.h"
+
+using namespace std;
+
+const int maxSpecializedCount = 8; //planes or lights beyond this are left to the uniforms
+
+//what a build of ray.frag is specialised to: small counts become constants
+//its loops unroll over, and kinds of primitive the scene lacks are compiled
+//out. The default is the generic build, which traces any scene
+struct ShaderPermutation {
+	int planes = -1;          //-1 = read from the numPlanes uniform
+	int lights = -1;          //-1 = read from the numLights uniform
+	bool spheres = true;
+	bool triangles = true;
+	bool instances = true;
+	bool reflection = true;   //false when no material reflects, so paths end at the first hit
+
+	//the #define lines to compile with, empty for the generic build; also
+	//the key programs are cached by
+	string Defines() const;
+};
+
+//the permutation that traces the scene with the least generality
+ShaderPermutation ScenePermutation(const Scene &scene);
+
+//ray.frag programs compiled once per permutation and kept for the life of
+//one OpenGL context, so that switching back to a kind of scene seen before
+//takes no compile
+class ShaderCache
+{
+public:
+	//the program for a permutation, compiled if it is new; 0 if it fails to
+	//compile, which is not cached so a fixed shader can be tried again
+	GLuint Get(const ShaderPermutation &permutation);
+	//delete the programs; must be called while their context is current
+	void Destroy();
+
+	size_t Programs() const { return m_programs.size(); }
+	int Hits() const { return m_hits; }
+	double CompileSeconds() const { return m_compileSeconds; }
+
+private:
+	map<string, GLuint> m_programs;
+	int m_hits = 0;
+	double m_compileSeconds = 0;
+};
@@ -1,4 +1,8 @@
 #include "Tracer.h"
+#include "Headless.h"
+
+#include <chrono>
+#include <random>
 
 #define DIM 1024
 
@@ -18,8 +22,25 @@ float xOld = 0, yOld = 0;
 
 bool leftPressed = false;
 
+//scene currently loaded, and whether it is traced on the CPU instead of in ray.frag
+Scene currentScene;
+BVH currentBVH;
+bool cpuMode = false;
+ProgressiveRender progressive;
+TraceSettings traceSettings; //path length and termination, shared by ray.frag and the CPU tracer
+SceneBuffers sceneBuffers; //what ray.frag reads the current scene from
+ShaderCache shaderCache; //a build of ray.frag for each kind of scene loaded
+DynamicResolution dynamicResolution; //lower resolution shader frames while the view moves, toggled by Z
+ScreenshotCapture screenshot;
+bool screenshotRequested = false; //set by the P key, taken once the next frame is drawn
+const double progressiveBudget = 0.03; //seconds of CPU tracing per frame
+
 int main(int argc, char *argv[])
 {
+	// command line arguments select one of the windowless modes
+	if (argc > 1)
+		return RunHeadless(argc, argv);
+
 	// initialize the GLFW windowing system
 	if (!glfwInit())
 	{
@@ -60,48 +81,32 @@ int main(int argc, char *argv[])
 	// query and print out information about our OpenGL environment
 	QueryGLVersion();
 
-	// call function to load and compile shader programs
-	program = InitializeShaders();
+	// call function to load and compile shader programs; the generic build
+	// stands in for any scene whose own fails to compile
+	program = shaderCache.Get(ShaderPermutation());
 	if (program == 0)
 	{
 		cout << "Program could not initialize shaders, TERMINATING" << endl;
 		return -1;
 	}
 
-	// three vertex positions and assocated colours of a triangle
-	vector<vec2> vertices = {
-		vec2(-1, -1),
-		vec2(-1, 1),
-		vec2(1, -1),
-		vec2(1,1)
-
-	};
-
-
 	// call function to create and fill buffers with geometry data
 	Geometry geometry;
 	if (!InitializeVAO(&geometry))
 		cout << "Program failed to intialize geometry!" << endl;
 
-	if (!LoadGeometry(&geometry, vertices))
+	if (!LoadGeometry(&geometry, ScreenQuad()))
 		cout << "Failed to load geometry" << endl;
 
+	if (!dynamicResolution.Initialize(DIM, DIM))
+		cout << "Failed to create the dynamic resolution target" << endl;
+
 	// bind our shader program and the vertex array object containing our
 	// scene geometry, then tell OpenGL to draw our geometry
 	glUseProgram(program);
 	glBindVertexArray(geometry.vertexArray);
 
-	//set the origin of our scene, so we can move around in it
-	vec3 origin = vec3(0.0f, 2.0f, 5.0f);
-	GLuint originLoc = glGetUniformLocation(program, "cameraOrigin");
-	GLuint fov = glGetUniformLocation(program, "fov");
-	GLuint transform = glGetUniformLocation(program, "transform");
-	GLuint oTransform = glGetUniformLocation(program, "oTransform");
-	
-	glUniform3fv(originLoc, 1, glm::value_ptr(origin));
-	glUniform1f(fov, 30);
-
-	LoadScene1(program);
+	LoadScene(NumberedScenePath(1));
 
 	ib = new ImageBuffer();
 	ib->Initialize();
@@ -112,21 +117,19 @@ int main(int argc, char *argv[])
 	while (!glfwWindowShouldClose(window))
 	{
 
-		vec3 origin = vec3(0, 0, 0);
-		glUniform3fv(originLoc, 1, glm::value_ptr(origin));
-
-		glm::mat4 trans;
-		glm::mat4 oTrans;
-		
-		trans = glm::rotate(trans, pitchAmt /500, vec3(0, 1, 0));
-		trans = glm::rotate(trans, yawAmt /500, vec3(1, 0, 0));
-		oTrans = glm::translate(oTrans, cameraPosition);
-		
-		
-		glUniformMatrix4fv(transform, 1, GL_FALSE, glm::value_ptr(trans));
-		glUniformMatrix4fv(oTransform, 1, GL_FALSE, glm::value_ptr(oTrans));
+		Camera camera = CurrentCamera();
+		SetCameraUniforms(program, camera);
+		SetTraceUniforms(program, traceSettings);
 		// call function to draw our scene
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount);
+		if (cpuMode)
+		{
+			//refine for part of a frame, so the window stays responsive and
+			//moving the camera shows a coarse preview straight away
+			progressive.Step(currentScene, currentBVH, camera, ib, progressiveBudget);
+			ib->Render();
+		}
+		else
+			dynamicResolution.Draw(camera, [&]() { glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount); });
 
 		
 		yoff += 0.001;
@@ -134,6 +137,17 @@ int main(int argc, char *argv[])
 			yoff = 0;
 		}
 
+		//read the frame just drawn, before it is swapped away
+		if (screenshotRequested)
+		{
+			screenshotRequested = false;
+			if (screenshot.Busy())
+				cout << "The last screenshot is still being saved" << endl;
+			else
+				screenshot.Begin(DIM, DIM, "scene.png");
+		}
+		screenshot.Poll();
+
 		// check for an report any OpenGL errors
 		CheckGLErrors();
 
@@ -145,10 +159,13 @@ int main(int argc, char *argv[])
 	// reset state to default (no shader or geometry bound)
 
 	// clean up allocated resources before exit
+	screenshot.Destroy();
+	dynamicResolution.Destroy();
+	sceneBuffers.Destroy();
 	DestroyGeometry(&geometry);
 	glBindVertexArray(0);
 	glUseProgram(0);
-	glDeleteProgram(program);
+	shaderCache.Destroy();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
@@ -156,621 +173,288 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-void LoadScene1(GLuint program)
+Scene MakeSyntheticScene(int triangleCount)
 {
-	vector<Light> lights = {};
-	vector<Sphere> spheres = {};
-	vector<Triangle> triangles = {};
-	vector<Plane> planes = {};
-	Light l1 = {
-		vec4(0, 2.4, -7.75, 1),
-		vec4(1, 1, 1, 1),
-		1.0f,
-		0.5f};
-
-	lights.push_back(l1);
-
-	Sphere reflectiveGrey = {
-		vec4(0.9, -1.925, -6.69, 1),
-		vec4(0.5, 0.5, 0.5, 1),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		0.825f,
-		0.5};
-
-	spheres.push_back(reflectiveGrey);
-
-	//Blue pyramid
-
-	vec4 lightBlue = vec4(0.0f, 191.0 / 255.0, 1.0, 0.0);
-
-	Triangle blueT1 = {
-		vec4(-0.4, -2.75, -9.55, 1),
-		vec4(-0.93, 0.55, -8.51, 1),
-		vec4(0.11, -2.75, -7.98, 1),
-		lightBlue,
-		vec4(1, 1, 1, 1),
-		10.f,
-		0.5};
-	Triangle blueT2 = {
-		vec4(0.11, -2.75, -7.98, 1),
-		vec4(-0.93, 0.55, -8.51, 1),
-		vec4(-1.46, -2.75, -7.47, 1),
-		lightBlue,
-		vec4(1, 1, 1, 1),
-		10.f,
-		0.5 };
-	Triangle blueT3 = {
-		vec4(-1.46, -2.75, -7.47, 1),
-		vec4(-0.93, 0.55, -8.51, 1),
-		vec4(-1.97, -2.75, -9.04, 1),
-		lightBlue,
-		vec4(1, 1, 1, 1),
-		10.f,
-		0.5 };
-	Triangle blueT4 = {
-		vec4(-1.97, -2.75, -9.0, 14),
-		vec4(-0.93, 0.55, -8.51, 1),
-		vec4(-0.4, -2.75, -9.55, 1),
-		lightBlue,
-		vec4(1, 1, 1, 1),
-		10.f,
-		0.5 };
-
-	//Ceiling
-	Triangle ceilingT1 = {
-		vec4(2.75, 2.75, -10.5, 1),
-		vec4(2.75, 2.75, -5, 1),
-		vec4(-2.75, 2.75, -5, 1),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10.0f};
-	Triangle ceilingT2 = {
-		vec4(-2.75, 2.75, -10.5, 1),
-		vec4(2.75, 2.75, -10.5, 1),
-		vec4(-2.75, 2.75, -5, 1),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10.0f};
-
-	//Green wall on right
-	Triangle wallRightGreenT1 = {
-		vec4(2.75, 2.75, -5, 1),
-		vec4(2.75, 2.75, -10.5, 1),
-		vec4(2.75, -2.75, -10.5, 1),
-		vec4(0, 1, 0, 0),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		1};
-	Triangle wallRightGreenT2 = {
-		vec4(2.75, -2.75, -5, 1),
-		vec4(2.75, 2.75, -5, 1),
-		vec4(2.75, -2.75, -10.5, 1),
-		vec4(0, 1, 0, 0),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		1};
-
-	//Red wall on left
-	Triangle wallLeftRedT1 = {
-		vec4(-2.75, -2.75, -5, 1),
-		vec4(-2.75, -2.75, -10.5, 1),
-		vec4(-2.75, 2.75, -10.5, 1),
-		vec4(1, 0, 0, 0),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		1};
-	Triangle wallLeftRedT2 = {
-		vec4(-2.75, 2.75, -5, 1),
-		vec4(-2.75, -2.75, -5, 1),
-		vec4(-2.75, 2.75, -10.5, 1),
-		vec4(1, 0, 0, 0),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		1};
-
-	//Floor
-	Triangle floorT1 = {
-		vec4(2.75, -2.75, -5, 1),
-		vec4(2.75, -2.75, -10.5, 1),
-		vec4(-2.75, -2.75, -10.5, 1),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		0.0};
-	Triangle floorT2 = {
-		vec4(-2.75, -2.75, -5, 1),
-		vec4(2.75, -2.75, -5, 1),
-		vec4(-2.75, -2.75, -10.5, 1),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10.0f,
-		0.0 };
-
-	triangles.push_back(blueT1);
-	triangles.push_back(blueT2);
-	triangles.push_back(blueT3);
-	triangles.push_back(blueT4);
-	triangles.push_back(ceilingT1);
-	triangles.push_back(ceilingT2);
-	triangles.push_back(wallRightGreenT1);
-	triangles.push_back(wallRightGreenT2);
-	triangles.push_back(wallLeftRedT1);
-	triangles.push_back(wallLeftRedT2);
-	triangles.push_back(floorT1);
-	triangles.push_back(floorT2);
-
-	//Back wall
-	Plane backWall = {
-		vec4(0, 0, 1, 0),
-		vec4(0, 0, -10.5, 0),
-		vec4(1, 1, 1, 1),
+	Scene scene;
+	scene.lights.push_back({
+		vec4(4, 6, -1, 1),
 		vec4(1, 1, 1, 1),
-		10.0f};
-
-	planes.push_back(backWall);
-
-	LoadShapes(spheres, triangles, planes, lights, program);
+		1.0,
+		0.5 });
+	scene.AddPlane(vec3(0, 1, 0), vec3(0, -3, 0),
+		scene.AddMaterial({ vec3(1, 1, 1), 10, vec3(1, 1, 1), 0 }));
+	scene.AddPlane(vec3(0, 0, 1), vec3(0, 0, -14),
+		scene.AddMaterial({ vec3(0, 191.0 / 255.0, 1), 10, vec3(1, 1, 1), 0 }));
+
+	//a grid of balls, each a latitude/longitude mesh of 2 * rings * segments triangles
+	const int grid = 10;
+	const float radius = 0.28f;
+	int perBall = std::max(8, triangleCount / (grid * grid));
+	int rings = std::max(2, (int)sqrt(perBall / 4.0));
+	int segments = std::max(3, perBall / (2 * rings));
+
+	for (int b = 0; b < grid * grid; b++)
+	{
+		vec3 center = vec3((b % grid - (grid - 1) / 2.0f) * 0.65f,
+			(b / grid - (grid - 1) / 2.0f) * 0.6f, -9.0f - (b % 3));
+		vec3 diffuse = vec3(0.3f + 0.7f * (b % 2), 0.3f + 0.7f * ((b / 2) % 2), 0.3f + 0.7f * ((b / 4) % 2));
+		float reflect = (b % 5 == 0) ? 0.5f : 0.0f;
+		uint32_t material = scene.AddMaterial({ diffuse, 10, vec3(1, 1, 1), reflect });
+
+		auto point = [&](int ring, int segment) {
+			float theta = pi<float>() * ring / rings;
+			float phi = 2 * pi<float>() * segment / segments;
+			return center + radius * vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+		};
+		for (int r = 0; r < rings; r++)
+			for (int sgm = 0; sgm < segments; sgm++)
+			{
+				vec3 a = point(r, sgm), c = point(r + 1, sgm);
+				vec3 d = point(r + 1, sgm + 1), e = point(r, sgm + 1);
+				scene.AddTriangle(a, e, d, material);
+				scene.AddTriangle(a, d, c, material);
+			}
+	}
+	return scene;
 }
 
-void LoadScene2(GLuint program)
+//the 20 faces of an icosahedron of unit radius, with a vertex at each pole
+static void AddIcosahedron(Scene &scene)
 {
+	vec3 v[12];
+	v[0] = vec3(0, 1, 0);
+	v[11] = vec3(0, -1, 0);
+	float y = 1 / sqrt(5.0f), r = 2 / sqrt(5.0f);
+	for (int i = 0; i < 5; i++)
+	{
+		float upper = 2 * pi<float>() * i / 5, lower = upper + pi<float>() / 5;
+		v[1 + i] = vec3(r * cos(upper), y, r * sin(upper));
+		v[6 + i] = vec3(r * cos(lower), -y, r * sin(lower));
+	}
+	for (int i = 0; i < 5; i++)
+	{
+		int j = (i + 1) % 5;
+		scene.AddMeshTriangle(v[0], v[1 + j], v[1 + i]);
+		scene.AddMeshTriangle(v[1 + i], v[1 + j], v[6 + i]);
+		scene.AddMeshTriangle(v[1 + j], v[6 + j], v[6 + i]);
+		scene.AddMeshTriangle(v[6 + i], v[6 + j], v[11]);
+	}
+}
 
-	vector<Light> lights = {};
-	vector<Sphere> spheres = {};
-	vector<Triangle> triangles = {};
-	vector<Plane> planes = {};
-	Light light = {
+Scene MakeInstancedScene(int instanceCount)
+{
+	Scene scene;
+	scene.lights.push_back({
 		vec4(4, 6, -1, 1),
 		vec4(1, 1, 1, 1),
 		1.0,
-		0.5};
+		0.5 });
+	scene.AddPlane(vec3(0, 1, 0), vec3(0, -1, 0),
+		scene.AddMaterial({ vec3(1, 1, 1), 10, vec3(1, 1, 1), 0 }));
+
+	uint32_t mesh = scene.AddMesh();
+	AddIcosahedron(scene);
+	uint32_t materials[4];
+	for (int m = 0; m < 4; m++)
+		materials[m] = scene.AddMaterial({ vec3(0.3f + 0.7f * (m % 2), 0.3f + 0.7f * (m / 2), 0.3f), 10,
+			vec3(1, 1, 1), (m == 3) ? 0.5f : 0.0f });
+
+	//rows of icosahedra resting on the floor and receding from the camera,
+	//each turned and sized a little differently
+	int columns = std::max(1, (int)sqrt((float)instanceCount));
+	for (int i = 0; i < instanceCount; i++)
+	{
+		float size = 0.15f + 0.05f * (i % 3);
+		vec3 position((i % columns - (columns - 1) / 2.0f) * 0.5f, -1 + size, -4.0f - (i / columns) * 0.5f);
+		mat4 placement = translate(mat4(1.0f), position);
+		placement = rotate(placement, 0.7f * i, vec3(0, 1, 0));
+		placement = scale(placement, vec3(size));
+		scene.AddInstance(mesh, placement, materials[i % 4]);
+	}
+	return scene;
+}
 
-	lights.push_back(light);
-	// Floor
-	Plane floorPlane = {
-		vec4(0, 1, 0, 0),
-		vec4(0, -1, 0, 0),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10,
-		0};
-
-	// Back wall
-	Plane wallPlane = {
-		vec4(0, 0, 1, 0),
-		vec4(0, 0, -12, 0),
-		vec4(0, 191.0/255.0, 1, 1),
-		vec4(1, 1, 1, 1),
-		10};
+void ScatterLights(Scene &scene, int count)
+{
+	if (scene.lights.empty())
+		return;
+	mt19937 random(453);
+	uniform_real_distribution<float> unit(-1, 1);
+	size_t sources = scene.lights.size();
+	vector<Light> lights(count);
+	for (int i = 0; i < count; i++)
+	{
+		//light i % sources has count / sources copies, one more for the first count % sources
+		const Light &source = scene.lights[i % sources];
+		int copies = count / (int)sources + ((size_t)(count % sources) > i % sources ? 1 : 0);
+		vec3 offset;
+		do
+			offset = vec3(unit(random), unit(random), unit(random));
+		while (dot(offset, offset) > 1);
+		lights[i] = source;
+		lights[i].center += vec4(offset * source.radius, 0);
+		lights[i].radius = 0;
+		lights[i].intensity = source.intensity / copies;
+	}
+	scene.lights = lights;
+}
 
-	planes.push_back(floorPlane);
-	planes.push_back(wallPlane);
+bool LoadScene(const string &path)
+{
+	Scene scene;
+	BVH bvh;
+	SceneLoadInfo info;
+	if (!LoadCachedScene(path, scene, bvh, &info))
+		return false;
+	cout << "Loaded " << path << (info.fromCache ? " from its cache" : "") << " in "
+		<< info.seconds * 1000 << " ms" << endl;
+
+	//the buffers and the program built for the scene go together, so neither
+	//changes unless the scene fits in the buffers
+	GLuint specialized = shaderCache.Get(ScenePermutation(scene));
+	GLuint sceneProgram = specialized ? specialized : shaderCache.Get(ShaderPermutation());
+	if (!sceneProgram || !LoadShapes(scene, bvh, sceneProgram, sceneBuffers))
+	{
+		cout << "ERROR: " << path << " could not be loaded for the shader, keeping the current scene" << endl;
+		glUseProgram(program);
+		return false;
+	}
+	program = sceneProgram;
+	swap(currentScene, scene);
+	swap(currentBVH, bvh);
+	progressive.Reset();
+	return true;
+}
 
-	// Large yellow sphere
-	Sphere sphereYellow = {
-		vec4(1, -0.5, -3.5, 1),
-		vec4(1, 1, 0, 1),
-		vec4(1, 1, 1, 1),
-		10,
-		0.5,
-		0.0};
-
-	// Reflective grey sphere
-	Sphere sphereGrey = {
-		vec4(0, 1, -5, 1),
-		vec4(0.5, 0.5, 0.5, 0.5),
-		vec4(1, 1, 1, 1),
-		100,
-		0.4,
-		0.8};
-
-	// Metallic purple sphere
-	Sphere spherePurple = {
-		vec4(-0.8, -0.75, -4, 1),
-		vec4(1, 0, 1, 1),
-		vec4(1, 0, 1, 1),
-		100,
-		0.25,
-		0.33};
-
-	spheres.push_back(sphereYellow);
-	spheres.push_back(sphereGrey);
-	spheres.push_back(spherePurple);
-
-	// Green cone
-
-	vec4 greenCone = vec4(0, 1, 0, 1);
-	Triangle greenCone0 = {
-		vec4(0, -1, -5.8, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0.4, -1, -5.693, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone1 = {
-		vec4(0.4, -1, -5.693, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0.6928, -1, -5.4, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone2 = {
-		vec4(0.6928, -1, -5.4, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0.8, -1, -5, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone3 = {
-		vec4(0.8, -1, -5, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0.6928, -1, -4.6, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone4 = {
-		vec4(0.6928, -1, -4.6, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0.4, -1, -4.307, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone5 = {
-		vec4(0.4, -1, -4.307, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0, -1, -4.2, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone6 = {
-		vec4(0, -1, -4.2, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(-0.4, -1, -4.307, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone7 = {
-		vec4(-0.4, -1, -4.307, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(-0.6928, -1, -4.6, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone8 = {
-		vec4(-0.6928, -1, -4.6, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(-0.8, -1, -5, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone9 = {
-		vec4(-0.8, -1, -5, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(-0.6928, -1, -5.4, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone10 = {
-		vec4(-0.6928, -1, -5.4, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(-0.4, -1, -5.693, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-	Triangle greenCone11 = {
-		vec4(-0.4, -1, -5.693, 1),
-		vec4(0, 0.6, -5, 1),
-		vec4(0, -1, -5.8, 1),
-		greenCone,
-		vec4(1, 1, 1, 1),
-		10};
-
-
-	vec4 redIco = vec4(1, 0, 0, 1);
-	//, Shiny, red, icosahedron
-	Triangle icosahedron0 = {
-		vec4(-2, -1, -7, 1),
-		vec4(-1.276, -0.4472, -6.474, 1),
-		vec4(-2.276, -0.4472, -6.149, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron1 = {
-		vec4(-1.276, -0.4472, -6.474, 1),
-		vec4(-2, -1, -7, 1),
-		vec4(-1.276, -0.4472, -7.526, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron2 = {
-		vec4(-2, -1, -7, 1),
-		vec4(-2.276, -0.4472, -6.149, 1),
-		vec4(-2.894, -0.4472, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron3 = {
-		vec4(-2, -1, -7, 1),
-		vec4(-2.894, -0.4472, -7, 1),
-		vec4(-2.276, -0.4472, -7.851, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron4 = {
-		vec4(-2, -1, -7, 1),
-		vec4(-2.276, -0.4472, -7.851, 1),
-		vec4(-1.276, -0.4472, -7.526, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron5 = {
-		vec4(-1.276, -0.4472, -6.474, 1),
-		vec4(-1.276, -0.4472, -7.526, 1),
-		vec4(-1.106, 0.4472, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron6 = {
-		vec4(-2.276, -0.4472, -6.149, 1),
-		vec4(-1.276, -0.4472, -6.474, 1),
-		vec4(-1.724, 0.4472, -6.149, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron7 = {
-		vec4(-2.894, -0.4472, -7, 1),
-		vec4(-2.276, -0.4472, -6.149, 1),
-		vec4(-2.724, 0.4472, -6.474, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron8 = {
-		vec4(-2.276, -0.4472, -7.851, 1),
-		vec4(-2.894, -0.4472, -7, 1),
-		vec4(-2.724, 0.4472, -7.526, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron9 = {
-		vec4(-1.276, -0.4472, -7.526, 1),
-		vec4(-2.276, -0.4472, -7.851, 1),
-		vec4(-1.724, 0.4472, -7.851, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron10 = {
-		vec4(-1.276, -0.4472, -6.474, 1),
-		vec4(-1.106, 0.4472, -7, 1),
-		vec4(-1.724, 0.4472, -6.149, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron11 = {
-		vec4(-2.276, -0.4472, -6.149, 1),
-		vec4(-1.724, 0.4472, -6.149, 1),
-		vec4(-2.724, 0.4472, -6.474, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron12 = {
-		vec4(-2.894, -0.4472, -7, 1),
-		vec4(-2.724, 0.4472, -6.474, 1),
-		vec4(-2.724, 0.4472, -7.526, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron13 = {
-		vec4(-2.276, -0.4472, -7.851, 1),
-		vec4(-2.724, 0.4472, -7.526, 1),
-		vec4(-1.724, 0.4472, -7.851, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron14 = {
-		vec4(-1.276, -0.4472, -7.526, 1),
-		vec4(-1.724, 0.4472, -7.851, 1),
-		vec4(-1.106, 0.4472, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron15 = {
-		vec4(-1.724, 0.4472, -6.149, 1),
-		vec4(-1.106, 0.4472, -7, 1),
-		vec4(-2, 1, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron16 = {
-		vec4(-2.724, 0.4472, -6.474, 1),
-		vec4(-1.724, 0.4472, -6.149, 1),
-		vec4(-2, 1, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron17 = {
-		vec4(-2.724, 0.4472, -7.526, 1),
-		vec4(-2.724, 0.4472, -6.474, 1),
-		vec4(-2, 1, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron18 = {
-		vec4(-1.724, 0.4472, -7.851, 1),
-		vec4(-2.724, 0.4472, -7.526, 1),
-		vec4(-2, 1, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-	Triangle icosahedron19 = {
-		vec4(-1.106, 0.4472, -7, 1),
-		vec4(-1.724, 0.4472, -7.851, 1),
-		vec4(-2, 1, -7, 1),
-		redIco,
-		vec4(1, 0.5, 0.5, 1),
-		10,
-		0.5};
-
-	triangles.push_back(greenCone0);
-	triangles.push_back(greenCone1);
-	triangles.push_back(greenCone2);
-	triangles.push_back(greenCone3);
-	triangles.push_back(greenCone4);
-	triangles.push_back(greenCone5);
-	triangles.push_back(greenCone6);
-	triangles.push_back(greenCone7);
-	triangles.push_back(greenCone8);
-	triangles.push_back(greenCone9);
-	triangles.push_back(greenCone10);
-	triangles.push_back(greenCone11);
-
-	triangles.push_back(icosahedron0);
-	triangles.push_back(icosahedron1);
-	triangles.push_back(icosahedron2);
-	triangles.push_back(icosahedron3);
-	triangles.push_back(icosahedron4);
-	triangles.push_back(icosahedron5);
-	triangles.push_back(icosahedron6);
-	triangles.push_back(icosahedron7);
-	triangles.push_back(icosahedron8);
-	triangles.push_back(icosahedron9);
-	triangles.push_back(icosahedron10);
-	triangles.push_back(icosahedron11);
-	triangles.push_back(icosahedron12);
-	triangles.push_back(icosahedron13);
-	triangles.push_back(icosahedron14);
-	triangles.push_back(icosahedron15);
-	triangles.push_back(icosahedron16);
-	triangles.push_back(icosahedron17);
-	triangles.push_back(icosahedron18);
-	triangles.push_back(icosahedron19);
-	LoadShapes(spheres, triangles, planes, lights, program);
+bool LoadShapes(const Scene &scene, const BVH &bvh, GLuint program, SceneBuffers &buffers)
+{
+	if (!buffers.Upload(scene, bvh))
+		return false;
 
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "numPlanes"), scene.PlaneCount());
+	glUniform1i(glGetUniformLocation(program, "numLights"), scene.lights.size());
+	glUniform1i(glGetUniformLocation(program, "numNodes"), bvh.nodes.size());
+	return !CheckGLErrors();
 }
 
+void SetCameraUniforms(GLuint program, const Camera &camera)
+{
+	glUniform3fv(glGetUniformLocation(program, "cameraOrigin"), 1, glm::value_ptr(camera.origin));
+	glUniform1f(glGetUniformLocation(program, "fov"), camera.fov);
+	glUniformMatrix4fv(glGetUniformLocation(program, "transform"), 1, GL_FALSE, glm::value_ptr(camera.transform));
+	glUniformMatrix4fv(glGetUniformLocation(program, "oTransform"), 1, GL_FALSE, glm::value_ptr(camera.oTransform));
+}
 
-void LoadScene3(GLuint program) {
-	vector<Light> lights = {};
-	vector<Sphere> spheres = {};
-	vector<Triangle> triangles = {};
-	vector<Plane> planes = {};
-	Light light = {
-		vec4(4, 6, -1, 1),
-		vec4(1, 1, 1, 1),
-		1.0,
-		0.25 };
-	Light light2 = {
-		vec4(-4, 6, -1, 1),
-		vec4(1, 1, 1, 1),
-		1.0,
-		0.25 };
-
-	lights.push_back(light);
-	lights.push_back(light2);
-	// Floor
-	Plane floorPlane = {
-		vec4(0, 1, 0, 0),
-		vec4(0, -1, 0, 0),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10,
-		0.0 };
+void SetTraceUniforms(GLuint program, const TraceSettings &settings)
+{
+	glUniform1i(glGetUniformLocation(program, "bounces"), settings.bounces);
+	glUniform1f(glGetUniformLocation(program, "minWeight"), settings.minWeight);
+	glUniform1i(glGetUniformLocation(program, "rouletteBounce"), settings.rouletteBounce);
+	glUniform1i(glGetUniformLocation(program, "lightSamples"), settings.lightSamples);
+}
 
-	// Back wall
-	Plane wallPlane = {
-		vec4(0, 0, 1, 0),
-		vec4(0, 0, -12, 0),
-		vec4(1, 1, 1, 1),
-		vec4(1, 1, 1, 1),
-		10 };
+vector<vec2> ScreenQuad()
+{
+	return { vec2(-1, -1), vec2(3, -1), vec2(-1, 3) };
+}
 
-	Sphere sphereA = {
-		vec4(0, 0, -5, 1),
-		vec4(0, 0, 0, 1),
-		vec4(1, 1, 1, 1),
-		100,
-		1,
-		0 };
-	Sphere sphereB = {
-		vec4(1, 1, -5, 1),
-		vec4(0, 0, 0, 1),
-		vec4(1, 1, 1, 1),
-		100,
-		0.5,
-		0 };
-	Sphere sphereC = {
-		vec4(-1, 1, -5, 1),
-		vec4(0, 0, 0, 1),
-		vec4(1, 1, 1, 1),
-		100,
-		0.5,
-		0 };
+GLFWwindow *OpenHiddenWindow(int width, int height)
+{
+	if (!glfwInit())
+	{
+		cout << "ERROR: GLFW failed to initialize" << endl;
+		return nullptr;
+	}
+	glfwSetErrorCallback(ErrorCallback);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow *window = glfwCreateWindow(width, height, "RayTracing", 0, 0);
+	if (!window)
+	{
+		cout << "ERROR: could not create an OpenGL 4.3 context" << endl;
+		glfwTerminate();
+		return nullptr;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGL())
+	{
+		cout << "ERROR: GLAD init failed" << endl;
+		CloseHiddenWindow(window);
+		return nullptr;
+	}
+	return window;
+}
 
-	planes.push_back(floorPlane);
-	planes.push_back(wallPlane);
+void CloseHiddenWindow(GLFWwindow *window)
+{
+	glfwDestroyWindow(window);
+	glfwTerminate();
+}
 
-	spheres.push_back(sphereA);
-	spheres.push_back(sphereB);
-	spheres.push_back(sphereC);
+bool RenderShader(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image, double *seconds,
+	const TraceSettings &settings)
+{
+	int width = image->Width(), height = image->Height();
+	GLFWwindow *window = OpenHiddenWindow(width, height);
+	if (!window)
+		return false;
+	QueryGLVersion();
 
+	bool ok = false;
+	GLuint program = InitializeShaders(ScenePermutation(scene).Defines());
+	Geometry geometry;
+	SceneBuffers buffers;
+	GLuint texture = 0, framebuffer = 0;
+	if (program && InitializeVAO(&geometry) && LoadGeometry(&geometry, ScreenQuad())
+		&& LoadShapes(scene, bvh, program, buffers))
+	{
+		//draw into a float texture rather than the hidden window, whose pixels
+		//need not exist
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+		glViewport(0, 0, width, height);
+
+		glUseProgram(program);
+		glBindVertexArray(geometry.vertexArray);
+		SetCameraUniforms(program, camera);
+		SetTraceUniforms(program, settings);
+		glFinish();
+		auto start = chrono::high_resolution_clock::now();
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, geometry.elementCount);
+		glFinish();
+		if (seconds)
+			*seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, image->Row(0));
+		image->MarkModified(0, height);
+		ok = !CheckGLErrors();
+	}
 
-	LoadShapes(spheres, triangles, planes, lights, program);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &texture);
+	buffers.Destroy();
+	DestroyGeometry(&geometry);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDeleteProgram(program);
+	CloseHiddenWindow(window);
+	return ok;
 }
 
-void LoadShapes(vector<Sphere> spheres, vector<Triangle> triangles, vector<Plane> planes, vector<Light> lights, GLuint program)
+Camera CurrentCamera()
 {
-	GLuint sphereUBO, triangleUBO, planeUBO, lightUBO;
-	glGenBuffers(1, &sphereUBO);
-	glGenBuffers(1, &triangleUBO);
-	glGenBuffers(1, &planeUBO);
-	glGenBuffers(1, &lightUBO);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, sphereUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(Sphere) * spheres.size(), spheres.data(), GL_DYNAMIC_DRAW);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, triangleUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(Triangle) * triangles.size(), triangles.data(), GL_DYNAMIC_DRAW);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, planeUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(Plane) * planes.size(), planes.data(), GL_DYNAMIC_DRAW);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(Light) * lights.size(), lights.data(), GL_DYNAMIC_DRAW);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glBindBufferBase(GL_UNIFORM_BUFFER, 1, sphereUBO);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 2, triangleUBO);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 3, planeUBO);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 4, lightUBO);
-
-	GLuint sphereCountIndex = glGetUniformLocation(program, "numSpheres");
-	GLuint triangleCountIndex = glGetUniformLocation(program, "numTriangles");
-	GLuint planeCountIndex = glGetUniformLocation(program, "numPlanes");
-	GLuint lightCountIndex = glGetUniformLocation(program, "numLights");
-	glUniform1i(sphereCountIndex, spheres.size());
-	glUniform1i(triangleCountIndex, triangles.size());
-	glUniform1i(planeCountIndex, planes.size());
-	glUniform1i(lightCountIndex, lights.size());
+	//the mouse's horizontal travel turns the view about the vertical axis
+	return MakeCamera(cameraPosition, pitchAmt / 500, yawAmt / 500);
 }
 
 
@@ -796,38 +480,68 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
 			glfwSetWindowShouldClose(window, GL_TRUE);
 			break;
 		case GLFW_KEY_P:
+			//saved to scene.png in the background once the next frame is drawn
+			screenshotRequested = true;
+			break;
+		case GLFW_KEY_C:
+			cpuMode = !cpuMode;
+			cout << (cpuMode ? "Tracing on the CPU" : "Tracing in the shader") << endl;
+			break;
+		case GLFW_KEY_Z:
+			//shader frames drop resolution while the view moves, to stay in budget
+			dynamicResolution.enabled = !dynamicResolution.enabled;
+			cout << "Dynamic resolution " << (dynamicResolution.enabled ? "on" : "off") << ", "
+				<< dynamicResolution.controller.budget * 1000 << " ms budget" << endl;
+			break;
+		case GLFW_KEY_V:
 		{
-			GLfloat * data = new GLfloat[3 * DIM * DIM];
-			glReadPixels(0, 0, DIM, DIM, GL_RGB, GL_FLOAT, data);
+			//draw the shader frame, trace the same view on the CPU and compare
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei)ScreenQuad().size());
+			vector<vec3> gpu(DIM * DIM);
+			glReadPixels(0, 0, DIM, DIM, GL_RGB, GL_FLOAT, gpu.data());
+			double seconds = RenderCpu(currentScene, currentBVH, CurrentCamera(), ib, 0, nullptr, tileSize, nullptr,
+				traceSettings);
+
+			double sum = 0, worst = 0;
+			int differing = 0;
 			for (int y = 0; y < DIM; y++) {
+				const vec3 *row = ib->Row(y);
 				for (int x = 0; x < DIM; x++) {
-					float rValue = data[3 * (x + y * DIM)];
-					float gValue = data[3 * (x + y * DIM) + 1];
-					float bValue = data[3 * (x + y * DIM) + 2];
-
-					ib->SetPixel(x, y, vec3(rValue, gValue, bValue));
+					vec3 error = abs(clamp(row[x], 0.f, 1.f) - gpu[x + y * DIM]);
+					float e = std::max(error.r, std::max(error.g, error.b));
+					sum += e;
+					worst = std::max(worst, (double)e);
+					if (e > 2 / 255.0)
+						differing++;
 				}
 			}
-			free(data);
-			ib->Render();
-			ib->SaveToFile("scene.jpg");
+			cout << "CPU frame in " << seconds * 1000 << " ms; mean error " << sum / (DIM * DIM)
+				<< ", max error " << worst << ", " << differing << " pixels differ by more than 2/255" << endl;
+			break;
 		}
+		case GLFW_KEY_LEFT_BRACKET:
+		case GLFW_KEY_RIGHT_BRACKET:
+		case GLFW_KEY_R:
+			//fewer or more bounces, or Russian roulette from the second bounce on or off
+			if (key == GLFW_KEY_R)
+				traceSettings.rouletteBounce = traceSettings.rouletteBounce ? 0 : 2;
+			else
+				traceSettings.bounces = glm::clamp(traceSettings.bounces + (key == GLFW_KEY_RIGHT_BRACKET ? 1 : -1),
+					1, maxBounce);
+			cout << traceSettings.bounces << " bounces, roulette "
+				<< (traceSettings.rouletteBounce ? "on" : "off") << endl;
+			progressive.trace = traceSettings;
+			progressive.Reset();
+			break;
 		case GLFW_KEY_O:
 			pitchAmt = 0;
 			yawAmt = 0;
 			cameraPosition = vec3(0, 0, 0);
 			break;
-		case GLFW_KEY_1:
-			LoadScene1(program);
-			break;
-		case GLFW_KEY_2:
-			LoadScene2(program);
-			break;
-		case GLFW_KEY_3:
-			LoadScene3(program);
-			break;
-		
 		default:
+			//the number keys load the matching file from scenes/
+			if (key >= GLFW_KEY_1 && key <= GLFW_KEY_9)
+				LoadScene(NumberedScenePath(key - GLFW_KEY_0));
 			break;
 		}
 	}
@@ -881,7 +595,7 @@ void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
 		leftPressed = (action == GLFW_PRESS);
 }
 
-GLuint InitializeShaders()
+GLuint InitializeShaders(const string &defines)
 {
 	string name = "ray";
 	GLuint vertex, fragment;
@@ -894,6 +608,14 @@ GLuint InitializeShaders()
 		return 0;
 	}
 
+	//the defines go after #version, which must come first, and #line keeps
+	//the line numbers of errors those of the file
+	if (!defines.empty())
+	{
+		size_t version = fragmentSource.find('\n') + 1;
+		fragmentSource.insert(version, defines + "#line 2\n");
+	}
+
 	vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
 	fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
 
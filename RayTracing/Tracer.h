@@ -4,63 +4,64 @@
 
 #include "Geometry.h"
 #include "imagebuffer.h"
-struct Sphere {
-	vec4 center;
-	vec4 diffuseColor;
-	vec4 specularColor;
-	float phongExp;
-	float radius;
-	float reflectance;
-	float pad2; //align to 4-float;
-};
-
-struct Plane {
-	vec4 norm;
-	vec4 point;
-	vec4 diffuseColor;
-	vec4 specularColor;
-	float phongExp;
-	float reflectance; 
-	float pad2;//align to 4-float;
-	float pad3;
-
-};
-
-struct Triangle {
-	vec4 A;
-	vec4 B;
-	vec4 C;
-	vec4 diffuseColor;
-	vec4 specularColor;
-	float phongExp;
-	float reflectance; 
-	float pad2;//align to 4-float;
-	float pad3;
-};
-
-struct Light {
-	vec4 center;
-	vec4 color;
-	float radius; //radius = 0 -> point light source
-	float intensity;
-	float padd01;
-	float padd02;
-};
+#include "Scene.h"
+#include "SceneFile.h"
+#include "SceneCache.h"
+#include "CpuTracer.h"
+#include "ProgressiveRender.h"
+#include "Wavefront.h"
+#include "SceneBuffers.h"
+#include "Screenshot.h"
+#include "HdrImage.h"
+#include "Distributed.h"
+#include "CameraPath.h"
+#include "Batch.h"
+#include "CostMap.h"
+#include "ShaderCache.h"
+#include "DynamicResolution.h"
 
 using namespace std;
 
 
-//Prepare scenes for the buffer
-void LoadScene1(GLuint program);
-void LoadScene2(GLuint program);
-void LoadScene3(GLuint program);
+//floor, back wall and a grid of tessellated balls totalling about triangleCount triangles
+Scene MakeSyntheticScene(int triangleCount);
+//floor and a field of instanceCount placements of one icosahedron mesh
+Scene MakeInstancedScene(int instanceCount);
+//replace the scene's lights by count point lights scattered through their
+//spheres, each light's power shared among those taken from it; the light
+//hierarchy must be rebuilt after
+void ScatterLights(Scene &scene, int count);
 
-//load shapes into uniform buffer objects
-void LoadShapes(vector<Sphere> spheres, vector<Triangle> triangle, vector<Plane> planes, vector<Light> lights, GLuint program);
+//load a scene file, through its cache, and make it current for both the
+//shader and the CPU tracer, switching to the build of ray.frag specialised
+//to it; the current scene is kept if loading fails
+bool LoadScene(const string &path);
+//load shapes and the BVH over them into buffers and set the matching
+//uniforms; false if they exceed what the OpenGL implementation allows
+bool LoadShapes(const Scene &scene, const BVH &bvh, GLuint program, SceneBuffers &buffers);
+//set the camera uniforms of ray.frag
+void SetCameraUniforms(GLuint program, const Camera &camera);
+//path length and termination uniforms, matching what the CPU tracer is given
+void SetTraceUniforms(GLuint program, const TraceSettings &settings);
+//one triangle covering the viewport, so no diagonal seam is rasterized twice
+vector<vec2> ScreenQuad();
+//an invisible window with an OpenGL 4.3 context, made current with the
+//loader initialized; null after printing why if there is none
+GLFWwindow *OpenHiddenWindow(int width, int height);
+void CloseHiddenWindow(GLFWwindow *window);
+//trace the scene with ray.frag, specialised to it, into image, in a hidden
+//window of its own; seconds receives the time of the draw alone. False if
+//OpenGL 4.3 or the shaders are unavailable
+bool RenderShader(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	double *seconds = nullptr, const TraceSettings &settings = TraceSettings());
+//camera pose matching the transform uniforms of the current frame
+Camera CurrentCamera();
 //GLFW Callbacks
 void ErrorCallback(int error, const char *description);
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void CursorPosCallback(GLFWwindow *window, double xpos, double ypos);
 void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
 
-GLuint InitializeShaders();
\ No newline at end of file
+//compile and link ray.vert and ray.frag, with the #define lines of a
+//ShaderPermutation put into ray.frag; 0 on failure
+GLuint InitializeShaders(const string &defines = "");
@@ -0,0 +1,273 @@
+#include "Wavefront.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Wave state
+
+//a hit waiting to be shaded: the point, nudged off the surface as Trace does,
+//and what is needed to light it and reflect the ray
+struct Surface {
+	vec3 point;
+	vec3 normal;
+	vec3 ray; //the incoming direction
+	uint32_t material;
+	uint32_t path;
+};
+
+//one wave's paths and the queues of its current bounce. Paths are numbered
+//in the order their pixels were generated, and queue entries refer to them
+//by number
+struct Wave {
+	//per path: its pixel, its weight, and the colour, reflectance and
+	//roulette scale of every bounce, zero (or 1) past its end, to be
+	//combined as Trace combines them
+	vector<ivec2> pixels;
+	vector<float> weights;
+	vector<vec3> local;
+	vector<float> reflectance;
+	vector<float> scale;
+
+	//the rays of the bounce
+	vector<vec3> origins, rays;
+	vector<uint32_t> paths;
+
+	//the bounce's hits in queue order, then binned by material, and the light
+	//each binned hit receives
+	vector<Surface> hits, binned;
+	vector<uint32_t> binNext;
+	vector<vec3> diffuse, specular;
+	OccluderCache occluders;
+	//per binned hit, the light each of its shadow rays heads for and the
+	//factor for what it adds
+	vector<int> shadowLights;
+	vector<float> shares;
+};
+
+// --------------------------------------------------------------------------
+// Stages
+
+//closest hit of every queued ray, keeping the rays that hit something
+static void IntersectRays(const Scene &scene, const BVH &bvh, Wave &wave, int bounce, TraceStats &stats)
+{
+	wave.hits.clear();
+	for (size_t i = 0; i < wave.rays.size(); i++)
+	{
+		vec3 origin = wave.origins[i], ray = wave.rays[i];
+		Hit hit;
+		IntersectClosest(scene, bvh, origin, ray, hit, &stats.tests);
+		if (hit.t < 0)
+			continue;
+		Surface s;
+		vec3 intersect = origin + hit.t * ray;
+		SurfaceAt(scene, hit, intersect, s.normal, s.material);
+		s.point = intersect + 0.00001f * s.normal;
+		s.ray = ray;
+		s.path = wave.paths[i];
+		wave.hits.push_back(s);
+	}
+
+	if (bounce == 0)
+		stats.primaryRays += wave.rays.size();
+	else
+		stats.secondaryRays += wave.rays.size();
+	stats.bounceRays[bounce] += wave.rays.size();
+}
+
+//stable counting sort of the hits by material, so each material is shaded
+//in one run and its hits keep their order, which follows the image
+static void BinByMaterial(const Scene &scene, Wave &wave)
+{
+	wave.binNext.assign(scene.materials.size() + 1, 0);
+	for (const Surface &s : wave.hits)
+		wave.binNext[s.material + 1]++;
+	for (size_t m = 1; m < wave.binNext.size(); m++)
+		wave.binNext[m] += wave.binNext[m - 1];
+	wave.binned.resize(wave.hits.size());
+	for (const Surface &s : wave.hits)
+		wave.binned[wave.binNext[s.material]++] = s;
+}
+
+//shadow rays of every binned hit, once each hit's lights are chosen: one
+//shadow ray of each hit at a time so each run of rays heads for the same
+//light (or draw) while every light gets its own, summing the Phong terms of
+//the lights each hit sees; the same arithmetic, in the same order, as the
+//loop in Trace. Returns the shadow rays per hit
+static int LightHits(const Scene &scene, const BVH &bvh, const TraceSettings &settings, Wave &wave, int bounce,
+	TraceStats &stats)
+{
+	size_t count = wave.binned.size();
+	wave.diffuse.assign(count, vec3(0));
+	wave.specular.assign(count, vec3(0));
+	wave.shadowLights.resize(count * maxLightSamples);
+	wave.shares.resize(count * maxLightSamples);
+	int shadowRays = 0;
+	for (size_t i = 0; i < count; i++)
+		shadowRays = ShadowLights(scene, bvh, settings, wave.binned[i].point, wave.binned[i].normal, bounce,
+			&wave.shadowLights[i * maxLightSamples], &wave.shares[i * maxLightSamples]);
+
+	for (int sample = 0; sample < shadowRays; sample++)
+	{
+		Occluder &last = wave.occluders.Get(sample, bounce);
+		for (size_t i = 0; i < count; i++)
+		{
+			const Surface &s = wave.binned[i];
+			int l = wave.shadowLights[i * maxLightSamples + sample];
+			if (l < 0)
+				continue;
+			const Light &light = scene.lights[l];
+			stats.shadowRays++;
+			vec3 rayToLight = vec3(light.center) - s.point;
+			vec3 rLight = normalize(rayToLight);
+			float dist = length(rayToLight);
+
+			Occluder before = last;
+			if (IntersectAny(scene, bvh, s.point, rLight, dist, &last, &stats.tests))
+			{
+				stats.occludedRays++;
+				if (last.leaf == before.leaf && last.plane == before.plane)
+					stats.occluderCacheHits++;
+				continue;
+			}
+
+			const Material &m = scene.materials[s.material];
+			vec3 shadow = vec3(light.color) * (light.intensity * wave.shares[i * maxLightSamples + sample]);
+			vec3 R = rLight - 2 * (dot(rLight, s.normal)) * s.normal;
+			wave.specular[i] += pow(glm::max(0.f, dot(R, s.ray)), m.phongExp) * shadow;
+			wave.diffuse[i] += glm::max(0.f, dot(rLight, s.normal)) * shadow;
+		}
+	}
+	return shadowRays;
+}
+
+//store the colour each hit adds to its path, and queue its reflection as the
+//next bounce's rays for the paths that go on
+static void FinishBounce(const Scene &scene, const TraceSettings &settings, Wave &wave, int bounce)
+{
+	wave.origins.clear();
+	wave.rays.clear();
+	wave.paths.clear();
+	for (size_t i = 0; i < wave.binned.size(); i++)
+	{
+		const Surface &s = wave.binned[i];
+		const Material &m = scene.materials[s.material];
+		vec3 temp = ambientLight * m.diffuseColor;
+		temp += wave.diffuse[i] * m.diffuseColor;
+		temp += wave.specular[i] * m.specularColor;
+		wave.local[s.path * settings.bounces + bounce] = temp;
+		wave.reflectance[s.path * settings.bounces + bounce] = m.reflectance;
+
+		vec3 ray = s.ray - 2 * (dot(s.ray, s.normal)) * s.normal;
+		float &weight = wave.weights[s.path];
+		weight *= m.reflectance;
+		float gain;
+		if (!ContinuePath(settings, bounce + 1, ray, weight, gain))
+			continue;
+		wave.scale[s.path * settings.bounces + bounce + 1] = gain;
+		wave.origins.push_back(s.point);
+		wave.rays.push_back(ray);
+		wave.paths.push_back(s.path);
+	}
+}
+
+// --------------------------------------------------------------------------
+// Rendering
+
+//trace the pixels of the block at corner through every bounce, and write
+//their colours to image
+static void TraceWave(const Scene &scene, const BVH &bvh, const TraceSettings &settings, const Camera &camera,
+	ImageBuffer *image, ivec2 corner, int edge, Wave &wave, TraceStats &stats)
+{
+	int width = image->Width();
+	int height = image->Height();
+	int x1 = std::min(corner.x + edge, width);
+	int y1 = std::min(corner.y + edge, height);
+
+	wave.pixels.clear();
+	wave.origins.clear();
+	wave.rays.clear();
+	wave.paths.clear();
+	for (int y = corner.y; y < y1; y++)
+		for (int x = corner.x; x < x1; x++)
+		{
+			vec2 pixel = vec2((x + 0.5f) / width, (y + 0.5f) / height) * 2.f - 1.f;
+			vec3 origin, ray;
+			PrimaryRay(camera, pixel, origin, ray, (float)width / height);
+			wave.paths.push_back((uint32_t)wave.pixels.size());
+			wave.pixels.push_back(ivec2(x, y));
+			wave.origins.push_back(origin);
+			wave.rays.push_back(ray);
+		}
+	size_t pathCount = wave.pixels.size();
+	wave.weights.assign(pathCount, 1.f);
+	wave.local.assign(pathCount * settings.bounces, vec3(0));
+	wave.reflectance.assign(pathCount * settings.bounces, 0.f);
+	wave.scale.assign(pathCount * settings.bounces, 1.f);
+	//occluders are node indices into this scene's hierarchy, so none may
+	//survive from a wave of another frame
+	wave.occluders.occluders.assign(maxLightSamples * maxBounce, Occluder());
+
+	//every ray of the wave is timed, since the clock is read once per stage
+	for (int bounce = 0; bounce < settings.bounces && !wave.rays.empty(); bounce++)
+	{
+		size_t rayCount = wave.rays.size();
+		auto bounceStart = chrono::high_resolution_clock::now();
+		IntersectRays(scene, bvh, wave, bounce, stats);
+		BinByMaterial(scene, wave);
+		auto shadowStart = chrono::high_resolution_clock::now();
+		int shadowRays = LightHits(scene, bvh, settings, wave, bounce, stats);
+		auto shadowEnd = chrono::high_resolution_clock::now();
+		FinishBounce(scene, settings, wave, bounce);
+		auto end = chrono::high_resolution_clock::now();
+
+		stats.timedShadowRays += wave.binned.size() * shadowRays;
+		stats.timedShadowSeconds += chrono::duration<double>(shadowEnd - shadowStart).count();
+		stats.timedBounces[bounce] += rayCount;
+		stats.timedBounceSeconds[bounce] += chrono::duration<double>(end - bounceStart).count();
+	}
+
+	for (size_t p = 0; p < pathCount; p++)
+	{
+		const vec3 *local = &wave.local[p * settings.bounces];
+		const float *reflectance = &wave.reflectance[p * settings.bounces];
+		const float *scale = &wave.scale[p * settings.bounces];
+		vec3 reflectedColor = vec3(0);
+		for (int bwdPass = settings.bounces - 1; bwdPass >= 0; bwdPass--)
+		{
+			vec3 temp = local[bwdPass];
+			if (bwdPass < settings.bounces - 1)
+			{
+				float ref = reflectance[bwdPass];
+				temp = (1 - ref) * temp + ref * reflectedColor;
+			}
+			reflectedColor = temp * scale[bwdPass];
+		}
+		image->Row(wave.pixels[p].y)[wave.pixels[p].x] = reflectedColor;
+	}
+}
+
+double RenderWavefront(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	int threads, TraceStats *stats, int edge, const atomic<bool> *cancel, const TraceSettings &settings)
+{
+	auto start = chrono::high_resolution_clock::now();
+
+	int width = image->Width();
+	int height = image->Height();
+	edge = std::max(edge, 1);
+	vector<ivec2> waves = MortonOrder((width + edge - 1) / edge, (height + edge - 1) / edge);
+	ParallelTiles((int)waves.size(), threads, [&](int index, TraceStats &local) {
+		//each thread keeps its queues from one wave to the next
+		thread_local Wave wave;
+		TraceWave(scene, bvh, settings, camera, image, waves[index] * edge, edge, wave, local);
+	}, stats, cancel);
+
+	image->MarkModified(0, height);
+
+	return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <atomic>
+
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "imagebuffer.h"
+
+using namespace glm;
+using namespace std;
+
+//default edge length of the square block of pixels traced as one wave; its
+//paths, queues and hits take a few hundred kilobytes, so a thread's wave
+//stays in cache however large the frame
+const int waveEdge = 64;
+
+//trace the image a stage at a time rather than a pixel at a time. Each wave
+//of pixels, in Morton order, generates all its primary rays into a queue and
+//intersects them together; the hits are binned by material and shaded, the
+//shadow rays cast one light (or one draw of lights) at a time, and the
+//reflections queued for the next bounce of the paths settings let go on. The
+//colour of each bounce is kept per path and combined as Trace does, so the
+//image matches RenderCpu's with the same settings. Waves are shared out to
+//the given number of threads (0 = one per core) like RenderCpu's tiles,
+//stopping between waves once cancel is set; returns seconds taken
+double RenderWavefront(const Scene &scene, const BVH &bvh, const Camera &camera, ImageBuffer *image,
+	int threads = 0, TraceStats *stats = nullptr, int edge = waveEdge, const atomic<bool> *cancel = nullptr,
+	const TraceSettings &settings = TraceSettings());
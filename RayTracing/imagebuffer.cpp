@@ -16,11 +16,13 @@
 // Date:    2016-2018
 // ==========================================================================
 
+#include <algorithm>
 #include <iostream>
 #include <glm/common.hpp>
 
 
 #include "imagebuffer.h"
+#include "HdrImage.h"
 
 // --------------------------------------------------------------------------
 // Set these defines to choose which image library to use for saving image
@@ -71,18 +73,9 @@ bool ImageBuffer::Initialize()
     // retrieve the current viewport size
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
 
     // allocate image data
-    m_imageData.resize(m_width * m_height);
-    for (int i = 0, k = 0; i < m_height; ++i)
-        for (int j = 0; j < m_width; ++j, ++k)
-        {
-            int p = (i >> 4) + (j >> 4);
-            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
-            m_imageData[k] = vec3(c);
-        }
+    Allocate(viewport[2], viewport[3]);
 
     // allocate texture object
     if (!m_textureName)
@@ -109,6 +102,22 @@ bool ImageBuffer::Initialize()
     return status == GL_FRAMEBUFFER_COMPLETE;
 }
 
+void ImageBuffer::Allocate(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+
+    m_imageData.resize(m_width * m_height);
+    for (int i = 0, k = 0; i < m_height; ++i)
+        for (int j = 0; j < m_width; ++j, ++k)
+        {
+            int p = (i >> 4) + (j >> 4);
+            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
+            m_imageData[k] = vec3(c);
+        }
+    ResetModified();
+}
+
 void ImageBuffer::Destroy()
 {
     if (m_framebufferObject) {
@@ -130,8 +139,23 @@ void ImageBuffer::SetPixel(int x, int y, vec3 colour)
 
     // mark that something was changed
     m_modified = true;
-    m_modifiedLower = min(m_modifiedLower, y);
-    m_modifiedUpper = max(m_modifiedUpper, y+1);
+    m_modifiedLower = std::min(m_modifiedLower, y);
+    m_modifiedUpper = std::max(m_modifiedUpper, y+1);
+}
+
+void ImageBuffer::SetRegion(int x, int y, int width, int height, const vec3 *pixels)
+{
+    for (int row = 0; row < height; ++row)
+        std::copy(pixels + row * width, pixels + (row + 1) * width,
+                  m_imageData.begin() + (y + row) * m_width + x);
+    MarkModified(y, y + height);
+}
+
+void ImageBuffer::MarkModified(int lower, int upper)
+{
+    m_modified = true;
+    m_modifiedLower = std::min(m_modifiedLower, lower);
+    m_modifiedUpper = std::max(m_modifiedUpper, upper);
 }
 
 // --------------------------------------------------------------------------
@@ -175,6 +199,10 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
     }
     cout << "ImageBuffer saving image to " << imageFileName << "..." << endl;
 
+    // .pfm and .exr keep the float colours as they are, without clamping
+    if (IsHdrPath(imageFileName))
+        return SaveHdr(*this, imageFileName);
+
 #ifdef USE_STB_IMAGE
     const unsigned numComponents = 3; //RGB
     unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
@@ -186,9 +214,9 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
             int i = (m_height - 1 - y) * m_width + x;
             i *= numComponents;
 
-            pixels[i]     = (unsigned char) (255 * clamp(color.r, 0.f, 1.f));	// red
-            pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
-            pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
+            pixels[i]     = (unsigned char) (255 * glm::clamp(color.r, 0.f, 1.f));	// red
+            pixels[i + 1] = (unsigned char) (255 * glm::clamp(color.g, 0.f, 1.f));	// green
+            pixels[i + 2] = (unsigned char) (255 * glm::clamp(color.b, 0.f, 1.f));	// blue
         }
 
     // Save the image to disk
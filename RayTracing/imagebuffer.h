@@ -61,15 +61,31 @@ public:
     // call this if you need to delete the framebuffer object and texture
     void Destroy();
 
+    // allocates the pixel data only, without any OpenGL objects, so that an
+    // image can be rendered and saved without a window
+    void Allocate(int width, int height);
+
     // set a pixel in this image buffer to a specified colour:
     //  - (0,0) is the bottom-left pixel of the image
     //  - colour is RGB given as floating point numbers in the range [0,1]
     void SetPixel(int x, int y, glm::vec3 colour);
 
+    // copy a width x height block of tightly packed pixels, bottom row first
+    // as glReadPixels returns them, with its bottom-left corner at (x,y);
+    // the rows are marked modified once rather than per pixel
+    void SetRegion(int x, int y, int width, int height, const glm::vec3 *pixels);
+
+    // direct access to a row of pixels, for renderers that fill the buffer in
+    // bulk; call MarkModified() with the range of rows written afterwards
+    glm::vec3 *Row(int y) { return &m_imageData[y * m_width]; }
+    const glm::vec3 *Row(int y) const { return &m_imageData[y * m_width]; }
+    void MarkModified(int lower, int upper);
+
     // call this in your render function to copy this image onto your screen
     void Render();
 
-    // call this at the end of your render to save the image to file
+    // call this at the end of your render to save the image to file; a .pfm
+    // or .exr name keeps the float colours, see HdrWriter
     bool SaveToFile(const std::string &imageFileName);
 };
 
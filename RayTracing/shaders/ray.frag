@@ -26,11 +26,11 @@ struct Plane
     float reflectance;
 };
 
+//toBarycentric holds the rows of the world to barycentric transform, the
+//last of which is the normal over its squared length; see TriangleLanes
 struct Triangle
 {
-    vec4 A;
-    vec4 B;
-    vec4 C;
+    vec4 toBarycentric[3];
     vec4 diffuseColor;
     vec4 specularColor;
     float phongExp;
@@ -45,30 +45,111 @@ struct Light
     float intensity;
 };
 
-layout(std140, binding = 1) uniform SphereData
+//one placement of a mesh; toMesh holds the rows of the world to mesh transform
+struct Instance
 {
-    Sphere sphere[50];
+    vec4 toMesh[3];
+    vec4 diffuseColor;
+    vec4 specularColor;
+    float phongExp;
+    float reflectance;
+    uint root; //node of the mesh's own hierarchy
+};
+
+struct BVHNode
+{
+    vec3 boundsMin;
+    uint leftFirst; //interior: index of the left child (right is +1); leaf: first primitive
+    vec3 boundsMax;
+    uint count;     //primitives in a leaf, 0 for interior nodes; sphereLeafBit and instanceLeafBit mark the kind
+};
+
+//one node of the hierarchy over the lights; see LightTree.h
+struct LightNode
+{
+    vec3 center; //of a sphere around the lights below
+    float radius;
+    float power;
+    uint child; //interior: index of the left child (right is +1); leaf: the light, with lightLeafBit
+    float leftPower; //the left child's power
+};
+
+//scene arrays, sized by the scene; spheres and triangles are in the leaf
+//order of the BVH so a leaf is a contiguous range of one of them
+layout(std430, binding = 1) readonly buffer SphereData
+{
+    Sphere sphere[];
+};
+layout(std430, binding = 2) readonly buffer TriangleData
+{
+    Triangle triangle[];
+};
+layout(std430, binding = 3) readonly buffer PlaneData
+{
+    Plane plane[];
+};
+layout(std430, binding = 4) readonly buffer LightData
+{
+    Light light[];
 };
-layout(std140, binding = 2) uniform TriangleData
+layout(std430, binding = 5) readonly buffer BVHData
 {
-    Triangle triangle[50];
+    BVHNode node[];
 };
-layout(std140, binding = 3) uniform PlaneData
+layout(std430, binding = 6) readonly buffer BVHSkipData
 {
-    Plane plane[50];
+    int skip[];
 };
-layout(std140, binding = 4) uniform LightData
+layout(std430, binding = 7) readonly buffer InstanceData
 {
-    Light light[50];
+    Instance instance[];
+};
+//the toBarycentric rows of every mesh triangle, three to a triangle, in mesh space
+layout(std430, binding = 8) readonly buffer MeshTriangleData
+{
+    vec4 meshTriangle[];
+};
+layout(std430, binding = 9) readonly buffer LightNodeData
+{
+    LightNode lightNode[];
 };
 
-//for iterating over
-uniform int numSpheres;
-uniform int numTriangles;
+//for iterating over. A build specialised to a scene (see ShaderCache.h) has
+//them as constants, and NO_SPHERES, NO_TRIANGLES, NO_INSTANCES and
+//NO_REFLECTION defined for what the scene lacks, so its loops unroll and
+//the branches for those are compiled out
+#ifdef NUM_PLANES
+const int numPlanes = NUM_PLANES;
+#else
 uniform int numPlanes;
+#endif
+#ifdef NUM_LIGHTS
+const int numLights = NUM_LIGHTS;
+#else
 uniform int numLights;
-
-const int numBounce = 4; //the number of bounces which will be made
+#endif
+#if defined(NO_SPHERES) && defined(NO_TRIANGLES) && defined(NO_INSTANCES)
+const int numNodes = 0;
+#else
+uniform int numNodes; //0 when there are no spheres or triangles
+#endif
+
+const uint sphereLeafBit = 0x80000000u;
+const uint instanceLeafBit = 0x40000000u;
+const uint lightLeafBit = 0x80000000u;
+
+const int maxBounce = 8; //the most bounces a path may take
+#ifdef NO_REFLECTION
+const int tracedPasses = 1; //nothing reflects, so every path ends at its first hit
+#else
+const int tracedPasses = maxBounce;
+#endif
+uniform int bounces; //the number of bounces which will be made, up to maxBounce
+uniform float minWeight; //paths whose reflected weight falls to this end early
+uniform int rouletteBounce; //first bounce ended by Russian roulette, 0 = none
+uniform int lightSamples; //shadow rays per point, drawn from lightNode[], once there are more lights
+const int maxLightSamples = 16; //the most lightSamples may be
+const float lightSpreadLimit = 0.125; //radius over distance below which a node's lights are drawn by power
 const vec3 ambientLight = vec3(0.1, 0.1, 0.1);
 uniform vec3 cameraOrigin;
 uniform float fov;
@@ -83,11 +164,25 @@ vec3 trace(vec3 origin, vec3 ray, int depth);
 //calculate a direction vector from which px on screen we are rendering
 vec3 directionFromPixel(vec2 pixel);
 float vecToMagnitude(vec3 v);
+//whether a path whose reflections so far leave weight goes on to the given
+//bounce along ray; a roulette survivor's weight is reset to 1 and scale gets
+//the factor that keeps its colour unbiased. The same test as the CPU tracer's
+bool continuePath(int bounce, vec3 ray, inout float weight, out float scale);
+//the light the draw'th shadow ray of a point heads for and the factor for
+//what it adds, -1 if none can reach the point; as ShadowLights in CpuTracer.h
+int shadowLight(vec3 point, vec3 normal, int bounce, int draw, out float share);
 
 //determine intersection point for ray from origin, and selected shape in selected shape index
 float intersectSphere(vec3 origin, vec3 ray, int sphereIndex);
 float intersectPlane(vec3 origin, vec3 ray, int planeIndex);
 float intersectTriangle(vec3 origin, vec3 ray, int triangleIndex);
+float intersectMeshTriangle(vec3 origin, vec3 ray, int triangleIndex);
+//any-hit query: true as soon as any shape is hit with 0 <= t <= dist
+bool occluded(vec3 origin, vec3 ray, float dist);
+//closest sphere or triangle through the BVH, updating minT (-1 = none yet), objectType and index;
+//for the triangle of an instance's mesh also hitInstance
+void intersectBVH(vec3 origin, vec3 ray, inout float minT, inout int objectType, inout int index,
+    inout int hitInstance);
 
 
 
@@ -105,35 +200,32 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
     vec3 phong;
 
     //fwdPass collects the following information
-    vec3 specularCalc[numBounce];  //max(0, dot(R, V)^P) * shadow
-    vec3 diffuseCalc[numBounce];   //max(0, dot(L, N))   * shadow
-    float reflectance[numBounce];
-    vec3 diffuseColor[numBounce];
-    vec3 specularColor[numBounce];
-    for(int fwdPass = 0; fwdPass < numBounce; fwdPass++){
-
-        specularCalc[fwdPass] = vec3(0,0,0);  //max(0, dot(R, V)^P) * shadow
-        diffuseCalc[fwdPass] = vec3(0,0,0);   //max(0, dot(L, N))   * shadow
-        reflectance[fwdPass] = 0;
-        diffuseColor[fwdPass] = vec3(0,0,0);
-        specularColor[fwdPass] = vec3(0,0,0);
+    vec3 specularCalc[maxBounce];  //max(0, dot(R, V)^P) * shadow
+    vec3 diffuseCalc[maxBounce];   //max(0, dot(L, N))   * shadow
+    float reflectance[maxBounce];
+    vec3 diffuseColor[maxBounce];
+    vec3 specularColor[maxBounce];
+    float scale[maxBounce];        //roulette's factor for what a pass and those after it gather
+    for(int pass = 0; pass < maxBounce; pass++){
+        specularCalc[pass] = vec3(0,0,0);
+        diffuseCalc[pass] = vec3(0,0,0);
+        reflectance[pass] = 0;
+        diffuseColor[pass] = vec3(0,0,0);
+        specularColor[pass] = vec3(0,0,0);
+        scale[pass] = 1;
+    }
+    float weight = 1;
+    for(int fwdPass = 0; fwdPass < bounces && fwdPass < tracedPasses; fwdPass++){
+
         //find intersection point and type of object
-        int objectType = -1; //0 = sphere; 1 = plane; 2 = triangle
+        int objectType = -1; //0 = sphere; 1 = plane; 2 = triangle; 3 = triangle of an instance's mesh
+        int index = -1;
+        int hitInstance = -1;
         Sphere s;
         Plane p;
         Triangle t;
 
         float minT = -1;
-        for (int i = 0; i < numSpheres; i++)
-        {
-            float test = intersectSphere(origin, ray, i);
-            if (test > 0 && (minT < 0 || test < minT))
-            {
-                minT = test;
-                objectType = 0;
-                s = sphere[i];
-            }
-        }
         for (int i = 0; i < numPlanes; i++)
         {
             float test = intersectPlane(origin, ray, i);
@@ -141,31 +233,33 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
             {
                 minT = test;
                 objectType = 1;
-                p = plane[i];
-            }
-        }
-        for (int i = 0; i < numTriangles; i++)
-        {
-            float test = intersectTriangle(origin, ray, i);
-            if (test > 0 && (minT < 0 || test < minT))
-            {
-                minT = test;
-                objectType = 2;
-                t = triangle[i];
+                index = i;
             }
         }
-
-        //no intersection
-        if (minT < 0){
-            diffuseColor[fwdPass] = vec3(0,0,0);
-            specularColor[fwdPass] = vec3(0,0,0);
-        }
+        intersectBVH(origin, ray, minT, objectType, index, hitInstance);
+#ifndef NO_SPHERES
+        if (objectType == 0)
+            s = sphere[index];
+#endif
+        if (objectType == 1)
+            p = plane[index];
+#ifndef NO_TRIANGLES
+        if (objectType == 2)
+            t = triangle[index];
+#endif
+
+        //no intersection: this pass and every later one keep their zeroed
+        //colours; shading on would use an undefined normal, which comes out
+        //as NaN or garbage on some implementations
+        if (minT < 0)
+            break;
         //collect data from intersected object:
         vec3 normal;
         float phongExp;
         vec3 intersect = origin + minT * ray;
         switch (objectType)
         {
+#ifndef NO_SPHERES
         case 0:
             diffuseColor[fwdPass] = s.diffuseColor.xyz;
             specularColor[fwdPass] = s.specularColor.xyz;
@@ -174,6 +268,7 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
 
             normal = normalize(intersect - s.center.xyz);
             break;
+#endif
         case 1:
             diffuseColor[fwdPass] = p.diffuseColor.xyz;
             specularColor[fwdPass] = p.specularColor.xyz;
@@ -182,29 +277,46 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
 
             normal = normalize(p.norm.xyz);
             break;
+#ifndef NO_TRIANGLES
         case 2:
             diffuseColor[fwdPass] = t.diffuseColor.xyz;
             specularColor[fwdPass] = t.specularColor.xyz;
             reflectance[fwdPass] = t.reflectance;
             phongExp = t.phongExp;
 
-            vec3 A = t.A.xyz;
-            vec3 B = t.B.xyz;
-            vec3 C = t.C.xyz;
-
-            vec3 N = B - A;
-            vec3 M = C - A;
-            normal = normalize(cross(N, M));
+            normal = normalize(t.toBarycentric[2].xyz);
+            break;
+#endif
+#ifndef NO_INSTANCES
+        case 3:
+            Instance inst = instance[hitInstance];
+            diffuseColor[fwdPass] = inst.diffuseColor.xyz;
+            specularColor[fwdPass] = inst.specularColor.xyz;
+            reflectance[fwdPass] = inst.reflectance;
+            phongExp = inst.phongExp;
+
+            //out of mesh space by the transpose of toMesh
+            vec3 local = meshTriangle[3 * index + 2].xyz;
+            normal = normalize(local.x * inst.toMesh[0].xyz + local.y * inst.toMesh[1].xyz
+                + local.z * inst.toMesh[2].xyz);
             break;
+#endif
         default:
             // No intersection. Don't set anything
             break;
         }
         intersect = intersect + 0.00001 * normal;
         
-        //collect phong lighting for each light source
-        for (int l = 0; l < numLights; l++)
+        //collect phong lighting for each light source, or for a few drawn
+        //from the hierarchy when there are many
+        int samples = clamp(lightSamples, 1, maxLightSamples);
+        int shadowRays = numLights > samples ? samples : numLights;
+        for (int k = 0; k < shadowRays; k++)
         {
+            float share;
+            int l = shadowLight(intersect, normal, fwdPass, k, share);
+            if (l < 0)
+                continue;
             //check if in shadow from light, sum shadow
             vec3 center = light[l].center.xyz;
             vec3 rayToLight = center - intersect;
@@ -213,34 +325,11 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
             float dist = vecToMagnitude(rayToLight);
            
          
-            bool found = false;
             //check if an object is between light and object
-            for (int i = 0; i < numSpheres && !found; i++)
-            {
-                //move slightly in direction of normal
-                float test = intersectSphere(intersect, rLight, i);
-                if (test >= 0 && test <= dist)
-                    found = true;
-            }
-
-            for (int i = 0; i < numPlanes && !found; i++)
-            {
-                float test = intersectPlane(intersect, rLight, i);
-                if (test >= 0 && test <= dist)
-                    found = true;
-            }
-
-            for (int i = 0; i < numTriangles && !found; i++)
-            {
-                float test = intersectTriangle(intersect, rLight, i);
-                if (test >= 0 && test <= dist)
-                    found = true;
-            }
-
-            if (found)
+            if (occluded(intersect, rLight, dist))
                 shadow += vec3(0, 0, 0);
             else
-                shadow += light[l].color.xyz * light[l].intensity;
+                shadow += light[l].color.xyz * (light[l].intensity * share);
             
             vec3 R = rLight - 2 * (dot(rLight, normal)) * normal;
             //calculate phong data
@@ -252,27 +341,145 @@ vec3 trace(vec3 origin, vec3 ray, int depth)
         
         ray = ray - 2 * (dot(ray, normal)) * normal;
         origin = intersect;
+
+        //passes not traced keep their zeroed colours, like those after a miss
+        weight *= reflectance[fwdPass];
+        float gain;
+        if (!continuePath(fwdPass + 1, ray, weight, gain))
+            break;
+        scale[fwdPass + 1] = gain;
     }
 
-    vec3 reflectedColor[numBounce];
-    for(int bwdPass = numBounce - 1; bwdPass >= 0; bwdPass--){
+    //what the passes after bwdPass gather. The loop runs over every pass, those
+    //past the last bounce adding nothing, so its bounds stay constant: a loop
+    //from the bounces uniform came out wrong in whole blocks of pixels on Mesa
+    vec3 reflectedColor = vec3(0,0,0);
+    for(int bwdPass = tracedPasses - 1; bwdPass >= 0; bwdPass--){
         vec3 temp = vec3(0,0,0);
         
 
 		temp += ambientLight * diffuseColor[bwdPass];
         temp += diffuseCalc[bwdPass] * diffuseColor[bwdPass];
         temp += specularCalc[bwdPass] * specularColor[bwdPass];
-        if (bwdPass < numBounce - 1){
+        if (bwdPass < bounces - 1){
             float ref = reflectance[bwdPass];
-            temp = (1 - ref) * temp + ref * reflectedColor[bwdPass + 1];
+            temp = (1 - ref) * temp + ref * reflectedColor;
         }
 
         
-        reflectedColor[bwdPass] = temp;
+        reflectedColor = temp * scale[bwdPass];
     }
 
-    return reflectedColor[0];
+    return reflectedColor;
+
+}
+
+//a number in [0, 1) hashed from the bits of a point or direction and a salt,
+//so roulette and light sampling need no random state and are repeatable
+float hashSample(vec3 v, int salt)
+{
+    uvec3 bits = floatBitsToUint(v);
+    uint h = bits.x * 0x9E3779B1u ^ bits.y * 0x85EBCA77u ^ bits.z * 0xC2B2AE3Du ^ uint(salt);
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return float(h >> 8) * (1.0 / 16777216.0);
+}
+
+bool continuePath(int bounce, vec3 ray, inout float weight, out float scale)
+{
+    scale = 1;
+    if (bounce >= bounces || !(weight > minWeight))
+        return false;
+    if (rouletteBounce > 0 && bounce >= rouletteBounce && weight < 1)
+    {
+        if (hashSample(ray, bounce) >= weight)
+            return false;
+        scale = 1 / weight;
+        weight = 1;
+    }
+    return true;
+}
+
+//the lights of a node can add at most their power times a bound on the
+//cosine between the normal and a direction into the node's sphere
+float lightImportance(LightNode n, vec3 point, vec3 normal)
+{
+    vec3 toNode = n.center - point;
+    float dist = length(toNode);
+    if (dist <= n.radius)
+        return n.power;
+    float cosBound = (dot(toNode, normal) + n.radius) / (dist - n.radius);
+    return n.power * clamp(cosBound, 0, 1);
+}
+
+int shadowLight(vec3 point, vec3 normal, int bounce, int draw, out float share)
+{
+    share = 1;
+    int samples = clamp(lightSamples, 1, maxLightSamples);
+    if (numLights <= 1 || numLights <= samples)
+        return draw;
+
+    //descend from the root, taking each child in proportion to its
+    //importance with u rescaled to the branch taken, until the node looks
+    //small from the point; below it, u runs through that node's power
+    float u = (draw + hashSample(point, bounce)) / samples;
+    float pdf = 1;
+    if (!(lightImportance(lightNode[0], point, normal) > 0))
+        return -1;
+    uint index = 0;
+    bool byPower = false;
+    float topPower = 1;
+    //no deeper than there are lights; bounded like the walks in intersectBVH
+    for (int level = 0; level < numLights && (lightNode[index].child & lightLeafBit) == 0; level++)
+    {
+        LightNode n = lightNode[index];
+        uint left = n.child;
+        if (!byPower)
+        {
+            vec3 toNode = n.center - point;
+            if (n.radius * n.radius < lightSpreadLimit * lightSpreadLimit * dot(toNode, toNode))
+            {
+                byPower = true;
+                topPower = n.power;
+                u *= topPower;
+            }
+        }
+        if (byPower)
+        {
+            bool right = u >= n.leftPower;
+            u -= right ? n.leftPower : 0;
+            index = left + (right ? 1 : 0);
+            continue;
+        }
 
+        float leftImportance = lightImportance(lightNode[left], point, normal);
+        float rightImportance = lightImportance(lightNode[left + 1], point, normal);
+        if (!(leftImportance + rightImportance > 0))
+            return -1;
+        float pLeft = leftImportance / (leftImportance + rightImportance);
+        u = min(u, 0.99999994);
+        if (u < pLeft)
+        {
+            index = left;
+            u = u / pLeft;
+            pdf *= pLeft;
+        }
+        else
+        {
+            index = left + 1;
+            u = (u - pLeft) / (1 - pLeft);
+            pdf *= 1 - pLeft;
+        }
+    }
+    if (byPower)
+        pdf *= lightNode[index].power / topPower;
+    if (!(pdf > 0))
+        return -1;
+    share = 1 / (pdf * samples);
+    return int(lightNode[index].child & ~lightLeafBit);
 }
 
 float vecToMagnitude(vec3 v)
@@ -288,6 +495,208 @@ vec3 directionFromPixel(vec2 pixel)
     return normalize(dir);
 }
 
+//reciprocal direction with zero components nudged away from 0, as on the CPU
+vec3 inverseRay(vec3 ray)
+{
+    vec3 safe = mix(vec3(1e-20), ray, greaterThan(abs(ray), vec3(1e-20)));
+    return 1 / safe;
+}
+
+//distance at which the ray enters a node's box, or -1 if it misses it before tMax
+float intersectBounds(BVHNode n, vec3 origin, vec3 invRay, float tMax)
+{
+    vec3 t0 = (n.boundsMin - origin) * invRay;
+    vec3 t1 = (n.boundsMax - origin) * invRay;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return (enter <= exit) ? enter : -1;
+}
+
+//move a ray into the space of instance k's mesh; distances along it stay the same
+void toMesh(int k, inout vec3 origin, inout vec3 ray)
+{
+    vec4 o = vec4(origin, 1);
+    vec4 d = vec4(ray, 0);
+    origin = vec3(dot(instance[k].toMesh[0], o), dot(instance[k].toMesh[1], o), dot(instance[k].toMesh[2], o));
+    ray = vec3(dot(instance[k].toMesh[0], d), dot(instance[k].toMesh[1], d), dot(instance[k].toMesh[2], d));
+}
+
+//closest triangle of instance k's mesh, whose hierarchy ends in the skip link
+//of its root
+void intersectMesh(int k, vec3 origin, vec3 ray, inout float minT, inout int objectType, inout int index,
+    inout int hitInstance)
+{
+    const float far = 1e30;
+    toMesh(k, origin, ray);
+    vec3 invRay = inverseRay(ray);
+    int i = int(instance[k].root);
+    for (int visited = 0; visited < numNodes && i >= 0; visited++)
+    {
+        BVHNode n = node[i];
+        int next = skip[i];
+        float tMax = (minT < 0) ? far : minT;
+        if (intersectBounds(n, origin, invRay, tMax) >= 0)
+        {
+            if (n.count == 0)
+                next = int(n.leftFirst);
+            for (uint j = 0; j < n.count; j++)
+            {
+                int t = int(n.leftFirst + j);
+                float test = intersectMeshTriangle(origin, ray, t);
+                if (test > 0 && (minT < 0 || test < minT))
+                {
+                    minT = test;
+                    objectType = 3;
+                    index = t;
+                    hitInstance = k;
+                }
+            }
+        }
+        i = next;
+    }
+}
+
+//the kind of a leaf from its count, constant when the scene lacks the others
+bool sphereLeaf(uint count)
+{
+#if defined(NO_SPHERES)
+    return false;
+#elif defined(NO_TRIANGLES) && defined(NO_INSTANCES)
+    return true;
+#else
+    return (count & sphereLeafBit) != 0;
+#endif
+}
+
+bool instanceLeaf(uint count)
+{
+#if defined(NO_INSTANCES)
+    return false;
+#elif defined(NO_SPHERES) && defined(NO_TRIANGLES)
+    return true;
+#else
+    return (count & instanceLeafBit) != 0;
+#endif
+}
+
+void intersectBVH(vec3 origin, vec3 ray, inout float minT, inout int objectType, inout int index,
+    inout int hitInstance)
+{
+    if (numNodes == 0)
+        return;
+
+    const float far = 1e30;
+    vec3 invRay = inverseRay(ray);
+    int i = 0;
+    //a walk along the skip links visits each node at most once, so the node
+    //count bounds it. Every walk has that bound: on Mesa a walk with none,
+    //inside the light loop, lost the later shadow rays of whole blocks of
+    //pixels where the screen triangle is split
+    for (int visited = 0; visited < numNodes && i >= 0; visited++)
+    {
+        BVHNode n = node[i];
+        int next = skip[i];
+        float tMax = (minT < 0) ? far : minT;
+        if (intersectBounds(n, origin, invRay, tMax) >= 0)
+        {
+            uint count = n.count & ~(sphereLeafBit | instanceLeafBit);
+            bool spheres = sphereLeaf(n.count);
+            bool instances = instanceLeaf(n.count);
+            if (count == 0)
+                next = int(n.leftFirst);
+            for (uint j = 0; j < count; j++)
+            {
+                int k = int(n.leftFirst + j);
+                if (instances)
+                {
+                    intersectMesh(k, origin, ray, minT, objectType, index, hitInstance);
+                    continue;
+                }
+                float test = spheres ? intersectSphere(origin, ray, k) : intersectTriangle(origin, ray, k);
+                if (test > 0 && (minT < 0 || test < minT))
+                {
+                    minT = test;
+                    objectType = spheres ? 0 : 2;
+                    index = k;
+                }
+            }
+        }
+        i = next;
+    }
+}
+
+//true if any triangle of instance k's mesh is hit with 0 <= t <= dist
+bool occludedMesh(int k, vec3 origin, vec3 ray, float dist)
+{
+    toMesh(k, origin, ray);
+    vec3 invRay = inverseRay(ray);
+    int i = int(instance[k].root);
+    for (int visited = 0; visited < numNodes && i >= 0; visited++)
+    {
+        BVHNode n = node[i];
+        int next = skip[i];
+        if (intersectBounds(n, origin, invRay, dist) >= 0)
+        {
+            if (n.count == 0)
+                next = int(n.leftFirst);
+            for (uint j = 0; j < n.count; j++)
+            {
+                float test = intersectMeshTriangle(origin, ray, int(n.leftFirst + j));
+                if (test >= 0 && test <= dist)
+                    return true;
+            }
+        }
+        i = next;
+    }
+    return false;
+}
+
+bool occluded(vec3 origin, vec3 ray, float dist)
+{
+    //return at the first occluder rather than finishing every loop
+    for (int i = 0; i < numPlanes; i++)
+    {
+        float test = intersectPlane(origin, ray, i);
+        if (test >= 0 && test <= dist)
+            return true;
+    }
+    if (numNodes == 0)
+        return false;
+
+    vec3 invRay = inverseRay(ray);
+    int i = 0;
+    for (int visited = 0; visited < numNodes && i >= 0; visited++)
+    {
+        BVHNode n = node[i];
+        int next = skip[i];
+        if (intersectBounds(n, origin, invRay, dist) >= 0)
+        {
+            uint count = n.count & ~(sphereLeafBit | instanceLeafBit);
+            bool spheres = sphereLeaf(n.count);
+            bool instances = instanceLeaf(n.count);
+            if (count == 0)
+                next = int(n.leftFirst);
+            for (uint j = 0; j < count; j++)
+            {
+                int k = int(n.leftFirst + j);
+                if (instances)
+                {
+                    if (occludedMesh(k, origin, ray, dist))
+                        return true;
+                    continue;
+                }
+                float test = spheres ? intersectSphere(origin, ray, k) : intersectTriangle(origin, ray, k);
+                if (test >= 0 && test <= dist)
+                    return true;
+            }
+        }
+        i = next;
+    }
+    return false;
+}
+
 float intersectSphere(vec3 origin, vec3 ray, int i)
 {
 
@@ -324,47 +733,28 @@ float intersectPlane(vec3 origin, vec3 ray, int i)
     return t;
 }
 
-float intersectTriangle(vec3 origin, vec3 ray, int i)
+//the plane is w = 0 in the triangle's barycentric space; a ray parallel to it
+//gets an infinite or NaN t, for which u or v fail
+float intersectTriangleRows(vec3 origin, vec3 ray, vec4 U, vec4 V, vec4 W)
 {
-
-    vec3 A = triangle[i].A.xyz;
-    vec3 B = triangle[i].B.xyz;
-    vec3 C = triangle[i].C.xyz;
-
-    vec3 N = B - A;
-    vec3 M = C - A;
-
-    vec3 pvec = cross(ray, M);
-    float det = dot(N, pvec);
-
-    float invDet = 1 / det;
-
-    vec3 tvec = origin - A;
-
-    float u = dot(tvec, pvec) * invDet;
-    if (u < 0 || u > 1)
+    float t = -(dot(W.xyz, origin) + W.w) / dot(W.xyz, ray);
+    if (!(t > 0))
         return -1;
+    vec3 p = origin + t * ray;
+    float u = dot(U.xyz, p) + U.w;
+    float v = dot(V.xyz, p) + V.w;
+    return (u >= 0 && v >= 0 && u + v <= 1) ? t : -1;
+}
 
-    vec3 qvec = cross(tvec, N);
-    float v = dot(ray, qvec) * invDet;
-    if (v < 0 || u + v > 1)
-        return -1;
-
-    float t = dot(M, qvec) * invDet;
-
-    vec3 norm = cross(N, M);
-
-    //same plane calc
-    vec3 o = origin;
-    vec3 d = ray;
-    vec3 q = A;
-    vec3 n = normalize(norm);
+float intersectTriangle(vec3 origin, vec3 ray, int i)
+{
+    return intersectTriangleRows(origin, ray, triangle[i].toBarycentric[0], triangle[i].toBarycentric[1],
+        triangle[i].toBarycentric[2]);
+}
 
-    float qn = dot(q, n);
-    float on = dot(o, n);
-    float dn = dot(d, n);
-    float p = (qn - on) / dn;
-    return p;
+float intersectMeshTriangle(vec3 origin, vec3 ray, int i)
+{
+    return intersectTriangleRows(origin, ray, meshTriangle[3 * i], meshTriangle[3 * i + 1], meshTriangle[3 * i + 2]);
 }
 
 float rand(vec2 co)